@@ -40,6 +40,9 @@
 
 #include <tf/transform_datatypes.h>
 
+#include <cmath>
+#include <vector>
+
 namespace push_msgs = tams_ur5_push_msgs;
 
 namespace push_execution
@@ -68,6 +71,16 @@ namespace push_execution
       prevent_collision_ = prevent_collision;
     }
 
+    /*
+     * Penalize uncertain pushes by weight * sqrt(trace(covariance)) of the Monte-Carlo
+     * dropout prediction. Needs a model with Dropout layers, 0 disables the penalty.
+     */
+    void setUncertaintyPenalty(double weight, size_t samples=32)
+    {
+      uncertainty_penalty_ = weight;
+      uncertainty_samples_ = samples;
+    }
+
     void pushObjectToGoal(const geometry_msgs::Pose& goal, double goal_threshold=0.05)
     {
       pushObjectToGoal(execution_->getObjectPose(), goal, goal_threshold);
@@ -116,6 +129,8 @@ namespace push_execution
     push_prediction::PushPredictor predictor_;
     DistanceMode distance_mode_ = SE2;
     bool prevent_collision_ = false;
+    double uncertainty_penalty_ = 0.0;
+    size_t uncertainty_samples_ = 32;
 
     bool sampleTo(const geometry_msgs::Pose& start, geometry_msgs::Pose goal, push_msgs::Push& result, bool minimize=true)
     {
@@ -129,15 +144,35 @@ namespace push_execution
       geometry_msgs::Pose pose;
       pose.orientation.w = 1.0;
       double best_distance = getDistance(pose, goal);
-      for (int i=0;i<100;i++) {
-        sampler_.sampleRandomPush(push);
-        predictor_.predict(push, pose);
-        double distance = getDistance(pose, goal);
+      const bool penalize = uncertainty_penalty_ > 0.0 && predictor_.hasUncertainty();
+      std::vector<Eigen::Matrix3d> covariances;
+
+      // all samples are predicted as one batch, with the uncertainty penalty including their dropout samples
+      std::vector<push_msgs::Push> pushes(100);
+      for (push_msgs::Push& sample : pushes)
+        sampler_.sampleRandomPush(sample);
+      Eigen::Matrix3Xd steps;
+      if (penalize)
+        predictor_.predictUncertainty(pushes, steps, covariances, uncertainty_samples_);
+      else
+        predictor_.predictBatch(pushes, steps);
+
+      for (size_t i=0;i<pushes.size();i++) {
+        push = pushes[i];
+        // with uncertainty penalty steps holds the mean predictions
+        const double penalty = penalize ? uncertainty_penalty_ * std::sqrt(covariances[i].trace()) : 0.0;
+        pose.position.x = steps(0, i);
+        pose.position.y = steps(1, i);
+        pose.position.z = 0.0;
+        tf::quaternionTFToMsg(tf::createQuaternionFromYaw(steps(2, i)), pose.orientation);
+        // uncertain pushes look further when approaching and closer when pushing away
+        double distance = getDistance(pose, goal) + (minimize ? penalty : -penalty);
         if( minimize ^ distance > best_distance ) {
           best_distance = distance;
           result = push;
         }
       }
+      return true;
     }
 
     double getDistance(const geometry_msgs::Pose& start, const geometry_msgs::Pose& goal){
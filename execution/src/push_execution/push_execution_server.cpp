@@ -67,6 +67,7 @@ class PushExecutionServer {
     bool execute_= false;
     bool take_snapshots_ = false;
     bool record_ft_data_ = false;
+    double uncertainty_penalty_ = 0.0;
 
     int id_count_ = 0;
 
@@ -195,6 +196,7 @@ class PushExecutionServer {
       greedy_pushing_ = new GreedyPushing(push_execution_);
       greedy_pushing_->setDistanceMode(GreedyPushing::DistanceMode::SE2);
       greedy_pushing_->setPreventCollision(true);
+      greedy_pushing_->setUncertaintyPenalty(uncertainty_penalty_);
       greedy_pushing_->pushObjectToGoal(goal.target);
       move_object_server_.setSucceeded();
       service_busy_ = false;
@@ -350,6 +352,7 @@ class PushExecutionServer {
     pnh.param("take_snapshots", take_snapshots_, false);
     pnh.param("record_ft_data", record_ft_data_, false);
     pnh.param("execute", execute_, false);
+    pnh.param("uncertainty_penalty", uncertainty_penalty_, 0.0);
     point_service_ = nh.advertiseService("point_at_box", &PushExecutionServer::pointAtBox, this);
     push_execution_service_ = nh.advertiseService("push_execution", &PushExecutionServer::executePush, this);
     push_sampler_= nh.serviceClient<tams_ur5_push_msgs::SamplePredictivePush>("predictive_push_sampler");
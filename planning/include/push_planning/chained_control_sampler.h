@@ -39,6 +39,7 @@
 #include <ompl/control/SimpleDirectedControlSampler.h>
 
 #include <push_planning/conversions.h>
+#include <push_planning/push_state_propagator.h>
 
 namespace ob = ompl::base;
 namespace oc = ompl::control;
@@ -103,6 +104,11 @@ namespace push_planning {
             control->as<oc::RealVectorControlSpace::ControlType>()->values[0] = std::fmod(dist_(gen) * 0.1 + previous_approach, 1.0);
         }
 
+        // with the push propagator the steps of all candidates are predicted as one batch
+        const auto *propagator = dynamic_cast<const PushStatePropagator*>(si_->getStatePropagator().get());
+        if (propagator != nullptr)
+          return getBestControlBatch(*propagator, control, source, dest, previous_approach);
+
         const unsigned int minDuration = si_->getMinControlDuration();
         const unsigned int maxDuration = si_->getMaxControlDuration();
 
@@ -144,5 +150,73 @@ namespace push_planning {
 
         return steps;
       }
+
+      /*
+       * getBestControl for the push propagator: the first control is already sampled, the k-1 others and the
+       * step counts are sampled in the same order. The push of a planner control does not depend on the state,
+       * so the steps of all candidates are predicted as one batch and each candidate repeats its step
+       * while the states stay valid, as propagateWhileValid does.
+       */
+      unsigned int getBestControlBatch(const PushStatePropagator& propagator, oc::Control *control, const ob::State *source,
+          ob::State *dest, double previous_approach)
+      {
+        const unsigned int minDuration = si_->getMinControlDuration();
+        const unsigned int maxDuration = si_->getMaxControlDuration();
+        const unsigned int samples = std::max(numControlSamples_, 1u);
+
+        double *values = control->as<oc::RealVectorControlSpace::ControlType>()->values;
+        oc::Control *tempControl = si_->allocControl();
+        double *tempValues = tempControl->as<oc::RealVectorControlSpace::ControlType>()->values;
+        Eigen::Matrix3Xd controls(3, samples), steps;
+        std::vector<unsigned int> stepCounts(samples);
+        for (unsigned int i = 0; i < samples; ++i)
+        {
+          if (i > 0)
+          {
+            cs_->sample(tempControl, source);
+            if (previous_approach > 0.0)
+              tempValues[0] = std::fmod(dist_(gen) * 0.1 + previous_approach, 1.0);
+          }
+          controls.col(i) = Eigen::Map<const Eigen::Vector3d>(i == 0 ? values : tempValues);
+          stepCounts[i] = cs_->sampleStepCount(minDuration, maxDuration);
+        }
+        si_->freeControl(tempControl);
+        propagator.predictSteps(controls, steps, si_->getPropagationStepSize());
+
+        // save the control that gets closest to target
+        ob::State *bestState = si_->allocState();
+        ob::State *tempState = si_->allocState();
+        ob::State *nextState = si_->allocState();
+        double bestDistance = 0.0;
+        unsigned int best = 0, bestSteps = 0;
+        for (unsigned int i = 0; i < samples; ++i)
+        {
+          si_->copyState(tempState, source);
+          unsigned int sampleSteps = 0;
+          for (; sampleSteps < stepCounts[i]; ++sampleSteps)
+          {
+            propagator.applyStep(tempState, steps.col(i), nextState);
+            if (!si_->isValid(nextState))
+              break;
+            si_->copyState(tempState, nextState);
+          }
+          double tempDistance = si_->distance(tempState, dest);
+          if (i == 0 || tempDistance < bestDistance)
+          {
+            si_->copyState(bestState, tempState);
+            bestDistance = tempDistance;
+            best = i;
+            bestSteps = sampleSteps;
+          }
+        }
+        Eigen::Map<Eigen::Vector3d>(values) = controls.col(best);
+
+        si_->copyState(dest, bestState);
+        si_->freeState(nextState);
+        si_->freeState(tempState);
+        si_->freeState(bestState);
+
+        return bestSteps;
+      }
   };
 }
@@ -0,0 +1,162 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+#pragma once
+
+#include <push_planning/obstacle_footprints.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace push_planning {
+
+  /*
+   * Signed distance of the box footprint to the obstacles (see ObstacleFootprints::distance) rasterized over
+   * the workspace: one 2D field per yaw slice over half a turn, as the footprint is symmetric.
+   * clearance() interpolates trilinearly in constant time. The distance changes by at most the translation and
+   * the box radius times the rotation, which bounds the interpolation error (errorBound()).
+   */
+  class ClearanceField
+  {
+    private:
+      const std::shared_ptr<const ObstacleFootprints> obstacles_;
+
+      double min_;
+      double resolution_;
+      size_t cells_;
+      size_t yaw_steps_;
+      double yaw_resolution_;
+      double error_bound_;
+
+      // slice-major, then y, then x
+      std::vector<float> values_;
+
+      float value(size_t slice, size_t ix, size_t iy) const
+      {
+        return values_[(slice * cells_ + iy) * cells_ + ix];
+      }
+
+    public:
+      /*
+       * Rasterize the footprint distance for positions in [min, max]^2 at the given resolution and yaw_steps
+       * slices, split across threads (0: one per core).
+       */
+      ClearanceField(const std::shared_ptr<const ObstacleFootprints>& obstacles, double min, double max,
+          double resolution = 0.01, size_t yaw_steps = 36, unsigned int threads = 0)
+        : obstacles_(obstacles), min_(min), resolution_(resolution),
+        cells_(std::max<size_t>(2, std::ceil((max - min) / resolution) + 1)),
+        yaw_steps_(std::max<size_t>(1, yaw_steps)), yaw_resolution_(M_PI / yaw_steps_)
+      {
+        const double box_radius = std::hypot(0.5 * dimX, 0.5 * dimY);
+        // the interpolation weights average the distances to the grid points to at most
+        // resolution / sqrt(2) in position and half a slice in yaw
+        error_bound_ = resolution_ / std::sqrt(2.0) + 0.5 * box_radius * yaw_resolution_;
+
+        values_.resize(yaw_steps_ * cells_ * cells_);
+        if(threads == 0)
+          threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::min<unsigned int>(threads, yaw_steps_);
+        auto rasterize = [this, threads](unsigned int thread) {
+          for(size_t slice = thread; slice < yaw_steps_; slice += threads) {
+            const double yaw = slice * yaw_resolution_;
+            for(size_t iy = 0; iy < cells_; iy++)
+              for(size_t ix = 0; ix < cells_; ix++)
+                values_[(slice * cells_ + iy) * cells_ + ix] = obstacles_->distance(min_ + ix * resolution_, min_ + iy * resolution_, yaw);
+          }
+        };
+        std::vector<std::thread> workers;
+        for(unsigned int thread = 1; thread < threads; thread++)
+          workers.emplace_back(rasterize, thread);
+        rasterize(0);
+        for(std::thread& worker : workers)
+          worker.join();
+      }
+
+      /*
+       * Interpolated signed distance of the footprint at (x, y, yaw), within errorBound() of the exact one.
+       * Outside of the field it is reduced by the distance to the field, a lower bound.
+       */
+      double clearance(double x, double y, double yaw) const
+      {
+        // positions outside the field lose at most their distance to it
+        const double max = min_ + (cells_ - 1) * resolution_;
+        const double cx = std::min(std::max(x, min_), max);
+        const double cy = std::min(std::max(y, min_), max);
+        const double outside = std::hypot(x - cx, y - cy);
+
+        const double fx = std::min((cx - min_) / resolution_, cells_ - 1.0 - 1e-9);
+        const double fy = std::min((cy - min_) / resolution_, cells_ - 1.0 - 1e-9);
+        double fyaw = (yaw - std::floor(yaw / M_PI) * M_PI) / yaw_resolution_;
+        const size_t ix = fx, iy = fy;
+        const size_t slice = std::min<size_t>(fyaw, yaw_steps_ - 1);
+        // the slice after the last one is the first
+        const size_t next = slice + 1 < yaw_steps_ ? slice + 1 : 0;
+        const double tx = fx - ix, ty = fy - iy, tyaw = std::min(fyaw - slice, 1.0);
+
+        double result = 0.0;
+        for(int s = 0; s < 2; s++) {
+          const size_t k = s ? next : slice;
+          const double bottom = (1 - tx) * value(k, ix, iy) + tx * value(k, ix + 1, iy);
+          const double top = (1 - tx) * value(k, ix, iy + 1) + tx * value(k, ix + 1, iy + 1);
+          result += (s ? tyaw : 1 - tyaw) * ((1 - ty) * bottom + ty * top);
+        }
+        return result - outside;
+      }
+
+      double errorBound() const
+      {
+        return error_bound_;
+      }
+
+      // whether the footprint is free of obstacles, exact checks only within the error bound of an obstacle
+      bool isFree(double x, double y, double yaw) const
+      {
+        const double distance = clearance(x, y, yaw);
+        if(distance > error_bound_)
+          return true;
+        const double max = min_ + (cells_ - 1) * resolution_;
+        const bool inside = x >= min_ && x <= max && y >= min_ && y <= max;
+        if(inside && distance < -error_bound_)
+          return false;
+        return !obstacles_->collides(x, y, yaw);
+      }
+
+      size_t size() const
+      {
+        return values_.size();
+      }
+  };
+}
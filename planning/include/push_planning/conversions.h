@@ -60,8 +60,7 @@ const std::string object_frame = "pushable_object_0";
 namespace ob = ompl::base;
 namespace oc = ompl::control;
 
-void convertControlToPush(const oc::Control *control, tams_ur5_push_msgs::Push& push) {
-  const double* ctrl = control->as<oc::RealVectorControlSpace::ControlType>()->values;
+void convertControlToPush(const double* ctrl, tams_ur5_push_msgs::Push& push) {
   //retrieve approach point from pivot and box dimensions
   geometry_msgs::Pose pose = push_sampler::PushSampler::getPoseFromBoxBorder(ctrl[0], dimX, dimY, dimZ);
   push.approach.point = pose.position;
@@ -73,6 +72,64 @@ void convertControlToPush(const oc::Control *control, tams_ur5_push_msgs::Push&
   push.distance = ctrl[2] * 0.05;
 }
 
+void convertControlToPush(const oc::Control *control, tams_ur5_push_msgs::Push& push) {
+  convertControlToPush(control->as<oc::RealVectorControlSpace::ControlType>()->values, push);
+}
+
+/*
+ * Derivatives of (approach.point.x, approach.point.y, approach.angle, distance)
+ * with respect to the control as converted by convertControlToPush.
+ * The approach point moves linearly along each side of the box.
+ */
+Eigen::Matrix<double, 4, 3> controlToPushJacobian(const double* ctrl) {
+  Eigen::Matrix<double, 4, 3> jacobian = Eigen::Matrix<double, 4, 3>::Zero();
+  const double perimeter = 2 * (dimX + dimY);
+  const double p = ctrl[0] * perimeter;
+  if(p <= dimX)
+    jacobian(0, 0) = perimeter;
+  else if(p <= dimX + dimY)
+    jacobian(1, 0) = perimeter;
+  else if(p <= 2 * dimX + dimY)
+    jacobian(0, 0) = -perimeter;
+  else
+    jacobian(1, 0) = -perimeter;
+  jacobian(2, 1) = 0.5 * M_PI;
+  jacobian(3, 2) = 0.05;
+  return jacobian;
+}
+
+/*
+ * Pushes whose prediction inputs span all pushes of the control box [lower, upper]:
+ * the ends of the pivot range on each touched side of the box (the normal is constant
+ * along a side) with the lowest and highest angle and distance.
+ */
+void controlBoxToPushes(const double* lower, const double* upper, std::vector<tams_ur5_push_msgs::Push>& pushes) {
+  const double perimeter = 2 * (dimX + dimY);
+  const double sides[5] = { 0.0, dimX / perimeter, (dimX + dimY) / perimeter, (2 * dimX + dimY) / perimeter, 1.0 };
+  pushes.clear();
+  tams_ur5_push_msgs::Push push;
+  double ctrl[3];
+  for(int side = 0; side < 4; side++) {
+    const double begin = std::fmax(lower[0], sides[side]);
+    const double end = std::fmin(upper[0], sides[side + 1]);
+    if(begin > end || (begin == end && lower[0] < upper[0]))
+      continue;
+    // the center decides the side for pivots on a corner
+    const double center = 0.5 * (begin + end);
+    for(double pivot : { begin, end }) {
+      ctrl[0] = center;
+      for(int extreme = 0; extreme < 2; extreme++) {
+        ctrl[1] = extreme ? upper[1] : lower[1];
+        ctrl[2] = extreme ? upper[2] : lower[2];
+        convertControlToPush(ctrl, push);
+        geometry_msgs::Pose pose = push_sampler::PushSampler::getPoseFromBoxBorder(pivot, dimX, dimY, dimZ);
+        push.approach.point = pose.position;
+        pushes.push_back(push);
+      }
+    }
+  }
+}
+
 void convertPushToControl(const tams_ur5_push_msgs::Push& push, oc::RealVectorControlSpace::ControlType *ctrl) {
   //retrieve approach point from pivot and box dimensions
   ctrl->values = new double[3];
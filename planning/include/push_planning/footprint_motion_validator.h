@@ -0,0 +1,149 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+#pragma once
+
+#include <ompl/base/MotionValidator.h>
+#include <ompl/base/SpaceInformation.h>
+#include <ompl/base/spaces/SE2StateSpace.h>
+#include <ompl/control/DirectedControlSampler.h>
+#include <ompl/control/SpaceInformation.h>
+
+#include <push_planning/obstacle_footprints.h>
+#include <push_prediction/profiling.h>
+
+#include <memory>
+#include <utility>
+
+namespace ob = ompl::base;
+namespace oc = ompl::control;
+
+namespace push_planning {
+
+  // whether the swept footprint of the box collides between two SE(2) states (see ObstacleFootprints::sweepCollides)
+  inline bool sweepCollides(const ObstacleFootprints& obstacles, const ob::State *from, const ob::State *to)
+  {
+    PUSH_PREDICTION_PROFILE_NAMED_SCOPE("planning/motion check ns");
+    const auto *s1 = from->as<ob::SE2StateSpace::StateType>();
+    const auto *s2 = to->as<ob::SE2StateSpace::StateType>();
+    return obstacles.sweepCollides(s1->getX(), s1->getY(), s1->getYaw(), s2->getX(), s2->getY(), s2->getYaw());
+  }
+
+  /*
+   * Motions of the geometric planner checked by the swept footprint of the box instead of interpolated
+   * states, against the same obstacle footprints as the FootprintValidityChecker.
+   */
+  class FootprintMotionValidator : public ob::MotionValidator
+  {
+    private:
+      const std::shared_ptr<const ObstacleFootprints> obstacles_;
+
+    public:
+      FootprintMotionValidator(const ob::SpaceInformationPtr &si, const std::shared_ptr<const ObstacleFootprints>& obstacles)
+        : ob::MotionValidator(si), obstacles_(obstacles)
+      { }
+
+      bool checkMotion(const ob::State *s1, const ob::State *s2) const override
+      {
+        if(!si_->isValid(s2) || sweepCollides(*obstacles_, s1, s2)) {
+          invalid_++;
+          return false;
+        }
+        valid_++;
+        return true;
+      }
+
+      // without interpolation the last valid state of a colliding motion is its start
+      bool checkMotion(const ob::State *s1, const ob::State *s2, std::pair<ob::State *, double> &lastValid) const override
+      {
+        if(checkMotion(s1, s2))
+          return true;
+        if(lastValid.first != nullptr)
+          si_->copyState(lastValid.first, s1);
+        lastValid.second = 0.0;
+        return false;
+      }
+  };
+
+  /*
+   * Directed control sampler that checks the swept footprint of each propagation step of the sampled control,
+   * as control planners only check the states between steps. The steps are cut at the first colliding motion,
+   * like propagateWhileValid does at the first invalid state, so a single-step push that clips an obstacle
+   * yields no motion. The predicted box motion of a push is approximated by the linear SE(2) motion between its states.
+   */
+  class MotionCheckingControlSampler : public oc::DirectedControlSampler
+  {
+    private:
+      const oc::DirectedControlSamplerPtr sampler_;
+      const std::shared_ptr<const ObstacleFootprints> obstacles_;
+
+      unsigned int checkSteps(const oc::Control *control, const ob::State *source, ob::State *dest, unsigned int steps)
+      {
+        if(steps == 0)
+          return 0;
+        // the sampler already propagated the single step
+        if(steps == 1)
+          return sweepCollides(*obstacles_, source, dest) ? 0 : 1;
+
+        ob::State *from = si_->cloneState(source);
+        ob::State *to = si_->allocState();
+        unsigned int valid = 0;
+        for(; valid < steps; valid++) {
+          si_->getStatePropagator()->propagate(from, control, si_->getPropagationStepSize(), to);
+          if(sweepCollides(*obstacles_, from, to))
+            break;
+          std::swap(from, to);
+        }
+        si_->copyState(dest, from);
+        si_->freeState(from);
+        si_->freeState(to);
+        return valid;
+      }
+
+    public:
+      MotionCheckingControlSampler(const oc::SpaceInformation *si, const oc::DirectedControlSamplerPtr& sampler,
+          const std::shared_ptr<const ObstacleFootprints>& obstacles)
+        : oc::DirectedControlSampler(si), sampler_(sampler), obstacles_(obstacles)
+      { }
+
+      unsigned int sampleTo(oc::Control *control, const ob::State *source, ob::State *dest) override
+      {
+        return checkSteps(control, source, dest, sampler_->sampleTo(control, source, dest));
+      }
+
+      unsigned int sampleTo(oc::Control *control, const oc::Control *previous, const ob::State *source, ob::State *dest) override
+      {
+        return checkSteps(control, source, dest, sampler_->sampleTo(control, previous, source, dest));
+      }
+  };
+}
@@ -0,0 +1,96 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+#pragma once
+
+#include <ompl/base/SpaceInformation.h>
+#include <ompl/base/spaces/SE2StateSpace.h>
+#include <ompl/base/StateValidityChecker.h>
+
+#include <push_planning/clearance_field.h>
+#include <push_planning/obstacle_footprints.h>
+#include <push_prediction/profiling.h>
+
+#include <memory>
+
+namespace ob = ompl::base;
+
+namespace push_planning {
+
+  /*
+   * Validity of SE(2) states by the footprint of the box on the table (see ObstacleFootprints).
+   * With a clearance field, states away from obstacles are decided by a lookup and clearance() is
+   * interpolated from the field. Without shared mutable state, so concurrent planners can use the same footprints.
+   * PushStateValidityChecker remains as the exact check in the MoveIt planning scene including the robot.
+   */
+  class FootprintValidityChecker : public ob::StateValidityChecker
+  {
+    private:
+      const std::shared_ptr<const ObstacleFootprints> obstacles_;
+      const std::shared_ptr<const ClearanceField> field_;
+
+    public:
+      FootprintValidityChecker(const ob::SpaceInformationPtr &si, const std::shared_ptr<const ObstacleFootprints>& obstacles,
+          const std::shared_ptr<const ClearanceField>& field = nullptr)
+        : ob::StateValidityChecker(si), obstacles_(obstacles), field_(field)
+      {
+        specs_.clearanceComputationType = field_ ? ob::StateValidityCheckerSpecs::BOUNDED_APPROXIMATE : ob::StateValidityCheckerSpecs::EXACT;
+      }
+
+      bool isValid(const ob::State *state) const override
+      {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("planning/collision check ns");
+        const auto *se2state = state->as<ob::SE2StateSpace::StateType>();
+        if(!si_->satisfiesBounds(state))
+          return false;
+        if(field_)
+          return field_->isFree(se2state->getX(), se2state->getY(), se2state->getYaw());
+        return !obstacles_->collides(se2state->getX(), se2state->getY(), se2state->getYaw());
+      }
+
+      bool isValid(const ob::State *state, double &dist) const override
+      {
+        dist = clearance(state);
+        return isValid(state);
+      }
+
+      // signed distance of the footprint to the closest obstacle
+      double clearance(const ob::State *state) const override
+      {
+        const auto *se2state = state->as<ob::SE2StateSpace::StateType>();
+        if(field_)
+          return field_->clearance(se2state->getX(), se2state->getY(), se2state->getYaw());
+        return obstacles_->distance(se2state->getX(), se2state->getY(), se2state->getYaw());
+      }
+  };
+}
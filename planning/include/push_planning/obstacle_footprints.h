@@ -0,0 +1,404 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+#pragma once
+
+#include <moveit/planning_scene/planning_scene.h>
+#include <geometric_shapes/shapes.h>
+
+#include <push_planning/conversions.h>
+
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/StdVector>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace push_planning {
+
+  /*
+   * Footprints of the obstacles on the table as convex polygons in the table plane, for collision checks
+   * of the pushed box at SE(2) states. The box is tested against each obstacle with the separating axis
+   * theorem after a bounding circle test. Immutable once built, so any number of planners can share it.
+   */
+  class ObstacleFootprints
+  {
+    private:
+      struct Polygon {
+        // counter-clockwise vertices and outward unit normals of the edges (vertices i, i + 1)
+        Eigen::Matrix2Xd vertices;
+        Eigen::Matrix2Xd normals;
+        // n_i * vertex_i, the extent of the polygon along normal i
+        Eigen::VectorXd offsets;
+        // bounding circle
+        Eigen::Vector2d center;
+        double radius;
+      };
+
+      std::vector<Polygon, Eigen::aligned_allocator<Polygon>> polygons_;
+
+      // half extents of the box footprint and its bounding radius
+      double half_x_;
+      double half_y_;
+      double box_radius_;
+
+      // convex hull (Andrew's monotone chain), counter-clockwise without collinear points
+      static Eigen::Matrix2Xd convexHull(std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> points)
+      {
+        std::sort(points.begin(), points.end(), [](const Eigen::Vector2d& a, const Eigen::Vector2d& b) {
+            return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+        });
+        auto cross = [](const Eigen::Vector2d& o, const Eigen::Vector2d& a, const Eigen::Vector2d& b) {
+          return (a.x() - o.x()) * (b.y() - o.y()) - (a.y() - o.y()) * (b.x() - o.x());
+        };
+        std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> hull(2 * points.size());
+        size_t k = 0;
+        for(size_t i = 0; i < points.size(); i++) {
+          while(k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0)
+            k--;
+          hull[k++] = points[i];
+        }
+        for(size_t i = points.size() - 1, lower = k + 1; i-- > 0;) {
+          while(k >= lower && cross(hull[k - 2], hull[k - 1], points[i]) <= 0)
+            k--;
+          hull[k++] = points[i];
+        }
+        // the last point repeats the first
+        const size_t count = k > 1 ? k - 1 : k;
+        Eigen::Matrix2Xd vertices(2, count);
+        for(size_t i = 0; i < count; i++)
+          vertices.col(i) = hull[i];
+        return vertices;
+      }
+
+      // points of a shape in its frame whose convex hull contains the shape, round shapes use circumscribed polygons
+      static bool shapePoints(const shapes::Shape& shape, std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d>>& points)
+      {
+        const int sides = 16;
+        auto addCircle = [&](double radius, double z) {
+          radius /= std::cos(M_PI / sides);
+          for(int i = 0; i < sides; i++)
+            points.emplace_back(radius * std::cos(2 * M_PI * i / sides), radius * std::sin(2 * M_PI * i / sides), z);
+        };
+        switch(shape.type) {
+          case shapes::BOX: {
+            const double* size = static_cast<const shapes::Box&>(shape).size;
+            for(int i = 0; i < 8; i++)
+              points.emplace_back((i & 1 ? 0.5 : -0.5) * size[0], (i & 2 ? 0.5 : -0.5) * size[1], (i & 4 ? 0.5 : -0.5) * size[2]);
+            return true;
+          }
+          case shapes::CYLINDER: {
+            const auto& cylinder = static_cast<const shapes::Cylinder&>(shape);
+            addCircle(cylinder.radius, -0.5 * cylinder.length);
+            addCircle(cylinder.radius, 0.5 * cylinder.length);
+            return true;
+          }
+          case shapes::CONE: {
+            const auto& cone = static_cast<const shapes::Cone&>(shape);
+            addCircle(cone.radius, -0.5 * cone.length);
+            points.emplace_back(0.0, 0.0, 0.5 * cone.length);
+            return true;
+          }
+          case shapes::SPHERE: {
+            const double radius = static_cast<const shapes::Sphere&>(shape).radius;
+            addCircle(radius, -radius);
+            addCircle(radius, radius);
+            return true;
+          }
+          case shapes::MESH: {
+            // non-convex meshes are checked by their hull
+            const auto& mesh = static_cast<const shapes::Mesh&>(shape);
+            for(unsigned int i = 0; i < mesh.vertex_count; i++)
+              points.emplace_back(mesh.vertices[3 * i], mesh.vertices[3 * i + 1], mesh.vertices[3 * i + 2]);
+            return mesh.vertex_count > 0;
+          }
+          default:
+            return false;
+        }
+      }
+
+    public:
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+      ObstacleFootprints(double dim_x = dimX, double dim_y = dimY)
+        : half_x_(0.5 * dim_x), half_y_(0.5 * dim_y), box_radius_(std::hypot(half_x_, half_y_))
+      { }
+
+      /*
+       * Add the footprints of the world objects of the scene that reach into the height of the box
+       * (resting on the table, from 0 to dim_z in the table frame). The robot is not included.
+       */
+      void addScene(const planning_scene::PlanningScene& scene, const std::string& table_frame = "table_top", double dim_z = dimZ)
+      {
+        // the checker of the scene lifts the box 1 mm above the table
+        const double min_z = 0.001;
+        const double max_z = dim_z + 0.001;
+        const auto table = scene.getFrameTransform(table_frame).inverse();
+        const collision_detection::WorldConstPtr& world = scene.getWorld();
+        std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d>> points;
+        std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> footprint;
+        for(const std::string& id : world->getObjectIds()) {
+          const collision_detection::World::ObjectConstPtr object = world->getObject(id);
+          for(size_t i = 0; i < object->shapes_.size(); i++) {
+            points.clear();
+            if(!shapePoints(*object->shapes_[i], points)) {
+              ROS_WARN("shape %lu of object '%s' has no footprint, it is ignored by collision checks", (unsigned long) i, id.c_str());
+              continue;
+            }
+            const auto pose = table * object->shape_poses_[i];
+            double lowest = std::numeric_limits<double>::infinity();
+            double highest = -lowest;
+            footprint.clear();
+            for(const Eigen::Vector3d& point : points) {
+              const Eigen::Vector3d p = pose * point;
+              lowest = std::min(lowest, p.z());
+              highest = std::max(highest, p.z());
+              footprint.push_back(p.head<2>());
+            }
+            if(highest > min_z && lowest < max_z)
+              addPolygon(footprint);
+          }
+        }
+      }
+
+      // add the footprint of the convex hull of the points
+      void addPolygon(const std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>>& points)
+      {
+        if(points.empty())
+          return;
+        Polygon polygon;
+        polygon.vertices = convexHull(points);
+        const int count = polygon.vertices.cols();
+        polygon.normals.resize(2, count);
+        polygon.offsets.resize(count);
+        for(int i = 0; i < count; i++) {
+          const Eigen::Vector2d edge = polygon.vertices.col((i + 1) % count) - polygon.vertices.col(i);
+          // degenerate polygons (points, segments) keep zero normals, which never separate
+          const double length = edge.norm();
+          polygon.normals.col(i) = length > 0.0 ? Eigen::Vector2d(edge.y() / length, -edge.x() / length) : Eigen::Vector2d::Zero();
+          polygon.offsets(i) = polygon.normals.col(i).dot(polygon.vertices.col(i));
+        }
+        polygon.center = polygon.vertices.rowwise().mean();
+        polygon.radius = (polygon.vertices.colwise() - polygon.center).colwise().norm().maxCoeff();
+        polygons_.push_back(polygon);
+      }
+
+      size_t size() const
+      {
+        return polygons_.size();
+      }
+
+      // same box and obstacle polygons, so what was derived from the footprints of an unchanged scene can be reused
+      bool operator==(const ObstacleFootprints& other) const
+      {
+        return half_x_ == other.half_x_ && half_y_ == other.half_y_ && polygons_.size() == other.polygons_.size() &&
+          std::equal(polygons_.begin(), polygons_.end(), other.polygons_.begin(), [](const Polygon& a, const Polygon& b) {
+              return a.vertices.cols() == b.vertices.cols() && a.vertices == b.vertices;
+          });
+      }
+
+      // whether the box footprint at (x, y, yaw) overlaps an obstacle
+      bool collides(double x, double y, double yaw) const
+      {
+        const Eigen::Vector2d position(x, y);
+        const Eigen::Vector2d axis_x(std::cos(yaw), std::sin(yaw));
+        const Eigen::Vector2d axis_y(-axis_x.y(), axis_x.x());
+        for(const Polygon& polygon : polygons_) {
+          const double reach = polygon.radius + box_radius_;
+          if((polygon.center - position).squaredNorm() > reach * reach)
+            continue;
+
+          // axes of the box
+          double min_x = std::numeric_limits<double>::infinity(), max_x = -min_x;
+          double min_y = min_x, max_y = max_x;
+          for(int i = 0; i < polygon.vertices.cols(); i++) {
+            const Eigen::Vector2d relative = polygon.vertices.col(i) - position;
+            const double along_x = axis_x.dot(relative);
+            const double along_y = axis_y.dot(relative);
+            min_x = std::min(min_x, along_x);
+            max_x = std::max(max_x, along_x);
+            min_y = std::min(min_y, along_y);
+            max_y = std::max(max_y, along_y);
+          }
+          if(min_x > half_x_ || max_x < -half_x_ || min_y > half_y_ || max_y < -half_y_)
+            continue;
+
+          // edge normals of the obstacle
+          bool separated = false;
+          for(int i = 0; i < polygon.normals.cols() && !separated; i++) {
+            const Eigen::Vector2d normal = polygon.normals.col(i);
+            const double extent = half_x_ * std::abs(normal.dot(axis_x)) + half_y_ * std::abs(normal.dot(axis_y));
+            separated = normal.dot(position) - extent > polygon.offsets(i);
+          }
+          if(!separated)
+            return true;
+        }
+        return false;
+      }
+
+      /*
+       * Whether the box footprint overlaps an obstacle anywhere on the motion from (x0, y0, yaw0) to (x1, y1, yaw1),
+       * interpolated linearly in SE(2) along the shorter rotation. Conservative without interpolating states:
+       * the swept area lies in the convex hull of both footprints grown by the largest deviation of a point of the box
+       * from its chord, box_radius (1 - cos(rotation / 2)). Rotations beyond max_rotation are split in halves to keep
+       * that margin small. Both end states are covered, but should be checked by collides() first, which is cheaper.
+       */
+      bool sweepCollides(double x0, double y0, double yaw0, double x1, double y1, double yaw1, double max_rotation = M_PI / 8) const
+      {
+        const double rotation = std::remainder(yaw1 - yaw0, 2.0 * M_PI);
+        if(std::abs(rotation) > max_rotation) {
+          const double x = 0.5 * (x0 + x1), y = 0.5 * (y0 + y1), yaw = yaw0 + 0.5 * rotation;
+          return sweepCollides(x0, y0, yaw0, x, y, yaw, max_rotation) || sweepCollides(x, y, yaw, x1, y1, yaw1, max_rotation);
+        }
+        const double margin = box_radius_ * (1.0 - std::cos(0.5 * rotation));
+        const Eigen::Vector2d center(0.5 * (x0 + x1), 0.5 * (y0 + y1));
+        const double radius = 0.5 * std::hypot(x1 - x0, y1 - y0) + box_radius_ + margin;
+        if(std::none_of(polygons_.begin(), polygons_.end(), [&](const Polygon& polygon) {
+              return (polygon.center - center).norm() <= polygon.radius + radius;
+            }))
+          return false;
+
+        std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> corners;
+        corners.reserve(8);
+        for(const Eigen::Vector3d& pose : {Eigen::Vector3d(x0, y0, yaw0), Eigen::Vector3d(x1, y1, yaw1)}) {
+          const Eigen::Vector2d axis_x(std::cos(pose.z()), std::sin(pose.z()));
+          const Eigen::Vector2d axis_y(-axis_x.y(), axis_x.x());
+          for(int i = 0; i < 4; i++)
+            corners.push_back(pose.head<2>() + (i & 1 ? half_x_ : -half_x_) * axis_x + (i & 2 ? half_y_ : -half_y_) * axis_y);
+        }
+        const Eigen::Matrix2Xd hull = convexHull(corners);
+        const int count = hull.cols();
+
+        for(const Polygon& polygon : polygons_) {
+          const double reach = polygon.radius + radius;
+          if((polygon.center - center).squaredNorm() > reach * reach)
+            continue;
+
+          // edge normals of the obstacle, its extent along normal i is offsets(i)
+          bool separated = false;
+          for(int i = 0; i < polygon.normals.cols() && !separated; i++) {
+            const Eigen::Vector2d normal = polygon.normals.col(i);
+            if(normal.isZero())
+              continue;
+            double lowest = std::numeric_limits<double>::infinity();
+            for(int j = 0; j < count; j++)
+              lowest = std::min(lowest, normal.dot(hull.col(j)));
+            separated = lowest - margin > polygon.offsets(i);
+          }
+
+          // edge normals of the hull
+          for(int i = 0; i < count && !separated; i++) {
+            const Eigen::Vector2d edge = hull.col((i + 1) % count) - hull.col(i);
+            const double length = edge.norm();
+            if(length == 0.0)
+              continue;
+            const Eigen::Vector2d normal(edge.y() / length, -edge.x() / length);
+            double lowest = std::numeric_limits<double>::infinity();
+            for(int j = 0; j < polygon.vertices.cols(); j++)
+              lowest = std::min(lowest, normal.dot(polygon.vertices.col(j)));
+            separated = lowest > normal.dot(hull.col(i)) + margin;
+          }
+          if(!separated)
+            return true;
+        }
+        return false;
+      }
+
+      /*
+       * Signed distance between the box footprint at (x, y, yaw) and the closest obstacle:
+       * the gap if they are apart, minus the penetration depth (smallest separating translation) if they
+       * overlap. Capped at max_distance, which is returned without obstacles.
+       */
+      double distance(double x, double y, double yaw, double max_distance = 1.0) const
+      {
+        const Eigen::Vector2d position(x, y);
+        const Eigen::Vector2d axis_x(std::cos(yaw), std::sin(yaw));
+        const Eigen::Vector2d axis_y(-axis_x.y(), axis_x.x());
+        Eigen::Matrix<double, 2, 4> corners;
+        for(int i = 0; i < 4; i++)
+          corners.col(i) = position + (i == 1 || i == 2 ? half_x_ : -half_x_) * axis_x + (i >= 2 ? half_y_ : -half_y_) * axis_y;
+
+        double closest = max_distance;
+        for(const Polygon& polygon : polygons_) {
+          // beyond the closest obstacle so far
+          if((polygon.center - position).norm() - polygon.radius - box_radius_ >= closest)
+            continue;
+
+          // largest gap along the separating axes, negative if they overlap
+          double min_x = std::numeric_limits<double>::infinity(), max_x = -min_x;
+          double min_y = min_x, max_y = max_x;
+          for(int i = 0; i < polygon.vertices.cols(); i++) {
+            const Eigen::Vector2d relative = polygon.vertices.col(i) - position;
+            min_x = std::min(min_x, axis_x.dot(relative));
+            max_x = std::max(max_x, axis_x.dot(relative));
+            min_y = std::min(min_y, axis_y.dot(relative));
+            max_y = std::max(max_y, axis_y.dot(relative));
+          }
+          double gap = std::max(std::max(min_x - half_x_, -half_x_ - max_x), std::max(min_y - half_y_, -half_y_ - max_y));
+          for(int i = 0; i < polygon.normals.cols(); i++) {
+            const Eigen::Vector2d normal = polygon.normals.col(i);
+            if(normal.isZero())
+              continue;
+            const double extent = half_x_ * std::abs(normal.dot(axis_x)) + half_y_ * std::abs(normal.dot(axis_y));
+            gap = std::max(gap, normal.dot(position) - extent - polygon.offsets(i));
+          }
+          if(gap <= 0.0) {
+            closest = std::min(closest, gap);
+            continue;
+          }
+
+          // apart: the closest points are a vertex of one and an edge of the other
+          double apart = std::numeric_limits<double>::infinity();
+          const int count = polygon.vertices.cols();
+          for(int i = 0; i < count; i++) {
+            const Eigen::Vector2d relative = polygon.vertices.col(i) - position;
+            const double dx = std::max(std::abs(axis_x.dot(relative)) - half_x_, 0.0);
+            const double dy = std::max(std::abs(axis_y.dot(relative)) - half_y_, 0.0);
+            apart = std::min(apart, std::hypot(dx, dy));
+            const Eigen::Vector2d start = polygon.vertices.col(i);
+            const Eigen::Vector2d edge = polygon.vertices.col((i + 1) % count) - start;
+            const double length = edge.squaredNorm();
+            for(int c = 0; c < 4; c++) {
+              const double t = length > 0.0 ? std::min(std::max((corners.col(c) - start).dot(edge) / length, 0.0), 1.0) : 0.0;
+              apart = std::min(apart, (start + t * edge - corners.col(c)).norm());
+            }
+          }
+          closest = std::min(closest, apart);
+        }
+        return closest;
+      }
+  };
+}
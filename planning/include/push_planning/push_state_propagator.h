@@ -38,12 +38,23 @@
 #include <ompl/control/spaces/RealVectorControlSpace.h>
 
 #include <push_prediction/push_predictor.h>
+#include <push_prediction/profiling.h>
 #include <push_planning/conversions.h>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <vector>
+
 
 
 namespace push_planning {
 
+  // SAMPLING picks the best of random controls, GAUSS_NEWTON optimizes a control using the model Jacobian,
+  // BRANCH_AND_BOUND searches the control space using bounds of the model
+  enum SteeringMode { SAMPLING, GAUSS_NEWTON, BRANCH_AND_BOUND };
+
   class PushStatePropagator : public oc::StatePropagator
   {
     private:
@@ -57,6 +68,8 @@ namespace push_planning {
 
       bool set_distance_from_duration_ = false;
 
+      SteeringMode steering_mode_ = SAMPLING;
+
     public:
 
       PushStatePropagator(const oc::SpaceInformationPtr &si, push_prediction::PushPredictor& predictor, bool canSteer=false) : oc::StatePropagator(si),
@@ -65,9 +78,13 @@ namespace push_planning {
       canSteer_(canSteer),
       predictor_(&predictor)
     {
-      predictor_->setReuseSolutions(true);
     }
 
+      void setSteeringMode(SteeringMode mode)
+      {
+        steering_mode_ = mode;
+      }
+
       /*
          void propagate(const ob::State *start, const oc::Control *control, const double duration, ob::State *result) const override
          {
@@ -118,38 +135,43 @@ namespace push_planning {
 
       void propagate(const ob::State *start, const oc::Control *control, const double duration, ob::State *result) const override
       {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("planning/propagate ns");
         const double* ctrl = control->as<oc::RealVectorControlSpace::ControlType>()->values;
 
-        // extract start state
-        const auto *se2state = start->as<ob::SE2StateSpace::StateType>();
-        const double x = se2state->getX();
-        const double y = se2state->getY();
-        const double yaw = se2state->getYaw();
-
-        tams_ur5_push_msgs::Push push;
-        convertControlToPush(control, push);
+        // the push distance is the last control dimension
+        double push_ctrl[3] = { ctrl[0], ctrl[1], ctrl[2] };
         if(set_distance_from_duration_)
-          push.distance = duration;
+          push_ctrl[2] = duration / push_prediction::ControlTable::MAX_DISTANCE;
 
         // predict push control effect
-        geometry_msgs::Pose pose;
-        predictor_->predict(push, pose);
+        Eigen::Vector3d step;
+        predictor_->predictControl(push_ctrl, step.x(), step.y(), step.z());
 
-        tf::getYaw(pose.orientation);
+        applyStep(start, step, result);
+      }
 
-        geometry_msgs::Quaternion q = pose.orientation;
-        Eigen::Quaterniond next_q(q.w, q.x, q.y, q.z);
-        double next_yaw = next_q.toRotationMatrix().eulerAngles(0,1,2)[2];
+      // push steps (dx, dy, dyaw) of planner controls (one per column) propagated for the given duration,
+      // predicted as one batch
+      void predictSteps(Eigen::Matrix3Xd controls, Eigen::Matrix3Xd& steps, double duration) const
+      {
+        if(set_distance_from_duration_)
+          controls.row(2).setConstant(duration / push_prediction::ControlTable::MAX_DISTANCE);
+        predictor_->predictBatch(controls, steps);
+      }
 
-        // create new state
-        Eigen::Affine2d next_pos = Eigen::Translation2d(x, y) 
-          * Eigen::Rotation2Dd(yaw) * Eigen::Translation2d(pose.position.x, pose.position.y);
+      // apply a push step (dx, dy, dyaw) in the frame of the start state
+      void applyStep(const ob::State *start, const Eigen::Vector3d& step, ob::State *result) const
+      {
+        const auto *se2state = start->as<ob::SE2StateSpace::StateType>();
+        const double x = se2state->getX();
+        const double y = se2state->getY();
+        const double yaw = se2state->getYaw();
 
-        // set result state
-        result->as<ob::SE2StateSpace::StateType>()->setXY(
-            next_pos.translation().x(),
-            next_pos.translation().y());
-        result->as<ob::SE2StateSpace::StateType>()->setYaw( std::fmod(yaw + next_yaw + M_PI , 2 * M_PI) - M_PI);
+        const double cos_yaw = std::cos(yaw);
+        const double sin_yaw = std::sin(yaw);
+        auto *result_state = result->as<ob::SE2StateSpace::StateType>();
+        result_state->setXY(x + cos_yaw * step.x() - sin_yaw * step.y(), y + sin_yaw * step.x() + cos_yaw * step.y());
+        result_state->setYaw(std::fmod(yaw + step.z() + M_PI, 2 * M_PI) - M_PI);
       }
 
       void se2StateToEigen(const ob::State *state, Eigen::Affine2d& pose) const
@@ -166,8 +188,24 @@ namespace push_planning {
         return diff.translation().norm() + 0.5 * Eigen::Rotation2Dd(diff.rotation()).angle();
       }
 
+      // random controls (one per column) for the sampling steer functions, predicted as one batch
+      void sampleControls(oc::Control *control, Eigen::Matrix3Xd& controls, int samples = 100) const
+      {
+        const double *values = control->as<oc::RealVectorControlSpace::ControlType>()->values;
+        controls.resize(3, samples);
+        for(int i = 0; i < samples; i++) {
+          cs_->sample(control);
+          controls.col(i) = Eigen::Map<const Eigen::Vector3d>(values);
+        }
+      }
+
       bool steer(const ob::State *start, const ob::State *goal, oc::Control *control, double& duration) const override
       {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("planning/steer ns");
+        if(steering_mode_ == GAUSS_NEWTON)
+          return steerGaussNewton(start, goal, control, duration);
+        if(steering_mode_ == BRANCH_AND_BOUND)
+          return steerBranchAndBound(start, goal, control, duration);
         return steer2(start, goal, control, duration);
       }
 
@@ -190,26 +228,21 @@ namespace push_planning {
         Eigen::Affine2d goal_pose;
         se2StateToEigen(goal, goal_pose);
 
-        // temp variables
-        tams_ur5_push_msgs::Push push;
-        geometry_msgs::Pose pose;
-
         const double goal_distance = si_->distance(start, goal);
         const double goal_threshold = 0.05;
 
+        Eigen::Matrix3Xd controls, steps;
+        sampleControls(control, controls);
+        predictor_->predictBatch(controls, steps);
+
         Eigen::Affine2d next_pose, step;
 
-        for(int i = 0; i < 100; i++) {
+        for(int i = 0; i < controls.cols(); i++) {
 
-          // sample control
-          cs_->sample(control);
-          convertControlToPush(control, push);
-
-          // predict sampled push
-          predictor_->predict(push, pose);
+          // sampled push
           step.setIdentity();
-          step.translate(Eigen::Vector2d(pose.position.x, pose.position.y));
-          step.rotate(Eigen::Rotation2Dd(tf::getYaw(pose.orientation)));
+          step.translate(steps.col(i).head<2>());
+          step.rotate(Eigen::Rotation2Dd(steps(2, i)));
 
           // compute push step
           next_pose = start_pose * step;
@@ -225,6 +258,7 @@ namespace push_planning {
           }
 
           if(duration > 0.0 && min_distance < goal_threshold) {
+            Eigen::Map<Eigen::Vector3d>(control->as<oc::RealVectorControlSpace::ControlType>()->values) = controls.col(i);
             return true;
           }
         }
@@ -244,29 +278,25 @@ namespace push_planning {
         Eigen::Affine2d goal_pose;
         se2StateToEigen(goal, goal_pose);
 
-        // temp variables
-        tams_ur5_push_msgs::Push push;
-        geometry_msgs::Pose pose;
-
         const double goal_threshold = 0.05;
 
-        Eigen::Affine2d step;
+        Eigen::Matrix3Xd controls, steps;
+        sampleControls(control, controls);
+        predictor_->predictBatch(controls, steps);
 
-        for(int i = 0; i < 100; i++) {
+        Eigen::Affine2d step;
 
-          // sample control
-          cs_->sample(control);
-          convertControlToPush(control, push);
+        for(int i = 0; i < controls.cols(); i++) {
 
-          // predict sampled push
-          predictor_->predict(push, pose);
+          // sampled push
           step.setIdentity();
-          step.translate(Eigen::Vector2d(pose.position.x, pose.position.y));
-          step.rotate(Eigen::Rotation2Dd(tf::getYaw(pose.orientation)));
+          step.translate(steps.col(i).head<2>());
+          step.rotate(Eigen::Rotation2Dd(steps(2, i)));
 
 
           if(se2Distance(start_pose * step, goal_pose) < goal_threshold) {
-            duration = control->as<oc::RealVectorControlSpace::ControlType>()->values[2];
+            Eigen::Map<Eigen::Vector3d>(control->as<oc::RealVectorControlSpace::ControlType>()->values) = controls.col(i);
+            duration = controls(2, i);
             return true;
           }
         }
@@ -275,6 +305,197 @@ namespace push_planning {
 
 
 
+      /*
+       * Gauss-Newton steering:
+       * Start from the best of a few sampled controls and minimize the squared SE(2) error between
+       * start * predicted push and goal (translation and 0.5 * yaw, as in se2Distance) over the control.
+       * Steps use the Jacobian of the push model (Levenberg-Marquardt damping), the pivot wraps around
+       * the box and angle and distance are clamped to the control bounds.
+       */
+      bool steerGaussNewton(const ob::State *start, const ob::State *goal, oc::Control *control, double& duration) const
+      {
+        const int initial_samples = 16;
+        const int max_iterations = 4;
+        const double yaw_weight = 0.5;
+        const double goal_threshold = 0.05;
+
+        const auto *start_state = start->as<ob::SE2StateSpace::StateType>();
+        const auto *goal_state = goal->as<ob::SE2StateSpace::StateType>();
+        const Eigen::Rotation2Dd start_rotation(start_state->getYaw());
+        const Eigen::Vector2d start_position(start_state->getX(), start_state->getY());
+        const Eigen::Vector2d goal_position(goal_state->getX(), goal_state->getY());
+
+        tams_ur5_push_msgs::Push push;
+        geometry_msgs::Pose pose;
+        Eigen::Matrix<double, 3, 4> pose_jacobian;
+
+        double dx, dy, dyaw;
+
+        // residual of the state reached by a push step
+        auto residual = [&](double step_x, double step_y, double step_yaw) {
+          Eigen::Vector3d r;
+          r.head<2>() = start_position + start_rotation * Eigen::Vector2d(step_x, step_y) - goal_position;
+          double yaw = start_state->getYaw() + step_yaw - goal_state->getYaw();
+          r(2) = yaw_weight * std::remainder(yaw, 2 * M_PI);
+          return r;
+        };
+
+        // initialize with the best sampled control
+        double* ctrl = control->as<oc::RealVectorControlSpace::ControlType>()->values;
+        Eigen::Matrix3Xd controls, steps;
+        sampleControls(control, controls, initial_samples);
+        predictor_->predictBatch(controls, steps);
+        Eigen::Vector3d r;
+        double cost = std::numeric_limits<double>::infinity();
+        for(int i = 0; i < initial_samples; i++) {
+          const Eigen::Vector3d sample_r = residual(steps(0, i), steps(1, i), steps(2, i));
+          if(sample_r.squaredNorm() < cost) {
+            r = sample_r;
+            cost = r.squaredNorm();
+            Eigen::Map<Eigen::Vector3d>(ctrl) = controls.col(i);
+          }
+        }
+
+        // the costs are computed like the propagated states (predictBatch, predictControl),
+        // the network only provides the Jacobian
+        double lambda = 1e-3;
+        for(int i = 0; i < max_iterations; i++) {
+          convertControlToPush(ctrl, push);
+          predictor_->predict(push, pose, pose_jacobian);
+          const double r_cost = cost;
+
+          Eigen::Matrix3d J;
+          J.topRows<2>() = start_rotation.toRotationMatrix() * pose_jacobian.topRows<2>() * controlToPushJacobian(ctrl);
+          J.row(2) = yaw_weight * pose_jacobian.row(2) * controlToPushJacobian(ctrl);
+          const Eigen::Matrix3d JtJ = J.transpose() * J;
+          const Eigen::Vector3d Jtr = J.transpose() * r;
+
+          // increase the damping until a step reduces the error
+          bool improved = false;
+          Eigen::Vector3d next;
+          while(!improved && lambda < 1e3) {
+            Eigen::Matrix3d damping = (lambda * JtJ.diagonal().cwiseMax(1e-9)).asDiagonal();
+            Eigen::Vector3d delta = (JtJ + damping).ldlt().solve(-Jtr);
+            next << ctrl[0] + delta(0), ctrl[1] + delta(1), ctrl[2] + delta(2);
+            next(0) -= std::floor(next(0));
+            next(1) = std::max(0.0, std::min(next(1), 1.0));
+            next(2) = std::max(0.0, std::min(next(2), 1.0));
+            predictor_->predictControl(next.data(), dx, dy, dyaw);
+            double next_cost = residual(dx, dy, dyaw).squaredNorm();
+            improved = next_cost < cost;
+            lambda = improved ? std::max(1e-6, lambda * 0.1) : lambda * 10;
+            if(improved) {
+              std::copy(next.data(), next.data() + 3, ctrl);
+              r = residual(dx, dy, dyaw);
+              cost = next_cost;
+            }
+          }
+          // stop at a local optimum
+          if(!improved || cost > (1.0 - 1e-3) * r_cost)
+            break;
+        }
+
+        duration = ctrl[2];
+        return r.head<2>().norm() + std::abs(r(2)) < goal_threshold;
+      }
+
+      /*
+       * Branch-and-bound steering:
+       * Best-first search over boxes of the control space [0,1]^3, starting with one box per side of the object.
+       * Interval bounds of the push model give a lower bound of the goal error (as in steerGaussNewton) for all
+       * controls of a box, boxes that cannot reach the goal threshold are discarded. The remaining boxes are
+       * tested at their center and the box with the smallest error is split along its widest dimension.
+       * Fails if no box is left or after max_boxes.
+       */
+      bool steerBranchAndBound(const ob::State *start, const ob::State *goal, oc::Control *control, double& duration) const
+      {
+        const int max_boxes = 100;
+        const double yaw_weight = 0.5;
+        const double goal_threshold = 0.05;
+
+        const auto *start_state = start->as<ob::SE2StateSpace::StateType>();
+        const auto *goal_state = goal->as<ob::SE2StateSpace::StateType>();
+        const Eigen::Rotation2Dd start_rotation(start_state->getYaw());
+        const Eigen::Vector2d start_position(start_state->getX(), start_state->getY());
+        const Eigen::Vector2d goal_position(goal_state->getX(), goal_state->getY());
+        // goal relative to the start, the push step has to reach it
+        const Eigen::Vector2d goal_step = start_rotation.inverse() * (goal_position - start_position);
+        const double goal_yaw = goal_state->getYaw() - start_state->getYaw();
+
+        struct Box {
+          double lower[3], upper[3];
+          // control at the center and its error
+          double center[3];
+          double error;
+          bool operator<(const Box& other) const { return error > other.error; }
+        };
+
+        std::vector<tams_ur5_push_msgs::Push> pushes;
+        double dx, dy, dyaw;
+        Eigen::Vector3d step_lower, step_upper;
+
+        // false if no control of the box can reach the goal, otherwise the error at the center
+        auto evaluate = [&](Box& box) {
+          controlBoxToPushes(box.lower, box.upper, pushes);
+          predictor_->predictBounds(pushes, step_lower, step_upper);
+          const Eigen::Vector2d clamped = goal_step.cwiseMax(step_lower.head<2>()).cwiseMin(step_upper.head<2>());
+          // smallest yaw error in [lower, upper] modulo 2 pi
+          const double width = step_upper(2) - step_lower(2);
+          const double begin = std::remainder(step_lower(2) - goal_yaw, 2 * M_PI);
+          double yaw = 0.0;
+          if(width < 2 * M_PI && begin > 0.0)
+            yaw = std::max(0.0, std::min(begin, 2 * M_PI - (begin + width)));
+          else if(width < 2 * M_PI && begin + width < 0.0)
+            yaw = -(begin + width);
+          if((clamped - goal_step).norm() + yaw_weight * yaw >= goal_threshold)
+            return false;
+
+          for(int d = 0; d < 3; d++)
+            box.center[d] = 0.5 * (box.lower[d] + box.upper[d]);
+          predictor_->predictControl(box.center, dx, dy, dyaw);
+          const Eigen::Vector2d position(dx, dy);
+          yaw = std::remainder(dyaw - goal_yaw, 2 * M_PI);
+          box.error = (position - goal_step).norm() + yaw_weight * std::abs(yaw);
+          return true;
+        };
+
+        std::priority_queue<Box> boxes;
+        const double perimeter = 2 * (dimX + dimY);
+        const double sides[5] = { 0.0, dimX / perimeter, (dimX + dimY) / perimeter, (2 * dimX + dimY) / perimeter, 1.0 };
+        for(int side = 0; side < 4; side++) {
+          Box box = {{ sides[side], 0.0, 0.0 }, { sides[side + 1], 1.0, 1.0 }, { 0.0, 0.0, 0.0 }, 0.0};
+          if(evaluate(box))
+            boxes.push(box);
+        }
+
+        double* ctrl = control->as<oc::RealVectorControlSpace::ControlType>()->values;
+        for(int i = 0; i < max_boxes && !boxes.empty(); i++) {
+          Box box = boxes.top();
+          boxes.pop();
+          if(box.error < goal_threshold) {
+            std::copy(box.center, box.center + 3, ctrl);
+            duration = ctrl[2];
+            return true;
+          }
+
+          // split the widest dimension
+          int split = 0;
+          for(int d = 1; d < 3; d++) {
+            if(box.upper[d] - box.lower[d] > box.upper[split] - box.lower[split])
+              split = d;
+          }
+          const double middle = 0.5 * (box.lower[split] + box.upper[split]);
+          Box lower_half = box, upper_half = box;
+          lower_half.upper[split] = middle;
+          upper_half.lower[split] = middle;
+          for(Box* half : { &lower_half, &upper_half }) {
+            if(evaluate(*half))
+              boxes.push(*half);
+          }
+        }
+        return false;
+      }
+
       bool canPropagateBackward()
       {
         return false;
@@ -45,7 +45,11 @@
 #include <moveit_msgs/CollisionObject.h>
 #include <moveit_msgs/AttachedCollisionObject.h>
 
+#include <push_planning/clearance_field.h>
 #include <push_planning/conversions.h>
+#include <push_prediction/profiling.h>
+
+#include <memory>
 
 namespace ob = ompl::base;
 namespace oc = ompl::control;
@@ -65,16 +69,22 @@ static moveit_msgs::AttachedCollisionObject createObject() {
   return obj;
 }
 
-// this should be initialized from shape
-static moveit_msgs::AttachedCollisionObject obj = createObject();
-
-
+/*
+ * Collision check of the object moved to a state. A check moves the object in the scene,
+ * so concurrent planners need a checker with a scene of their own (e.g. a diff of the planning scene).
+ */
 class PushStateValidityChecker : public ob::StateValidityChecker
 {
   private:
     const ob::SpaceInformationPtr si_;
     const planning_scene::PlanningScenePtr scene_;
 
+    // this should be initialized from shape
+    mutable moveit_msgs::AttachedCollisionObject obj_ = createObject();
+
+    // footprint clearance of the obstacles (the robot is not included)
+    std::shared_ptr<const push_planning::ClearanceField> field_;
+
   public:
     PushStateValidityChecker(const ob::SpaceInformationPtr &si, const planning_scene::PlanningScenePtr scene)
       : ob::StateValidityChecker(si), si_(si), scene_(scene)
@@ -82,15 +92,31 @@ class PushStateValidityChecker : public ob::StateValidityChecker
 
     bool isValid(const ob::State *state) const override
     {
+      PUSH_PREDICTION_PROFILE_NAMED_SCOPE("planning/collision check ns");
       return si_->satisfiesBounds(state) && !isStateColliding(state);
     }
 
+    // answer clearance() from the field, validity is still checked in the scene
+    void setClearanceField(const std::shared_ptr<const push_planning::ClearanceField>& field)
+    {
+      field_ = field;
+      specs_.clearanceComputationType = field_ ? ob::StateValidityCheckerSpecs::BOUNDED_APPROXIMATE : ob::StateValidityCheckerSpecs::NONE;
+    }
+
+    double clearance(const ob::State *state) const override
+    {
+      if(!field_)
+        return ob::StateValidityChecker::clearance(state);
+      const auto *se2state = state->as<ob::SE2StateSpace::StateType>();
+      return field_->clearance(se2state->getX(), se2state->getY(), se2state->getYaw());
+    }
+
     bool isStateColliding(const ob::State *state) const
     {
       // move object to state and check for collisions
-      convertStateToPose(state, obj.object.primitive_poses[0]);
-      obj.object.primitive_poses[0].position.z = 0.5 * obj.object.primitives[0].dimensions[2] + 0.001;
-      scene_->processAttachedCollisionObjectMsg(obj);
+      convertStateToPose(state, obj_.object.primitive_poses[0]);
+      obj_.object.primitive_poses[0].position.z = 0.5 * obj_.object.primitives[0].dimensions[2] + 0.001;
+      scene_->processAttachedCollisionObjectMsg(obj_);
       return scene_->isStateColliding();
     }
 };
@@ -0,0 +1,404 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+/*
+ * Microbenchmarks of the prediction, conversion, sampling and propagation hot paths.
+ * Runs without a ROS master, use --benchmark_format=json or --benchmark_out=<file>
+ * for machine-readable results (see the README of tams_ur5_push_prediction).
+ */
+
+#include <ros/ros.h>
+#include <ros/console.h>
+#include <ros/master.h>
+#include <ros/package.h>
+
+#include <benchmark/benchmark.h>
+#include <boost/filesystem.hpp>
+
+// OMPL
+#include <ompl/base/PlannerData.h>
+#include <ompl/base/spaces/SE2StateSpace.h>
+#include <ompl/control/PathControl.h>
+#include <ompl/control/SpaceInformation.h>
+#include <ompl/control/spaces/RealVectorControlSpace.h>
+#include <ompl/geometric/PathGeometric.h>
+
+// pushing
+#include <graph_msgs/GeometryGraph.h>
+#include <tams_ur5_push_msgs/PushTrajectory.h>
+
+#include <push_prediction/neural_network.h>
+#include <push_prediction/push_predictor.h>
+#include <push_sampler/push_sampler.h>
+#include <push_planning/clearance_field.h>
+#include <push_planning/conversions.h>
+#include <push_planning/footprint_validity_checker.h>
+#include <push_planning/push_state_propagator.h>
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace push_msgs = tams_ur5_push_msgs;
+
+namespace {
+
+  // random planner controls, the same for every run
+  std::vector<std::array<double, 3>> sampleControls(size_t count = 1024)
+  {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    std::vector<std::array<double, 3>> controls(count);
+    for(auto& control : controls)
+      for(double& value : control)
+        value = unif(gen);
+    return controls;
+  }
+
+  std::vector<push_msgs::Push> samplePushes(size_t count = 1024)
+  {
+    std::vector<push_msgs::Push> pushes;
+    for(const auto& control : sampleControls(count)) {
+      pushes.emplace_back();
+      convertControlToPush(control.data(), pushes.back());
+    }
+    return pushes;
+  }
+
+  push_prediction::PushPredictor& predictor()
+  {
+    static push_prediction::PushPredictor predictor;
+    return predictor;
+  }
+
+  void modelLoad(benchmark::State& state, const std::string& model_file)
+  {
+    for(auto _ : state) {
+      NeuralNetwork network;
+      network.load(model_file);
+      benchmark::DoNotOptimize(network);
+    }
+  }
+
+  void networkRun(benchmark::State& state, const std::string& model_file)
+  {
+    NeuralNetwork network;
+    network.load(model_file);
+    NeuralNetwork::InferenceContext context;
+    const Eigen::VectorXf input = Eigen::VectorXf::Random(network.inputSize());
+    Eigen::VectorXf output;
+    for(auto _ : state) {
+      network.run(context, input, output);
+      benchmark::DoNotOptimize(output.data());
+    }
+  }
+
+  // load and inference of every model shipped with the prediction package
+  void registerModelBenchmarks()
+  {
+    namespace fs = boost::filesystem;
+    const fs::path models = fs::path(ros::package::getPath("tams_ur5_push_prediction")) / "models";
+    if(!fs::is_directory(models)) {
+      ROS_WARN("no model directory %s, skipping model benchmarks", models.string().c_str());
+      return;
+    }
+    std::vector<fs::path> files;
+    for(fs::directory_iterator it(models); it != fs::directory_iterator(); ++it) {
+      const std::string extension = it->path().extension().string();
+      if(extension == ".yaml" || extension == ".bin")
+        files.push_back(it->path());
+    }
+    std::sort(files.begin(), files.end());
+    for(const fs::path& file : files) {
+      const std::string name = file.filename().string();
+      benchmark::RegisterBenchmark(("BM_ModelLoad/" + name).c_str(), modelLoad, file.string())->Unit(benchmark::kMicrosecond);
+      benchmark::RegisterBenchmark(("BM_NetworkRun/" + name).c_str(), networkRun, file.string());
+    }
+  }
+
+}
+
+static void BM_PushPredictorPredict(benchmark::State& state)
+{
+  const auto pushes = samplePushes();
+  geometry_msgs::Pose pose;
+  size_t i = 0;
+  for(auto _ : state) {
+    predictor().predict(pushes[i++ % pushes.size()], pose);
+    benchmark::DoNotOptimize(pose);
+  }
+}
+BENCHMARK(BM_PushPredictorPredict);
+
+static void BM_PushPredictorPredictControl(benchmark::State& state)
+{
+  const auto controls = sampleControls();
+  double dx, dy, dyaw;
+  size_t i = 0;
+  for(auto _ : state) {
+    predictor().predictControl(controls[i++ % controls.size()].data(), dx, dy, dyaw);
+    benchmark::DoNotOptimize(dx);
+  }
+}
+BENCHMARK(BM_PushPredictorPredictControl);
+
+// items per second are predictions per second
+static void BM_PushPredictorPredictBatch(benchmark::State& state)
+{
+  const auto samples = sampleControls(state.range(0));
+  Eigen::Matrix3Xd controls(3, samples.size()), steps;
+  for(size_t i = 0; i < samples.size(); i++)
+    controls.col(i) = Eigen::Map<const Eigen::Vector3d>(samples[i].data());
+  for(auto _ : state) {
+    predictor().predictBatch(controls, steps);
+    benchmark::DoNotOptimize(steps.data());
+  }
+  state.SetItemsProcessed(state.iterations() * controls.cols());
+}
+BENCHMARK(BM_PushPredictorPredictBatch)->Arg(16)->Arg(100);
+
+static void BM_ConvertControlToPush(benchmark::State& state)
+{
+  const auto controls = sampleControls();
+  push_msgs::Push push;
+  size_t i = 0;
+  for(auto _ : state) {
+    convertControlToPush(controls[i++ % controls.size()].data(), push);
+    benchmark::DoNotOptimize(push);
+  }
+}
+BENCHMARK(BM_ConvertControlToPush);
+
+static void BM_ConvertPushToControl(benchmark::State& state)
+{
+  const auto pushes = samplePushes();
+  oc::RealVectorControlSpace::ControlType control;
+  size_t i = 0;
+  for(auto _ : state) {
+    // the conversion allocates the control values
+    convertPushToControl(pushes[i++ % pushes.size()], &control);
+    benchmark::DoNotOptimize(control.values);
+    delete[] control.values;
+  }
+  control.values = nullptr;
+}
+BENCHMARK(BM_ConvertPushToControl);
+
+static void BM_GetPoseFromBoxBorder(benchmark::State& state)
+{
+  const auto controls = sampleControls();
+  size_t i = 0;
+  for(auto _ : state) {
+    geometry_msgs::Pose pose = push_sampler::PushSampler::getPoseFromBoxBorder(controls[i++ % controls.size()][0], dimX, dimY, dimZ);
+    benchmark::DoNotOptimize(pose);
+  }
+}
+BENCHMARK(BM_GetPoseFromBoxBorder);
+
+static void BM_SampleRandomPush(benchmark::State& state)
+{
+  push_sampler::PushSampler sampler;
+  shape_msgs::SolidPrimitive shape;
+  shape.type = shape_msgs::SolidPrimitive::BOX;
+  shape.dimensions = { dimX, dimY, dimZ };
+  sampler.setObject(shape, object_frame);
+  push_msgs::Push push;
+  for(auto _ : state) {
+    sampler.sampleRandomPush(push);
+    benchmark::DoNotOptimize(push);
+  }
+}
+BENCHMARK(BM_SampleRandomPush);
+
+// footprint of the box at random states against a table with a few box-shaped obstacles
+static void BM_ObstacleFootprintsCollides(benchmark::State& state)
+{
+  push_planning::ObstacleFootprints obstacles;
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> unif(-0.3, 0.3);
+  for(int i = 0; i < state.range(0); i++) {
+    const Eigen::Vector2d center(unif(gen), unif(gen));
+    std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> corners;
+    for(int corner = 0; corner < 4; corner++)
+      corners.push_back(center + Eigen::Rotation2Dd(unif(gen)) * Eigen::Vector2d(corner & 1 ? 0.05 : -0.05, corner & 2 ? 0.02 : -0.02));
+    obstacles.addPolygon(corners);
+  }
+  const auto controls = sampleControls();
+  size_t i = 0;
+  for(auto _ : state) {
+    const auto& pose = controls[i++ % controls.size()];
+    bool collides = obstacles.collides(pose[0] - 0.5, pose[1] - 0.5, 2 * M_PI * pose[2]);
+    benchmark::DoNotOptimize(collides);
+  }
+}
+BENCHMARK(BM_ObstacleFootprintsCollides)->Arg(1)->Arg(5)->Arg(20);
+
+// swept footprint checks of push sized motions (up to 5 cm and 0.3 rad) among a number of obstacles
+static void BM_ObstacleFootprintsSweep(benchmark::State& state)
+{
+  push_planning::ObstacleFootprints obstacles;
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> unif(-0.3, 0.3);
+  for(int i = 0; i < state.range(0); i++) {
+    const Eigen::Vector2d center(unif(gen), unif(gen));
+    std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> corners;
+    for(int corner = 0; corner < 4; corner++)
+      corners.push_back(center + Eigen::Rotation2Dd(unif(gen)) * Eigen::Vector2d(corner & 1 ? 0.05 : -0.05, corner & 2 ? 0.02 : -0.02));
+    obstacles.addPolygon(corners);
+  }
+  const auto controls = sampleControls();
+  size_t i = 0;
+  for(auto _ : state) {
+    const auto& pose = controls[i++ % controls.size()];
+    const double x = pose[0] - 0.5, y = pose[1] - 0.5, yaw = 2 * M_PI * pose[2];
+    bool collides = obstacles.sweepCollides(x, y, yaw, x + 0.1 * (pose[1] - 0.5), y + 0.1 * (pose[2] - 0.5), yaw + 0.6 * (pose[0] - 0.5));
+    benchmark::DoNotOptimize(collides);
+  }
+}
+BENCHMARK(BM_ObstacleFootprintsSweep)->Arg(1)->Arg(5)->Arg(20);
+
+// clearance lookups in a field of five obstacles at the default resolution
+static void BM_ClearanceFieldClearance(benchmark::State& state)
+{
+  auto obstacles = std::make_shared<push_planning::ObstacleFootprints>();
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> unif(-0.3, 0.3);
+  for(int i = 0; i < 5; i++) {
+    const Eigen::Vector2d center(unif(gen), unif(gen));
+    std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> corners;
+    for(int corner = 0; corner < 4; corner++)
+      corners.push_back(center + Eigen::Rotation2Dd(unif(gen)) * Eigen::Vector2d(corner & 1 ? 0.05 : -0.05, corner & 2 ? 0.02 : -0.02));
+    obstacles->addPolygon(corners);
+  }
+  const push_planning::ClearanceField field(obstacles, -0.3, 0.3);
+  const auto controls = sampleControls();
+  size_t i = 0;
+  for(auto _ : state) {
+    const auto& pose = controls[i++ % controls.size()];
+    double clearance = field.clearance(0.6 * pose[0] - 0.3, 0.6 * pose[1] - 0.3, 2 * M_PI * pose[2]);
+    benchmark::DoNotOptimize(clearance);
+  }
+}
+BENCHMARK(BM_ClearanceFieldClearance);
+
+namespace {
+
+  // planning spaces as set up by the planner node, every state is valid
+  struct PropagationFixture {
+    std::shared_ptr<ob::SE2StateSpace> space;
+    oc::SpaceInformationPtr si;
+    std::shared_ptr<push_planning::PushStatePropagator> propagator;
+
+    PropagationFixture()
+    {
+      space = std::make_shared<ob::SE2StateSpace>();
+      ob::RealVectorBounds bounds(2);
+      bounds.setLow(-1.0);
+      bounds.setHigh(1.0);
+      space->setBounds(bounds);
+
+      auto cspace(std::make_shared<oc::RealVectorControlSpace>(space, 3));
+      ob::RealVectorBounds cbounds(3);
+      cbounds.setLow(0.0);
+      cbounds.setHigh(1.0);
+      cspace->setBounds(cbounds);
+
+      si = std::make_shared<oc::SpaceInformation>(space, cspace);
+      si->setStateValidityChecker([](const ob::State*) { return true; });
+      si->setPropagationStepSize(1.0);
+      si->setup();
+      propagator = std::make_shared<push_planning::PushStatePropagator>(si, predictor(), true);
+    }
+  };
+
+}
+
+static void BM_PushStatePropagatorPropagate(benchmark::State& state)
+{
+  PropagationFixture fixture;
+  const auto controls = sampleControls();
+  ob::ScopedState<ob::SE2StateSpace> start(fixture.space), result(fixture.space);
+  start->setXY(0.1, -0.2);
+  start->setYaw(0.5);
+  oc::Control *control = fixture.si->allocControl();
+  double *values = control->as<oc::RealVectorControlSpace::ControlType>()->values;
+  size_t i = 0;
+  for(auto _ : state) {
+    std::copy_n(controls[i++ % controls.size()].data(), 3, values);
+    fixture.propagator->propagate(start.get(), control, 1.0, result.get());
+    benchmark::DoNotOptimize(result->getX());
+  }
+  fixture.si->freeControl(control);
+}
+BENCHMARK(BM_PushStatePropagatorPropagate);
+
+// the goal is out of reach of a single push, so every call evaluates all samples
+static void BM_PushStatePropagatorSteer2(benchmark::State& state)
+{
+  PropagationFixture fixture;
+  ob::ScopedState<ob::SE2StateSpace> start(fixture.space), goal(fixture.space);
+  start->setXY(0.0, 0.0);
+  start->setYaw(0.0);
+  goal->setXY(0.5, 0.5);
+  goal->setYaw(1.0);
+  oc::Control *control = fixture.si->allocControl();
+  double duration;
+  for(auto _ : state) {
+    bool reached = fixture.propagator->steer2(start.get(), goal.get(), control, duration);
+    benchmark::DoNotOptimize(reached);
+  }
+  fixture.si->freeControl(control);
+}
+BENCHMARK(BM_PushStatePropagatorSteer2)->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char** argv)
+{
+  // without a master the parameter lookups of the push sampler fail after the retry timeout
+  // and it keeps its defaults, rosout is not needed
+  ros::init(argc, argv, "push_benchmarks", ros::init_options::AnonymousName | ros::init_options::NoRosout |
+      ros::init_options::NoSigintHandler);
+  ros::master::setRetryTimeout(ros::WallDuration(0.5));
+  // keep stdout to the benchmark results
+  if(ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Warn))
+    ros::console::notifyLoggerLevelsChanged();
+
+  registerModelBenchmarks();
+  benchmark::Initialize(&argc, argv);
+  if(benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
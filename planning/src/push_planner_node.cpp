@@ -34,6 +34,7 @@
 //ROS
 #include <ros/ros.h>
 #include <actionlib/server/simple_action_server.h>
+#include <std_srvs/Trigger.h>
 
 // MoveIt
 #include <moveit/planning_scene/planning_scene.h>
@@ -54,6 +55,8 @@
 #include <ompl/control/SpaceInformation.h>
 #include <ompl/control/spaces/RealVectorControlSpace.h>
 #include <ompl/control/SimpleDirectedControlSampler.h>
+#include <ompl/base/PlannerTerminationCondition.h>
+#include <ompl/util/Time.h>
 
 #include <ompl/control/planners/rrt/RRT.h>
 #include <ompl/geometric/planners/rrt/RRT.h>
@@ -72,7 +75,17 @@
 #include <push_planning/chained_control_sampler.h>
 #include <push_planning/push_state_propagator.h>
 #include <push_planning/push_state_validity_checker.h>
+#include <push_planning/footprint_validity_checker.h>
+#include <push_planning/footprint_motion_validator.h>
+#include <push_planning/clearance_field.h>
 #include <push_planning/conversions.h>
+#include <push_prediction/profiling.h>
+
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <vector>
 
 
 namespace ob = ompl::base;
@@ -133,9 +146,14 @@ namespace push_planning {
 
       actionlib::SimpleActionServer<push_msgs::PlanPushAction> as_;
 
+      // returns the inference and planning statistics (PUSH_PREDICTION_PROFILING)
+      ros::ServiceServer profiling_service_;
 
       ExplorationStrategy strategy_ = CHAINED;
 
+      // number of control planners solving a request concurrently
+      int planning_threads_ = 1;
+
       // planner setup
       double planning_time_ = 300.0;
       double goal_accuracy_ = 0.05;
@@ -154,20 +172,63 @@ namespace push_planning {
 
       bool can_steer_ = false;
 
+      SteeringMode steering_mode_ = SAMPLING;
+
       bool use_control_planner_ = true;
 
+      // check states in the MoveIt planning scene instead of against the obstacle footprints
+      bool exact_collision_checking_ = false;
+
+      // clearance field of the obstacle footprints, rasterized when the obstacles change
+      double clearance_resolution_ = 0.01;
+      int clearance_yaw_steps_ = 36;
+
+      // check the swept footprint of the box between states, not only the states
+      bool swept_motion_checking_ = true;
+
       std::string object_id_ = "pushable_object";
 
+      // loaded once at startup, the model is shared by all plan requests
+      push_prediction::PushPredictor predictor_;
+
+      // kept across plan requests, created by the first one
+      planning_scene_monitor::PlanningSceneMonitorPtr scene_monitor_;
+      std::vector<oc::SimpleSetupPtr> control_setups_;
+
+      // obstacles of the last request, reused while the scene does not change
+      std::shared_ptr<const ObstacleFootprints> footprints_;
+      std::shared_ptr<const ClearanceField> field_;
+
+      // last push of the current request, for the chained control samplers (values allocated by convertPushToControl)
+      oc::RealVectorControlSpace::ControlType last_control_;
+      bool has_last_control_ = false;
+
     public:
       PushPlannerActionServer(ros::NodeHandle& nh, ros::NodeHandle& pnh, const std::string& action) :
         nh_(nh),
         pnh_(pnh),
         as_(nh_, action, boost::bind(&PushPlannerActionServer::planCB, this, _1), false)
     {
+      last_control_.values = nullptr;
       loadParams();
+      profiling_service_ = pnh_.advertiseService("profiling_report", &PushPlannerActionServer::profilingReportCB, this);
       as_.start();
     }
 
+      ~PushPlannerActionServer() {
+        delete[] last_control_.values;
+      }
+
+      bool profilingReportCB(std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res) {
+#ifdef PUSH_PREDICTION_PROFILING
+        res.success = true;
+        res.message = push_prediction::profiling::report();
+#else
+        res.message = "push_planner_node was built without PUSH_PREDICTION_PROFILING";
+#endif
+        return true;
+      }
+
       void loadParams() {
         std::string strategy;
         pnh_.param<std::string>("planning_strategy", strategy, "");
@@ -177,8 +238,20 @@ namespace push_planning {
         else if(strategy == "CHAINED") strategy_ = CHAINED;
         else if(strategy != "RANDOM") ROS_WARN("Unknown planning strategy: '%s'", strategy.c_str());
 
+        // concurrent control planners, 0 runs one per core
+        pnh_.param("planning_threads", planning_threads_, 1);
+
         can_steer_ = strategy_ == STEERED;
 
+        std::string steering_mode;
+        pnh_.param<std::string>("steering_mode", steering_mode, "SAMPLING");
+        if(steering_mode == "GAUSS_NEWTON")
+          steering_mode_ = GAUSS_NEWTON;
+        else if(steering_mode == "BRANCH_AND_BOUND")
+          steering_mode_ = BRANCH_AND_BOUND;
+        else if(steering_mode != "SAMPLING")
+          ROS_WARN("Unknown steering mode: '%s'", steering_mode.c_str());
+
         // planner setup
         pnh_.param("planning_time", planning_time_, 300.0);
         pnh_.param("goal_accuracy", goal_accuracy_, 0.05);
@@ -196,6 +269,28 @@ namespace push_planning {
         pnh_.param("control_sampler_iterations", control_sampler_iterations_, 10);
 
         pnh_.param("use_control_planner", use_control_planner_, true);
+        pnh_.param("exact_collision_checking", exact_collision_checking_, false);
+        pnh_.param("clearance_resolution", clearance_resolution_, 0.01);
+        pnh_.param("clearance_yaw_steps", clearance_yaw_steps_, 36);
+        pnh_.param("swept_motion_checking", swept_motion_checking_, true);
+
+        // prediction cache, kept across plan requests (off by default, it quantizes the predictions)
+        int cache_size;
+        double cache_resolution;
+        pnh_.param("prediction_cache_size", cache_size, 0);
+        pnh_.param("prediction_cache_resolution", cache_resolution, push_prediction::PushPredictor::DEFAULT_CACHE_RESOLUTION);
+        predictor_.setCache(std::max(cache_size, 0), cache_resolution);
+
+        // precomputed predictions of the controls (see build_control_table)
+        std::string lookup_table;
+        pnh_.param<std::string>("prediction_lookup_table", lookup_table, "");
+        if(!lookup_table.empty()) {
+          auto table = std::make_shared<push_prediction::ControlTable>();
+          table->load(lookup_table);
+          ROS_INFO("predicting with control table %s (max. error %g m, %g m, %g rad)", lookup_table.c_str(),
+              table->maxError()[0], table->maxError()[1], table->maxError()[2]);
+          predictor_.setLookupTable(table);
+        }
       }
 
 
@@ -203,23 +298,81 @@ namespace push_planning {
         return [&](const oc::SpaceInformation* si){ return std::make_shared<T>(si, control_sampler_iterations_); };
       }
 
+      /*
+       * Copy of the current planning scene without the pushed object. The scene monitor is started by the first
+       * request and follows the scene diffs published by move_group from then on, so later requests only copy it.
+       */
       planning_scene::PlanningScenePtr getPlanningScene(){
-        // load current planning scene and look for collision objects
-        moveit::planning_interface::PlanningSceneInterface psi;
-        std::map<std::string, moveit_msgs::CollisionObject> cobjs = psi.getObjects();
-
-        // apply collision objects to planning scene of StateValidityChecker
-        planning_scene_monitor::PlanningSceneMonitor psm("robot_description");
-        psm.startStateMonitor();
-        psm.waitForCurrentRobotState(ros::Time::now());
-        planning_scene::PlanningScenePtr scene(psm.getPlanningScene());
-        for (auto& cobj : cobjs) {
-          if(cobj.first.find(object_id_) > 1)
-            scene->processCollisionObjectMsg(cobj.second);
+        if(!scene_monitor_) {
+          scene_monitor_ = std::make_shared<planning_scene_monitor::PlanningSceneMonitor>("robot_description");
+          scene_monitor_->startStateMonitor();
+          scene_monitor_->startSceneMonitor();
+          scene_monitor_->waitForCurrentRobotState(ros::Time::now());
+
+          // collision objects added before the monitor was started
+          moveit::planning_interface::PlanningSceneInterface psi;
+          std::map<std::string, moveit_msgs::CollisionObject> cobjs = psi.getObjects();
+          planning_scene_monitor::LockedPlanningSceneRW monitored(scene_monitor_);
+          for (auto& cobj : cobjs)
+            monitored->processCollisionObjectMsg(cobj.second);
+        }
+
+        planning_scene::PlanningScenePtr scene;
+        {
+          planning_scene_monitor::LockedPlanningSceneRO monitored(scene_monitor_);
+          scene = planning_scene::PlanningScene::clone(monitored);
+        }
+        for (const std::string& id : scene->getWorld()->getObjectIds()) {
+          if(id.find(object_id_) <= 1)
+            scene->getWorldNonConst()->removeObject(id);
         }
         return scene;
       }
 
+      typedef std::function<ob::StateValidityCheckerPtr(const ob::SpaceInformationPtr&)> ValidityCheckerAllocator;
+
+      /*
+       * Obstacle footprints of the scene, extracted once per plan request and shared by all checkers.
+       * The footprints and clearance field of the last request are kept if the obstacles did not change.
+       */
+      void updateObstacleFootprints(const planning_scene::PlanningScene& scene) {
+        auto obstacles = std::make_shared<ObstacleFootprints>();
+        obstacles->addScene(scene);
+        if(footprints_ && *footprints_ == *obstacles)
+          return;
+        ROS_INFO("%lu obstacle footprints", (unsigned long) obstacles->size());
+        footprints_ = obstacles;
+        field_.reset();
+      }
+
+      /*
+       * Validity checkers of a plan request: the box footprint against the obstacle footprints of the scene,
+       * or with exact_collision_checking the MoveIt check, which needs a copy (diff) of the scene per
+       * concurrent planner. Both answer clearance queries from a clearance field of the footprints,
+       * rasterized when the obstacles change unless clearance_resolution is 0.
+       */
+      ValidityCheckerAllocator getValidityCheckerAllocator(const planning_scene::PlanningScenePtr& scene, bool concurrent) {
+        if(clearance_resolution_ > 0.0 && !field_) {
+          PUSH_PREDICTION_PROFILE_NAMED_SCOPE("planning/clearance field ns");
+          field_ = std::make_shared<ClearanceField>(footprints_, state_space_real_min_, state_space_real_max_,
+              clearance_resolution_, std::max(clearance_yaw_steps_, 1), planning_threads_ > 0 ? planning_threads_ : 0);
+          ROS_INFO("clearance field with %lu cells (error bound %g m)", (unsigned long) field_->size(), field_->errorBound());
+        }
+        const std::shared_ptr<const ClearanceField> field = field_;
+        const std::shared_ptr<const ObstacleFootprints> footprints = footprints_;
+
+        if(exact_collision_checking_) {
+          return [scene, concurrent, field](const ob::SpaceInformationPtr& si) {
+            auto checker = std::make_shared<PushStateValidityChecker>(si, concurrent ? scene->diff() : scene);
+            checker->setClearanceField(field);
+            return checker;
+          };
+        }
+        return [footprints, field](const ob::SpaceInformationPtr& si) {
+          return std::make_shared<FootprintValidityChecker>(si, footprints, field);
+        };
+      }
+
       void planCB(const push_msgs::PlanPushGoalConstPtr& goal) {
 	      if(use_control_planner_)
 		      planInControlSpace(goal);
@@ -244,9 +397,11 @@ namespace push_planning {
         ob::SpaceInformationPtr si(new ob::SpaceInformation(space));
 
         // initialize StateValidityChecker with updated planning scene
-        ob::StateValidityCheckerPtr checker(
-            std::make_shared<PushStateValidityChecker>(si, getPlanningScene()));
-        si->setStateValidityChecker(checker);
+        const planning_scene::PlanningScenePtr scene = getPlanningScene();
+        updateObstacleFootprints(*scene);
+        si->setStateValidityChecker(getValidityCheckerAllocator(scene, false)(si));
+        if(swept_motion_checking_)
+          si->setMotionValidator(std::make_shared<FootprintMotionValidator>(si, footprints_));
         si->setup();
 
         // create start and goal states
@@ -263,7 +418,12 @@ namespace push_planning {
         planner->setup();
 
         push_msgs::PlanPushResult result;
-        if (planner->solve(planning_time_)) {
+        bool solved;
+        {
+          PUSH_PREDICTION_PROFILE_NAMED_SCOPE("planning/solve ns");
+          solved = planner->solve(planning_time_);
+        }
+        if (solved) {
 
           // return solution
           ob::PlannerData data(si);
@@ -281,12 +441,12 @@ namespace push_planning {
       }
 
 
-      void planInControlSpace(const push_msgs::PlanPushGoalConstPtr& goal)
+      /*
+       * Control-space planner setup, kept across plan requests (see prepareControlSetup). The directed control
+       * samplers are allocated by the planner for each request, with its last push and obstacle footprints.
+       */
+      oc::SimpleSetupPtr createControlSetup()
       {
-
-        // extract goal request (not used atm)
-        //const std::string& object_id = goal->object_id;
-
         // construct a SE2 state space 
         // and set the bounds for the R^2 part of SE(2) state space
         auto space(std::make_shared<ob::SE2StateSpace>());
@@ -303,75 +463,176 @@ namespace push_planning {
         cbounds.setHigh(1.0);
         cspace->setBounds(cbounds);
 
-        // create start and goal states
-        ob::ScopedState<ob::SE2StateSpace> start_state(space);
-        convertPoseToState(goal->start_pose, start_state);
-        ob::ScopedState<ob::SE2StateSpace> goal_state(space);
-        convertPoseToState(goal->goal_pose, goal_state);
-
         // Declare planner setup and space information
-        oc::SimpleSetup* setup;
+        oc::SimpleSetupPtr setup;
         oc::SpaceInformationPtr si;
+        oc::DirectedControlSamplerAllocator sampler;
 
         // initialize setup and space information
         if(strategy_ == DIRECTED || strategy_ == CHAINED) {
           // custom control samplers need to be allocated within the space information
           // the setup is then initialized with the modified space information
 
-          oc::DirectedControlSamplerAllocator sampler;
           if(strategy_ == DIRECTED)
             sampler = getControlSamplerAllocator<oc::SimpleDirectedControlSampler>();
           if(strategy_ == CHAINED) {
             //sampler = getControlSamplerAllocator<ChainedControlSampler>();
-            oc::RealVectorControlSpace::ControlType* last_control = NULL;
-            if(goal->last_push.approach.frame_id != "") {
-              ROS_ERROR_STREAM("Reusing last push!");
-              last_control = new oc::RealVectorControlSpace::ControlType();
-              convertPushToControl(goal->last_push, last_control);
-              ROS_ERROR_STREAM("converted");
-            }
-            sampler = [&](const oc::SpaceInformation* si){ return std::make_shared<ChainedControlSampler>(si, control_sampler_iterations_, last_control); };
+            sampler = [this](const oc::SpaceInformation* si){ return std::make_shared<ChainedControlSampler>(si, control_sampler_iterations_, has_last_control_ ? &last_control_ : nullptr); };
           }
 
 
           si = std::make_shared<oc::SpaceInformation>(cspace->getStateSpace(), cspace);
           si->setDirectedControlSamplerAllocator(sampler);
-          setup = (new oc::SimpleSetup(si));
+          setup = std::make_shared<oc::SimpleSetup>(si);
 
         } else {
 
           // by default the setup is initialized with the control space
-          setup = (new oc::SimpleSetup(cspace));
+          setup = std::make_shared<oc::SimpleSetup>(cspace);
           si = setup->getSpaceInformation();
+          sampler = [](const oc::SpaceInformation* si){ return std::make_shared<oc::SimpleDirectedControlSampler>(si); };
         }
 
-        // set state propagator
-        push_prediction::PushPredictor predictor;
-        oc::StatePropagatorPtr propagator(std::make_shared<PushStatePropagator>(si, predictor, can_steer_));
-        setup->setStatePropagator(propagator);
+        // control planners check the states between propagation steps, the sampled controls check the motions
+        if(swept_motion_checking_) {
+          si->setDirectedControlSamplerAllocator([this, sampler](const oc::SpaceInformation* si) {
+              return std::make_shared<MotionCheckingControlSampler>(si, sampler(si), footprints_);
+          });
+        }
 
-        // initialize StateValidityChecker with updated planning scene
-        ob::StateValidityCheckerPtr checker(
-            std::make_shared<PushStateValidityChecker>(si, getPlanningScene()));
-        setup->setStateValidityChecker(checker);
+        // set state propagator, all setups share the predictor
+        auto push_propagator = std::make_shared<PushStatePropagator>(si, predictor_, can_steer_);
+        push_propagator->setSteeringMode(steering_mode_);
+        oc::StatePropagatorPtr propagator(push_propagator);
+        setup->setStatePropagator(propagator);
 
         // configure planner setup
-        setup->setStartAndGoalStates(start_state, goal_state, goal_accuracy_);
         setup->setPlanner(std::make_shared<oc::RRT>(si));
         setup->getPlanner()->as<oc::RRT>()->setGoalBias(goal_bias_);
         setup->getPlanner()->as<oc::RRT>()->setIntermediateStates(set_intermediate_states_);
         si->setMinMaxControlDuration(min_control_duration_, max_control_duration_);
         si->setPropagationStepSize(propagation_step_size_);
+        return setup;
+      }
+
+      // reset a kept setup for a plan request: clear the planner and set the validity checker, start and goal
+      void prepareControlSetup(const oc::SimpleSetupPtr& setup, const push_msgs::PlanPushGoalConstPtr& goal, const ValidityCheckerAllocator& checker)
+      {
+        setup->clear();
+
+        // initialize StateValidityChecker with updated planning scene
+        setup->setStateValidityChecker(checker(setup->getSpaceInformation()));
+
+        // create start and goal states
+        ob::ScopedState<ob::SE2StateSpace> start_state(setup->getStateSpace());
+        convertPoseToState(goal->start_pose, start_state);
+        ob::ScopedState<ob::SE2StateSpace> goal_state(setup->getStateSpace());
+        convertPoseToState(goal->goal_pose, goal_state);
+        setup->setStartAndGoalStates(start_state, goal_state, goal_accuracy_);
+      }
+
+      /*
+       * Solve the setups concurrently, one thread each, until a planner finds an exact solution or the
+       * planning time is up. Returns the setup with the exact solution, otherwise the one whose approximate
+       * solution is closest to the goal, or null without any solution.
+       * The planners are seeded independently by OMPL's seed generator.
+       */
+      oc::SimpleSetupPtr solveParallel(const std::vector<oc::SimpleSetupPtr>& setups)
+      {
+        if(setups.size() == 1)
+          return setups[0]->solve(planning_time_) ? setups[0] : nullptr;
+
+        std::atomic<bool> exact_solution(false);
+        const ompl::time::point deadline = ompl::time::now() + ompl::time::seconds(planning_time_);
+        std::vector<ob::PlannerStatus> status(setups.size());
+        std::vector<std::thread> threads;
+        for(size_t i = 0; i < setups.size(); i++) {
+          threads.emplace_back([&, i] {
+              ob::PlannerTerminationCondition ptc([&] { return exact_solution || ompl::time::now() > deadline; });
+              status[i] = setups[i]->solve(ptc);
+              if(status[i] == ob::PlannerStatus::EXACT_SOLUTION)
+                exact_solution = true;
+          });
+        }
+        for(std::thread& thread : threads)
+          thread.join();
+
+        oc::SimpleSetupPtr best;
+        double best_difference = std::numeric_limits<double>::infinity();
+        for(size_t i = 0; i < setups.size(); i++) {
+          if(status[i] == ob::PlannerStatus::EXACT_SOLUTION) {
+            ROS_INFO("planner %lu of %lu found a solution", (unsigned long) i + 1, (unsigned long) setups.size());
+            return setups[i];
+          }
+          if(status[i] == ob::PlannerStatus::APPROXIMATE_SOLUTION) {
+            const double difference = setups[i]->getProblemDefinition()->getSolutionDifference();
+            if(difference < best_difference) {
+              best_difference = difference;
+              best = setups[i];
+            }
+          }
+        }
+        return best;
+      }
+
+      void planInControlSpace(const push_msgs::PlanPushGoalConstPtr& goal)
+      {
+
+        // extract goal request (not used atm)
+        //const std::string& object_id = goal->object_id;
+
+        const ompl::time::point received = ompl::time::now();
+
+        delete[] last_control_.values;
+        last_control_.values = nullptr;
+        has_last_control_ = strategy_ == CHAINED && goal->last_push.approach.frame_id != "";
+        if(has_last_control_) {
+          ROS_ERROR_STREAM("Reusing last push!");
+          convertPushToControl(goal->last_push, &last_control_);
+          ROS_ERROR_STREAM("converted");
+        }
+
+        // one setup per planning thread, created by the first request
+        if(control_setups_.empty()) {
+          const int threads = planning_threads_ > 0 ? planning_threads_ : std::max(1u, std::thread::hardware_concurrency());
+          for(int i = 0; i < threads; i++)
+            control_setups_.push_back(createControlSetup());
+        }
+        const std::vector<oc::SimpleSetupPtr>& setups = control_setups_;
+
+        const planning_scene::PlanningScenePtr scene = getPlanningScene();
+        updateObstacleFootprints(*scene);
+        const ValidityCheckerAllocator checker = getValidityCheckerAllocator(scene, setups.size() > 1);
+        for(const oc::SimpleSetupPtr& setup : setups)
+          prepareControlSetup(setup, goal, checker);
+        ROS_INFO("plan request set up in %.1f ms", 1000.0 * ompl::time::seconds(ompl::time::now() - received));
 
         // attempt to solve the planning problem
 	push_msgs::PlanPushResult result;
-        if (setup->solve(planning_time_)) {
+        oc::SimpleSetupPtr setup;
+        {
+          PUSH_PREDICTION_PROFILE_NAMED_SCOPE("planning/solve ns");
+          setup = solveParallel(setups);
+        }
+        if(auto cache = predictor_.cache()) {
+          push_prediction::PredictionCache::Statistics statistics = cache->statistics();
+          ROS_INFO("prediction cache: %lu hits, %lu misses, %lu of %lu entries used",
+              (unsigned long) statistics.hits, (unsigned long) statistics.misses,
+              (unsigned long) statistics.size, (unsigned long) statistics.capacity);
+        }
+        if (setup) {
 
           // return solution
-          ob::PlannerData data(si);
+          ob::PlannerData data(setup->getSpaceInformation());
           setup->getPlannerData(data);
           plannerDataToGraphMsg(data, result.planner_data);
           controlPathToPushTrajectoryMsg(setup->getSolutionPath(), result.trajectory);
+          if(setup->getStateValidityChecker()->hasClearanceComputation()) {
+            double clearance = std::numeric_limits<double>::infinity();
+            for(const ob::State* state : setup->getSolutionPath().getStates())
+              clearance = std::min(clearance, setup->getStateValidityChecker()->clearance(state));
+            ROS_INFO("solution keeps a clearance of %g m to the obstacles", clearance);
+          }
           as_.setSucceeded(result);
 
         } else {
@@ -398,5 +659,8 @@ int main(int argc, char** argv)
 
   push_planning::PushPlannerActionServer planner(nh, pnh, "/push_plan_action");
   ros::spin();
+#ifdef PUSH_PREDICTION_PROFILING
+  ROS_INFO_STREAM("profiling statistics:\n" << push_prediction::profiling::report());
+#endif
   return 0;
 }
@@ -0,0 +1,290 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+/* Author: Lars Henning Kayser */
+
+#include <push_planning/obstacle_footprints.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using push_planning::ObstacleFootprints;
+
+namespace {
+
+  typedef std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> Points;
+
+  const double HALF_X = 0.5 * dimX;
+  const double HALF_Y = 0.5 * dimY;
+
+  double cross(const Eigen::Vector2d& o, const Eigen::Vector2d& a, const Eigen::Vector2d& b)
+  {
+    return (a.x() - o.x()) * (b.y() - o.y()) - (a.y() - o.y()) * (b.x() - o.x());
+  }
+
+  // whether the closed segments ab and cd share a point
+  bool segmentsIntersect(const Eigen::Vector2d& a, const Eigen::Vector2d& b, const Eigen::Vector2d& c, const Eigen::Vector2d& d)
+  {
+    const double d1 = cross(c, d, a), d2 = cross(c, d, b), d3 = cross(a, b, c), d4 = cross(a, b, d);
+    if(((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0)))
+      return true;
+    auto onSegment = [](const Eigen::Vector2d& p, const Eigen::Vector2d& q, const Eigen::Vector2d& r) {
+      return std::min(p.x(), q.x()) <= r.x() && r.x() <= std::max(p.x(), q.x()) &&
+        std::min(p.y(), q.y()) <= r.y() && r.y() <= std::max(p.y(), q.y());
+    };
+    return (d1 == 0 && onSegment(c, d, a)) || (d2 == 0 && onSegment(c, d, b)) ||
+      (d3 == 0 && onSegment(a, b, c)) || (d4 == 0 && onSegment(a, b, d));
+  }
+
+  // whether p lies in the counter-clockwise convex polygon
+  bool contains(const Points& polygon, const Eigen::Vector2d& p)
+  {
+    if(polygon.size() < 3)
+      return false;
+    for(size_t i = 0; i < polygon.size(); i++)
+      if(cross(polygon[i], polygon[(i + 1) % polygon.size()], p) < 0)
+        return false;
+    return true;
+  }
+
+  /*
+   * Overlap of the box with half extents (half_x, half_y) at (x, y, yaw) and a convex polygon, point or segment
+   * without separating axes: they overlap if a vertex of one lies in the other or two edges cross.
+   */
+  bool overlaps(const Points& polygon, double x, double y, double yaw, double half_x, double half_y)
+  {
+    const Eigen::Vector2d position(x, y);
+    const Eigen::Vector2d axis_x(std::cos(yaw), std::sin(yaw));
+    const Eigen::Vector2d axis_y(-axis_x.y(), axis_x.x());
+    Points box;
+    for(int i = 0; i < 4; i++)
+      box.push_back(position + (i == 1 || i == 2 ? half_x : -half_x) * axis_x + (i >= 2 ? half_y : -half_y) * axis_y);
+
+    for(const Eigen::Vector2d& corner : box)
+      if(contains(polygon, corner))
+        return true;
+    for(const Eigen::Vector2d& vertex : polygon)
+      if(std::abs(axis_x.dot(vertex - position)) <= half_x && std::abs(axis_y.dot(vertex - position)) <= half_y)
+        return true;
+    const size_t edges = polygon.size() < 3 ? polygon.size() - 1 : polygon.size();
+    for(size_t i = 0; i < edges; i++)
+      for(size_t j = 0; j < 4; j++)
+        if(segmentsIntersect(polygon[i], polygon[(i + 1) % polygon.size()], box[j], box[(j + 1) % 4]))
+          return true;
+    return false;
+  }
+
+  /*
+   * Convex obstacles on a 1 m x 1 m table around the origin, counter-clockwise with 1 to 8 vertices,
+   * so that points and segments are covered too.
+   */
+  std::vector<Points> makeObstacles(std::mt19937& generator, int count)
+  {
+    std::uniform_real_distribution<double> position(-0.5, 0.5);
+    std::uniform_real_distribution<double> radius(0.005, 0.1);
+    std::uniform_real_distribution<double> angle(0.0, 2.0 * M_PI);
+    std::uniform_int_distribution<int> vertices(1, 8);
+    std::vector<Points> obstacles(count);
+    for(Points& obstacle : obstacles) {
+      const Eigen::Vector2d center(position(generator), position(generator));
+      const double r = radius(generator);
+      std::vector<double> angles(vertices(generator));
+      for(double& a : angles)
+        a = angle(generator);
+      std::sort(angles.begin(), angles.end());
+      for(double a : angles)
+        obstacle.push_back(center + r * Eigen::Vector2d(std::cos(a), std::sin(a)));
+    }
+    return obstacles;
+  }
+
+  // brute force over all obstacles, -1 if the pose is within tolerance of touching one
+  int bruteForceCollides(const std::vector<Points>& obstacles, double x, double y, double yaw)
+  {
+    const double tolerance = 1e-9;
+    bool grown = false, shrunk = false;
+    for(const Points& obstacle : obstacles) {
+      grown = grown || overlaps(obstacle, x, y, yaw, HALF_X + tolerance, HALF_Y + tolerance);
+      shrunk = shrunk || overlaps(obstacle, x, y, yaw, HALF_X - tolerance, HALF_Y - tolerance);
+    }
+    return grown == shrunk ? grown : -1;
+  }
+
+  // state at t in [0, 1] of the motion from a to b (x, y, yaw), interpolated along the shorter rotation
+  Eigen::Vector3d interpolate(const Eigen::Vector3d& a, const Eigen::Vector3d& b, double t)
+  {
+    return Eigen::Vector3d(a.x() + t * (b.x() - a.x()), a.y() + t * (b.y() - a.y()),
+      a.z() + t * std::remainder(b.z() - a.z(), 2.0 * M_PI));
+  }
+
+}
+
+TEST(ObstacleFootprints, CollidesMatchesBruteForce)
+{
+  std::mt19937 generator(1);
+  const std::vector<Points> obstacles = makeObstacles(generator, 20);
+  ObstacleFootprints footprints;
+  for(const Points& obstacle : obstacles)
+    footprints.addPolygon(obstacle);
+  ASSERT_EQ(footprints.size(), obstacles.size());
+
+  std::uniform_real_distribution<double> position(-0.6, 0.6);
+  std::uniform_real_distribution<double> yaw(-M_PI, M_PI);
+  int collisions = 0, free = 0;
+  for(int i = 0; i < 20000; i++) {
+    const double x = position(generator), y = position(generator), theta = yaw(generator);
+    const int expected = bruteForceCollides(obstacles, x, y, theta);
+    if(expected < 0)
+      continue;
+    EXPECT_EQ(footprints.collides(x, y, theta), expected == 1) << "at " << x << ", " << y << ", " << theta;
+    (expected ? collisions : free)++;
+  }
+  // both outcomes are exercised
+  EXPECT_GT(collisions, 1000);
+  EXPECT_GT(free, 1000);
+}
+
+TEST(ObstacleFootprints, CollidesWithoutObstacles)
+{
+  ObstacleFootprints footprints;
+  EXPECT_EQ(footprints.size(), 0u);
+  EXPECT_FALSE(footprints.collides(0.0, 0.0, 0.0));
+}
+
+TEST(ObstacleFootprints, TouchingBoxes)
+{
+  // an obstacle the size of the box placed next to it, slightly apart and slightly overlapping
+  const Points obstacle = { Eigen::Vector2d(-HALF_X, -HALF_Y), Eigen::Vector2d(HALF_X, -HALF_Y),
+    Eigen::Vector2d(HALF_X, HALF_Y), Eigen::Vector2d(-HALF_X, HALF_Y) };
+  ObstacleFootprints footprints;
+  footprints.addPolygon(obstacle);
+  EXPECT_TRUE(footprints.collides(0.0, 0.0, 0.0));
+  EXPECT_FALSE(footprints.collides(2 * HALF_X + 1e-6, 0.0, 0.0));
+  EXPECT_TRUE(footprints.collides(2 * HALF_X - 1e-6, 0.0, 0.0));
+  EXPECT_FALSE(footprints.collides(0.0, 2 * HALF_Y + 1e-6, M_PI));
+  EXPECT_TRUE(footprints.collides(0.0, 2 * HALF_Y - 1e-6, M_PI));
+  // corner to corner along the diagonal, rotated by 90 degrees
+  EXPECT_FALSE(footprints.collides(HALF_X + HALF_Y + 1e-6, HALF_Y + HALF_X + 1e-6, 0.5 * M_PI));
+}
+
+TEST(ObstacleFootprints, SweepCoversInterpolatedStates)
+{
+  std::mt19937 generator(2);
+  const std::vector<Points> obstacles = makeObstacles(generator, 20);
+  ObstacleFootprints footprints;
+  for(const Points& obstacle : obstacles)
+    footprints.addPolygon(obstacle);
+
+  std::uniform_real_distribution<double> position(-0.6, 0.6);
+  std::uniform_real_distribution<double> step(-0.1, 0.1);
+  std::uniform_real_distribution<double> yaw(-M_PI, M_PI);
+  const int samples = 200;
+  int collisions = 0, free = 0;
+  for(int i = 0; i < 5000; i++) {
+    const Eigen::Vector3d from(position(generator), position(generator), yaw(generator));
+    const Eigen::Vector3d to(from.x() + step(generator), from.y() + step(generator), yaw(generator));
+    bool expected = false;
+    for(int s = 0; s <= samples && !expected; s++) {
+      const Eigen::Vector3d state = interpolate(from, to, double(s) / samples);
+      expected = footprints.collides(state.x(), state.y(), state.z());
+    }
+    const bool sweep = footprints.sweepCollides(from.x(), from.y(), from.z(), to.x(), to.y(), to.z());
+    // conservative, so it may report motions that pass between the sampled states
+    if(expected)
+      EXPECT_TRUE(sweep) << "from " << from.transpose() << " to " << to.transpose();
+    (sweep ? collisions : free)++;
+  }
+  EXPECT_GT(collisions, 500);
+  EXPECT_GT(free, 500);
+}
+
+TEST(ObstacleFootprints, SweepIsExactForTranslations)
+{
+  std::mt19937 generator(3);
+  const std::vector<Points> obstacles = makeObstacles(generator, 20);
+  ObstacleFootprints footprints;
+  for(const Points& obstacle : obstacles)
+    footprints.addPolygon(obstacle);
+
+  std::uniform_real_distribution<double> position(-0.6, 0.6);
+  std::uniform_real_distribution<double> step(-0.1, 0.1);
+  std::uniform_real_distribution<double> yaw(-M_PI, M_PI);
+  const int samples = 100;
+  int checked = 0;
+  for(int i = 0; i < 5000; i++) {
+    const Eigen::Vector3d from(position(generator), position(generator), yaw(generator));
+    const Eigen::Vector3d to(from.x() + step(generator), from.y() + step(generator), from.z());
+    if(!footprints.sweepCollides(from.x(), from.y(), from.z(), to.x(), to.y(), to.z()))
+      continue;
+    // without rotation the swept area is the hull of both footprints, every point of which lies within
+    // half a sample spacing of a sampled footprint
+    const double grow = 0.5 * (to - from).norm() / samples + 1e-9;
+    bool touched = false;
+    for(int s = 0; s <= samples && !touched; s++) {
+      const Eigen::Vector3d state = interpolate(from, to, double(s) / samples);
+      for(size_t o = 0; o < obstacles.size() && !touched; o++)
+        touched = overlaps(obstacles[o], state.x(), state.y(), state.z(), HALF_X + grow, HALF_Y + grow);
+    }
+    EXPECT_TRUE(touched) << "from " << from.transpose() << " to " << to.transpose();
+    checked++;
+  }
+  EXPECT_GT(checked, 500);
+}
+
+TEST(ObstacleFootprints, SweepPassesBetweenObstacles)
+{
+  // two posts at the sides of a corridor slightly wider than the box, one across its end
+  ObstacleFootprints footprints;
+  const double gap = 1e-3;
+  footprints.addPolygon({ Eigen::Vector2d(-1.0, HALF_Y + gap), Eigen::Vector2d(1.0, HALF_Y + gap), Eigen::Vector2d(0.0, 1.0) });
+  footprints.addPolygon({ Eigen::Vector2d(-1.0, -HALF_Y - gap), Eigen::Vector2d(0.0, -1.0), Eigen::Vector2d(1.0, -HALF_Y - gap) });
+  footprints.addPolygon({ Eigen::Vector2d(2.0, -0.5), Eigen::Vector2d(2.5, -0.5), Eigen::Vector2d(2.5, 0.5) });
+  EXPECT_FALSE(footprints.sweepCollides(-0.5, 0.0, 0.0, 0.5, 0.0, 0.0));
+  // turning in the corridor hits its sides
+  EXPECT_TRUE(footprints.sweepCollides(-0.5, 0.0, 0.0, 0.5, 0.0, 0.1));
+  // running into the post across the end
+  EXPECT_TRUE(footprints.sweepCollides(0.5, 0.0, 0.0, 2.5, 0.0, 0.0));
+  EXPECT_FALSE(footprints.collides(0.5, 0.0, 0.0));
+  EXPECT_FALSE(footprints.collides(3.0, 0.0, 0.0));
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
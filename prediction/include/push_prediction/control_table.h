@@ -0,0 +1,176 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+#pragma once
+
+#include <tams_ur5_push_msgs/Push.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace push_prediction {
+
+    /*
+     * Precomputed predictions on a grid over the planner controls (pivot, angle, distance)
+     * in [0, 1]^3, as converted to pushes by push_planning (convertControlToPush):
+     * the pivot runs around the border of the object starting at its corner (-x/2, -y/2),
+     * the approach angle is (angle - 0.5) * 90 degrees and the distance up to 5 cm.
+     *
+     * Every side of the object has its own grid, so the interpolation never mixes the
+     * approach normals of two sides. Predictions are interpolated trilinearly between the
+     * grid nodes. The file stores the largest error measured against the network and a
+     * guaranteed bound from the interval bounds of every cell (see PushPredictor::predictBounds).
+     */
+    class ControlTable {
+        public:
+            static constexpr size_t SIDES = 4;
+            static constexpr size_t VALUES = 3;
+
+            static constexpr double DEFAULT_OBJECT_X = 0.162;
+            static constexpr double DEFAULT_OBJECT_Y = 0.23;
+            static constexpr double MAX_ANGLE = 0.25 * M_PI;
+            static constexpr double MAX_DISTANCE = 0.05;
+
+            ControlTable() = default;
+
+            /*
+             * Grid with pivot_nodes nodes around the whole border (distributed over the sides
+             * by their length, at least two per side) and angle_nodes x distance_nodes per pivot.
+             * corner_refinement blends the pivot spacing from uniform (0) to cosine spacing (1),
+             * which is denser at the corners where the predictions change fastest.
+             * The values are zero until set with nodeValues().
+             */
+            ControlTable(size_t pivot_nodes, size_t angle_nodes, size_t distance_nodes, double corner_refinement = 0.0,
+                    double object_x = DEFAULT_OBJECT_X, double object_y = DEFAULT_OBJECT_Y);
+
+            void load(const std::string& filename);
+
+            void save(const std::string& filename) const;
+
+            size_t nodes() const {
+                return values_.size() / VALUES;
+            }
+
+            // control of a grid node, with the side the pivot belongs to
+            void nodeControl(size_t node, size_t& side, double* control) const;
+
+            float* nodeValues(size_t node) {
+                return values_.data() + node * VALUES;
+            }
+
+            // side and position along the side (0 to 1) of a pivot, false outside of [0, 1]
+            bool pivotSide(double pivot, size_t& side, double& position) const;
+
+            // side of any pivot, corners belong to the side ending there (as in getPoseFromBoxBorder)
+            static size_t sideOfPivot(double pivot, double object_x = DEFAULT_OBJECT_X, double object_y = DEFAULT_OBJECT_Y);
+
+            // approach point of a pivot on a side relative to the object center, computed like getPoseFromBoxBorder
+            static void borderPoint(size_t side, double pivot, double& x, double& y,
+                    double object_x = DEFAULT_OBJECT_X, double object_y = DEFAULT_OBJECT_Y);
+
+            // yaw of the approach normal of a side
+            static double sideNormal(size_t side);
+
+            // push of a control on the given side
+            void controlToPush(size_t side, const double* control, tams_ur5_push_msgs::Push& push) const;
+
+            // control of a push on the border of the object, false for other pushes
+            bool pushToControl(const tams_ur5_push_msgs::Push& push, size_t& side, double* control) const;
+
+            // interpolated prediction of a control, false outside of the table
+            bool interpolate(const double* control, float* values) const;
+
+            bool interpolate(size_t side, const double* control, float* values) const;
+
+            // pivot of the corner at the start of a side
+            double sideStart(size_t side) const;
+
+            // pivot at a position (0 to 1) along a side
+            double pivotControl(size_t side, double position) const;
+
+            // positions of the pivot nodes along a side
+            const std::vector<double>& pivotPositions(size_t side) const {
+                return pivot_positions_[side];
+            }
+
+            // largest difference to the network on the evaluation samples
+            const float* maxError() const {
+                return max_error_;
+            }
+
+            // the network differs by at most this much inside of the table
+            const float* errorBound() const {
+                return error_bound_;
+            }
+
+            void setError(const float* max_error, const float* error_bound);
+
+            size_t pivotNodes(size_t side) const {
+                return pivot_nodes_[side];
+            }
+
+            size_t angleNodes() const {
+                return angle_nodes_;
+            }
+
+            size_t distanceNodes() const {
+                return distance_nodes_;
+            }
+
+        private:
+            double object_x_ = DEFAULT_OBJECT_X;
+            double object_y_ = DEFAULT_OBJECT_Y;
+            float corner_refinement_ = 0.0f;
+            uint32_t pivot_nodes_[SIDES] = {};
+            std::vector<double> pivot_positions_[SIDES];
+            // pivots of the corners, the last one is 1
+            double side_start_[SIDES + 1] = {};
+            // first node of every side
+            size_t side_offset_[SIDES] = {};
+            uint32_t angle_nodes_ = 0;
+            uint32_t distance_nodes_ = 0;
+            float max_error_[VALUES] = {};
+            float error_bound_[VALUES] = {};
+            // node values, distance nodes first, then angle, pivot and side
+            std::vector<float> values_;
+
+            double sideLength(size_t side) const {
+                return side % 2 == 0 ? object_x_ : object_y_;
+            }
+
+            void setupOffsets();
+    };
+}
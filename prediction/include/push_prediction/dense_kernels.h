@@ -0,0 +1,133 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace push_prediction {
+  namespace kernels {
+
+    // number of output rows per panel of packed Dense weights
+    const size_t PANEL_ROWS = 16;
+
+    // matches NeuralNetwork::Activation
+    enum Activation { LINEAR = 0, RELU, SIGMOID };
+
+    /*
+     * Dense weights are packed into panels of PANEL_ROWS output rows. Each panel
+     * starts with the (zero-padded) bias and the lower bound of the ReLU of its
+     * rows, followed by one PANEL_ROWS wide column of weights per input. The
+     * layout does not depend on the instruction set, so packed weights can be
+     * stored in binary model files. bias and floor may be nullptr (zero).
+     */
+    size_t packedSize(size_t rows, size_t cols);
+    void packDense(const float* weights, const float* bias, const float* floor, size_t rows, size_t cols,
+        float* packed);
+
+    /*
+     * Compute output = activation(W * input + b) for a batch of column-major inputs
+     * (cols x batch) into column-major outputs (rows x batch) in a single pass.
+     * ReLU computes max(x, floor) with the floor stored in the panels.
+     */
+    typedef void (*DenseFunction)(const float* packed, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch);
+
+    /*
+     * Same with the columns of input and output strided by inputStride and outputStride
+     * (at least cols and rows), so a block of the rows of a larger batch runs in place.
+     */
+    typedef void (*DenseStridedFunction)(const float* packed, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch, size_t inputStride, size_t outputStride);
+
+    /*
+     * Block-sparse Dense weights skip the all-zero columns of each panel (blocks of
+     * PANEL_ROWS rows x 1 input). Each panel starts with bias and floor as above,
+     * followed by the number of stored blocks and their input indices (uint32,
+     * zero-padded to a multiple of PANEL_ROWS values) and the weights of the blocks.
+     * Run with the same signature as packed weights.
+     */
+    size_t sparsePackedSize(const float* weights, size_t rows, size_t cols);
+    void packSparseDense(const float* weights, const float* bias, const float* floor, size_t rows, size_t cols,
+        float* sparse);
+
+    struct DenseKernel {
+      const char* name;
+      DenseFunction run;
+      // block-sparse weights
+      DenseFunction runSparse;
+      DenseStridedFunction runStrided;
+    };
+
+    // kernels supported by the current CPU, fastest first
+    const std::vector<DenseKernel>& availableKernels();
+
+    // kernel by name, nullptr if unknown or unsupported
+    const DenseKernel* findKernel(const std::string& name);
+
+    // fastest supported kernel, can be overridden with the environment variable
+    // PUSH_PREDICTION_KERNEL (returns nullptr for "eigen" to select the Eigen path)
+    const DenseKernel* defaultKernel();
+
+    /*
+     * Quantized Dense layers store int8 weights with one scale per output row
+     * and quantize their input to 8 bit with a fixed range found by calibration.
+     * The layout starts with a 64 byte header (input scale), followed by panels
+     * of PANEL_ROWS rows: float scale, float bias and int32 zero point correction
+     * per row, then the weights in groups of four inputs per row, as consumed by
+     * 8 bit dot-product instructions.
+     */
+    size_t quantizedSize(size_t rows, size_t cols);
+    void quantizeDense(const float* weights, const float* bias, size_t rows, size_t cols, float inputRange,
+        uint8_t* quantized);
+
+    typedef void (*QuantizedDenseFunction)(const uint8_t* quantized, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch);
+
+    struct QuantizedDenseKernel {
+      const char* name;
+      QuantizedDenseFunction run;
+    };
+
+    const std::vector<QuantizedDenseKernel>& availableQuantizedKernels();
+    const QuantizedDenseKernel* findQuantizedKernel(const std::string& name);
+
+    // can be overridden with the environment variable PUSH_PREDICTION_QUANTIZED_KERNEL
+    const QuantizedDenseKernel* defaultQuantizedKernel();
+  }
+}
@@ -0,0 +1,84 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+
+/* Author: Lars Henning Kayser */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <push_prediction/neural_network.h>
+
+namespace push_prediction {
+
+    /*
+     * Process-wide cache of loaded networks keyed by model path.
+     * The first request loads the model and runs the setup function on it,
+     * later requests get the same immutable network without loading it again.
+     * Networks are shared between threads (see NeuralNetwork::InferenceContext)
+     * and stay loaded until clear() is called.
+     */
+    class ModelRegistry {
+        public:
+            typedef std::function<void(NeuralNetwork&)> Setup;
+
+            static ModelRegistry& instance();
+
+            // setup is only applied when the model is loaded, so all users of a path need to agree on it
+            std::shared_ptr<const NeuralNetwork> get(const std::string& model_file, const Setup& setup = Setup());
+
+            // ensemble of the models (see NeuralNetwork::stack), the setup is applied to the members and the ensemble
+            std::shared_ptr<const NeuralNetwork> getEnsemble(const std::vector<std::string>& model_files, const Setup& setup = Setup());
+
+            bool contains(const std::string& model_file);
+
+            // release the registry's references, handed out networks stay valid
+            void clear();
+
+        private:
+            ModelRegistry() = default;
+
+            // get() with the mutex held
+            std::shared_ptr<const NeuralNetwork> load(const std::string& model_file, const Setup& setup);
+
+            std::mutex mutex_;
+            std::map<std::string, std::shared_ptr<const NeuralNetwork>> networks_;
+    };
+}
@@ -32,12 +32,29 @@
 /* Author: Lars Henning Kayser */
 
 
+
 #pragma once
 
 #include <Eigen/Dense>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
 #include <functional>
+#include <memory>
+#include <new>
+#include <push_prediction/dense_kernels.h>
+#include <push_prediction/profiling.h>
+#include <random>
 #include <ros/ros.h>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <unordered_map>
 #include <vector>
 #include <xmlrpcpp/base64.h>
@@ -45,6 +62,9 @@
 
 class NeuralNetwork {
 
+    // emits fixed-size C++ code for a loaded network (see src/tools/generate_model_header.cpp)
+    friend class NeuralNetworkCodeGenerator;
+
 	private:
 
 
@@ -72,32 +92,498 @@ class NeuralNetwork {
         return vector;
     }
 
+    // read-only view of a weight matrix, stored column-major (rows x cols)
+    // either in memory owned by the network or in a memory-mapped model file
+    struct Weight {
+        const float* data = nullptr;
+        size_t rows = 0;
+        size_t cols = 0;
+        Eigen::Map<const Eigen::MatrixXf> matrix() const { return Eigen::Map<const Eigen::MatrixXf>(data, rows, cols); }
+        Eigen::Map<const Eigen::VectorXf> vector() const { return Eigen::Map<const Eigen::VectorXf>(data, rows * cols); }
+    };
+
+    // range of the activation arena holding a layer output; for a batch of
+    // n samples the slot stores a column-major (size x n) matrix at offset * n
+    struct Slot {
+        size_t offset = 0;
+        size_t size = 0;
+    };
+
+    enum class LayerType : uint32_t {
+        input = 0,
+        dense,
+        multiply,
+        add,
+        dropout,
+    };
+
+    enum class Activation : uint32_t {
+        linear = 0,
+        relu,
+        sigmoid,
+    };
+
     struct Layer {
         std::string name;
         std::vector<std::string> inputNames;
         std::vector<std::shared_ptr<Layer>> inputLayers;
-        std::vector<Eigen::VectorXf> inputs;
-        Eigen::VectorXf output;
-        std::vector<Eigen::MatrixXf> weights;
-        virtual void run() {}
+        std::vector<Weight> weights;
+
+        // arena slots, assigned by compile()
+        std::vector<Slot> inputSlots;
+        Slot outputSlot;
+
+        // run time of the layer (PUSH_PREDICTION_PROFILING)
+        push_prediction::profiling::Statistic* profile = nullptr;
+
+        Eigen::Map<const Eigen::MatrixXf, Eigen::Aligned> input(const float* arena, size_t i, size_t batch) const {
+            return Eigen::Map<const Eigen::MatrixXf, Eigen::Aligned>(arena + inputSlots[i].offset * batch, inputSlots[i].size, batch);
+        }
+        Eigen::Map<Eigen::MatrixXf, Eigen::Aligned> output(float* arena, size_t batch) const {
+            return Eigen::Map<Eigen::MatrixXf, Eigen::Aligned>(arena + outputSlot.offset * batch, outputSlot.size, batch);
+        }
+
+        virtual LayerType type() const = 0;
+        virtual size_t outputSize() const { return inputSlots.empty() ? 0 : inputSlots[0].size; }
+        virtual void run(float* arena, size_t batch) const {}
+        // derivatives of the output with respect to the network inputs: the tangent arena
+        // holds one column per input, the arena holds the values of a single sample
+        virtual void tangent(const float* arena, float* tangents, size_t inputs) const {}
+        // interval bounds of the output: the bounds arena holds the lower bounds
+        // in the first and the upper bounds in the second column of each slot
+        virtual void bound(float* bounds) const { run(bounds, 2); }
+    };
+
+    struct Input : Layer {
+        LayerType type() const { return LayerType::input; }
+    };
+
+    struct Dense : Layer {
+        Activation activation = Activation::linear;
+        bool useBias = false;
+        // fused kernel and its panel-packed weights (see dense_kernels.h),
+        // the layer falls back to Eigen if no kernel is selected
+        const push_prediction::kernels::DenseKernel* kernel = nullptr;
+        Weight packed;
+        // block-sparse packed weights (see kernels::packSparseDense), used instead of packed if set
+        Weight sparse;
+        // diagonal blocks of the block-diagonal layers of a stacked ensemble (see NeuralNetwork::stack),
+        // each one runs the dense kernel on the rows and columns of one member
+        struct Block {
+            size_t row = 0, col = 0, rows = 0, cols = 0;
+            // offset of the packed block in blockPacked and blockFolded
+            size_t packed = 0;
+        };
+        std::vector<Block> blocks;
+        // packed weights of all blocks, used instead of packed if there are blocks (and no sparse weights)
+        Weight blockPacked;
+        // blockPacked with the network output transform folded in, used instead of blockPacked if set
+        Eigen::VectorXf blockFolded;
+        // packed (or block-sparse) weights with the network input or output transform
+        // folded in, used instead of packed if set
+        Eigen::VectorXf folded;
+        // lower bound of the ReLU if the output transform is folded in (zero otherwise)
+        Eigen::VectorXf foldedFloor;
+        // int8 weights (see kernels::quantizeDense), stored as a float array
+        const push_prediction::kernels::QuantizedDenseKernel* quantizedKernel = nullptr;
+        Weight quantized;
+        // packed absolute values of the weights (without bias) for bound()
+        Eigen::VectorXf absolute;
+        LayerType type() const { return LayerType::dense; }
+        size_t outputSize() const { return weights[0].rows; }
+        void run(float* arena, size_t batch) const {
+            if(quantizedKernel) {
+                quantizedKernel->run(reinterpret_cast<const uint8_t*>(quantized.data), weights[0].rows, weights[0].cols,
+                        static_cast<push_prediction::kernels::Activation>(activation),
+                        arena + inputSlots[0].offset * batch, arena + outputSlot.offset * batch, batch);
+                return;
+            }
+            if(kernel) {
+                if(sparse.data) {
+                    kernel->runSparse(folded.size() ? folded.data() : sparse.data, weights[0].rows, weights[0].cols,
+                            static_cast<push_prediction::kernels::Activation>(activation),
+                            arena + inputSlots[0].offset * batch, arena + outputSlot.offset * batch, batch);
+                    return;
+                }
+                if(!blocks.empty()) {
+                    runBlocks(arena, batch);
+                    return;
+                }
+                kernel->run(folded.size() ? folded.data() : packed.data, weights[0].rows, weights[0].cols,
+                        static_cast<push_prediction::kernels::Activation>(activation),
+                        arena + inputSlots[0].offset * batch, arena + outputSlot.offset * batch, batch);
+                return;
+            }
+            auto output = this->output(arena, batch);
+            output.noalias() = weights[0].matrix() * input(arena, 0, batch);
+            if(useBias) {
+                output.colwise() += weights[1].vector();
+            }
+            switch(activation) {
+                case Activation::relu:
+                    output = output.cwiseMax(0.0f);
+                    break;
+                case Activation::sigmoid:
+                    output.array() = 1.0f / (1.0f + (-output.array()).exp());
+                    break;
+                default:
+                    break;
+            }
+        }
+        // the rows of a block are strided by the slot sizes in a batch, the kernel runs on them in place
+        void runBlocks(float* arena, size_t batch) const {
+            const float* packedBlocks = blockFolded.size() ? blockFolded.data() : blockPacked.data;
+            for(auto &block : blocks) {
+                kernel->runStrided(packedBlocks + block.packed, block.rows, block.cols,
+                        static_cast<push_prediction::kernels::Activation>(activation),
+                        arena + inputSlots[0].offset * batch + block.col, arena + outputSlot.offset * batch + block.row,
+                        batch, inputSlots[0].size, outputSlot.size);
+            }
+        }
+        // uses the weights without folded transforms, jacobian() applies the transforms
+        void tangent(const float* arena, float* tangents, size_t inputs) const {
+            auto output = this->output(tangents, inputs);
+            if(kernel) {
+                // the tangent columns run as a batch, the bias is added by the kernel
+                kernel->run(packed.data, weights[0].rows, weights[0].cols, push_prediction::kernels::LINEAR,
+                        tangents + inputSlots[0].offset * inputs, tangents + outputSlot.offset * inputs, inputs);
+                if(useBias)
+                    output.colwise() -= weights[1].vector();
+            } else {
+                output.noalias() = weights[0].matrix() * input(tangents, 0, inputs);
+            }
+            Eigen::Map<const Eigen::VectorXf> value(arena + outputSlot.offset, outputSlot.size);
+            switch(activation) {
+                case Activation::relu:
+                    if(foldedFloor.size())
+                        output = (value.array() > foldedFloor.array()).cast<float>().matrix().asDiagonal() * output;
+                    else
+                        output = (value.array() > 0.0f).cast<float>().matrix().asDiagonal() * output;
+                    break;
+                case Activation::sigmoid:
+                    output = (value.array() * (1.0f - value.array())).matrix().asDiagonal() * output;
+                    break;
+                default:
+                    break;
+            }
+        }
+        // center/radius form: W c + b +- |W| r, the activations are monotonic
+        void bound(float* bounds) const {
+            auto input = this->input(bounds, 0, 2);
+            auto output = this->output(bounds, 2);
+            const Eigen::VectorXf center = 0.5f * (input.col(0) + input.col(1));
+            const Eigen::VectorXf radius = 0.5f * (input.col(1) - input.col(0));
+            if(kernel) {
+                kernel->run(packed.data, weights[0].rows, weights[0].cols, push_prediction::kernels::LINEAR,
+                        center.data(), output.col(0).data(), 1);
+                kernel->run(absolute.data(), weights[0].rows, weights[0].cols, push_prediction::kernels::LINEAR,
+                        radius.data(), output.col(1).data(), 1);
+            } else {
+                output.col(0).noalias() = weights[0].matrix() * center;
+                if(useBias)
+                    output.col(0) += weights[1].vector();
+                output.col(1).noalias() = weights[0].matrix().cwiseAbs() * radius;
+            }
+            output.col(0) -= output.col(1);
+            output.col(1) = output.col(0) + 2.0f * output.col(1);
+            switch(activation) {
+                case Activation::relu:
+                    output = output.cwiseMax(0.0f);
+                    break;
+                case Activation::sigmoid:
+                    output.array() = 1.0f / (1.0f + (-output.array()).exp());
+                    break;
+                default:
+                    break;
+            }
+        }
+    };
+
+    struct Multiply : Layer {
+        LayerType type() const { return LayerType::multiply; }
+        void run(float* arena, size_t batch) const {
+            auto output = this->output(arena, batch);
+            output = input(arena, 0, batch);
+            for(size_t i = 1; i < inputSlots.size(); i++) {
+                output.array() *= input(arena, i, batch).array();
+            }
+        }
+        // product rule
+        void tangent(const float* arena, float* tangents, size_t inputs) const {
+            auto output = this->output(tangents, inputs);
+            output.setZero();
+            for(size_t i = 0; i < inputSlots.size(); i++) {
+                Eigen::VectorXf factor = Eigen::VectorXf::Ones(inputSlots[i].size);
+                for(size_t j = 0; j < inputSlots.size(); j++) {
+                    if(j != i)
+                        factor = factor.cwiseProduct(input(arena, j, 1).col(0));
+                }
+                output += factor.asDiagonal() * input(tangents, i, inputs);
+            }
+        }
+        // the product of intervals is bounded by the products of their ends
+        void bound(float* bounds) const {
+            auto output = this->output(bounds, 2);
+            output = input(bounds, 0, 2);
+            for(size_t i = 1; i < inputSlots.size(); i++) {
+                auto in = input(bounds, i, 2);
+                const Eigen::ArrayXf a = output.col(0).array() * in.col(0).array();
+                const Eigen::ArrayXf b = output.col(0).array() * in.col(1).array();
+                const Eigen::ArrayXf c = output.col(1).array() * in.col(0).array();
+                const Eigen::ArrayXf d = output.col(1).array() * in.col(1).array();
+                output.col(0) = a.min(b).min(c.min(d)).matrix();
+                output.col(1) = a.max(b).max(c.max(d)).matrix();
+            }
+        }
+    };
+
+    /*
+     * Identity at inference. Its output shares the slot of its input if it is
+     * the only consumer, otherwise run() copies. sample() applies a random
+     * dropout mask (scaled by 1 / (1 - rate) as in training) for Monte-Carlo dropout.
+     */
+    struct Dropout : Layer {
+        float rate = 0.0f;
+        LayerType type() const { return LayerType::dropout; }
+        bool aliased() const { return outputSlot.offset == inputSlots[0].offset; }
+        void run(float* arena, size_t batch) const {
+            if(!aliased())
+                output(arena, batch) = input(arena, 0, batch);
+        }
+        void tangent(const float* arena, float* tangents, size_t inputs) const {
+            run(tangents, inputs);
+        }
+        void sample(float* arena, size_t batch, uint64_t* random) const {
+            const float* in = arena + inputSlots[0].offset * batch;
+            float* out = arena + outputSlot.offset * batch;
+            const size_t size = outputSlot.size * batch;
+            // keep a unit if its 16 bit uniform value is below keep, the
+            // mask selects the scale without branches
+            const uint32_t keep = static_cast<uint32_t>((1.0f - rate) * 65536.0f + 0.5f);
+            const float scale = rate < 1.0f ? 1.0f / (1.0f - rate) : 0.0f;
+            uint32_t scaleBits;
+            memcpy(&scaleBits, &scale, sizeof(scale));
+            for(size_t i = 0; i < size; i += 16) {
+                // four independent xorshift64* generators, four values each
+                uint16_t values[16];
+                for(size_t k = 0; k < 4; k++) {
+                    random[k] ^= random[k] >> 12;
+                    random[k] ^= random[k] << 25;
+                    random[k] ^= random[k] >> 27;
+                    const uint64_t bits = random[k] * 0x2545F4914F6CDD1DULL;
+                    memcpy(values + 4 * k, &bits, sizeof(bits));
+                }
+                const size_t count = std::min<size_t>(16, size - i);
+                for(size_t j = 0; j < count; j++) {
+                    const uint32_t mask = -static_cast<uint32_t>(values[j] < keep) & scaleBits;
+                    float factor;
+                    memcpy(&factor, &mask, sizeof(factor));
+                    out[i + j] = in[i + j] * factor;
+                }
+            }
+        }
+    };
+
+    struct Add : Layer {
+        LayerType type() const { return LayerType::add; }
+        void run(float* arena, size_t batch) const {
+            auto output = this->output(arena, batch);
+            output = input(arena, 0, batch);
+            for(size_t i = 1; i < inputSlots.size(); i++) {
+                output += input(arena, i, batch);
+            }
+        }
+        void tangent(const float* arena, float* tangents, size_t inputs) const {
+            auto output = this->output(tangents, inputs);
+            output = input(tangents, 0, inputs);
+            for(size_t i = 1; i < inputSlots.size(); i++) {
+                output += input(tangents, i, inputs);
+            }
+        }
+    };
+
+    static std::shared_ptr<Layer> createLayer(LayerType type) {
+        switch(type) {
+            case LayerType::input: return std::make_shared<Input>();
+            case LayerType::dense: return std::make_shared<Dense>();
+            case LayerType::multiply: return std::make_shared<Multiply>();
+            case LayerType::add: return std::make_shared<Add>();
+            case LayerType::dropout: return std::make_shared<Dropout>();
+        }
+        return nullptr;
+    }
+
+    /*
+     * Binary model format
+     *
+     * A binary model is the in-memory image of a loaded network so that it can be
+     * mmap'ed and used in place: a file header, a table of layer records and the
+     * normalization and weight arrays. Weights are stored in the layout used by the
+     * kernels (column-major, output x input), Dense layers additionally store
+     * their panel-packed and optionally their int8 quantized or block-sparse weights, and every array starts at a 64 byte aligned
+     * file offset. Values are stored in native byte order.
+     */
+    static const char* binaryMagic() { return "PUSHNNB"; }
+    static constexpr size_t binaryMagicSize = 8;
+    static constexpr uint32_t binaryVersion = 6;
+    static constexpr size_t binaryAlignment = 64;
+    static constexpr size_t binaryMaxInputs = 8;
+
+    struct BinaryArray {
+        uint64_t offset;
+        uint32_t rows;
+        uint32_t cols;
+    };
+
+    struct BinaryHeader {
+        char magic[binaryMagicSize];
+        uint32_t version;
+        uint32_t layerCount;
+        uint32_t inputLayer;
+        uint32_t outputLayer;
+        uint32_t normalization;  // 0: none, 1: min_max, 2: z_score
+        uint32_t ensembleSize;  // stacked models (see stack), 0 or 1 for a single model
+        uint64_t fileSize;
+        // (min_in, max_in, min_out, max_out) or (input center, input scale, output center, output scale)
+        BinaryArray normalizationArrays[4];
+    };
+
+    struct BinaryLayer {
+        char name[48];
+        uint32_t type;
+        uint32_t activation;
+        uint32_t useBias;
+        uint32_t inputCount;
+        uint32_t inputs[binaryMaxInputs];
+        uint32_t weightCount;
+        float rate;  // Dropout only
+        BinaryArray weights[2];
+        BinaryArray packed;  // Dense only, packedSize x 1
+        BinaryArray quantized;  // Dense only, quantizedSize / 4 x 1 or empty
+        BinaryArray sparse;  // Dense only, sparsePackedSize x 1 or empty
     };
 
     std::unordered_map<std::string, std::shared_ptr<Layer>> layerMap;
     std::vector<std::shared_ptr<Layer>> layerList;
+
+    // memory backing the weight views: owned matrices or a file mapping
+    std::vector<std::shared_ptr<const void>> storage_;
+
+    // execution plan created by compile(): layers in topological order
+    // and the size of the activation arena holding all intermediate outputs
+    std::vector<std::shared_ptr<Layer>> ops_;
+    size_t arenaSize_ = 0;
+    size_t inputSize_ = 0;
     Eigen::VectorXf _inputCenter, _inputScale, _outputCenter, _outputScale;
     Eigen::VectorXf _inputMin, _inputMax, _outputMin, _outputMax;
+    // normalization as x' = (x - shift) / divisor and y = y' * factor + shift
+    Eigen::VectorXf _inputShift, _inputDivisor, _outputFactor, _outputShift;
+    // affine transforms of the network inputs and outputs (normalization and
+    // transformInputs/transformOutputs): the input layer receives
+    // inScale_ * x + inOffset_ and run() returns outScale_ * y + outOffset_
+    Eigen::VectorXf inScale_, inOffset_, outScale_, outOffset_;
+    bool inputTransform_ = false, outputTransform_ = false;
+    // transforms folded into the first and last Dense layers by setupKernels()
+    bool folding_ = true, inputFolded_ = false, outputFolded_ = false;
     std::shared_ptr<Layer> inputLayer, outputLayer;
+    const push_prediction::kernels::DenseKernel* kernel_ = push_prediction::kernels::defaultKernel();
+    const push_prediction::kernels::QuantizedDenseKernel* quantizedKernel_ = push_prediction::kernels::defaultQuantizedKernel();
+    bool quantized_ = false;
     bool has_normalization_=false;
     std::string normalization_type;
+    // number of stacked models, the outputs of model m are rows m * n ... (m + 1) * n - 1
+    size_t ensembleSize_ = 1;
+
+    // statistics of run(), runBatch() and the unfolded transforms (PUSH_PREDICTION_PROFILING),
+    // named after the model file
+    std::string profileName_ = "network";
+    push_prediction::profiling::Statistic *runProfile_ = nullptr, *batchProfile_ = nullptr;
+    push_prediction::profiling::Statistic *batchSizeProfile_ = nullptr, *transformProfile_ = nullptr;
+
+    // aligned to cache lines like the arrays of a binary model, the kernels load
+    // whole panel rows and loads crossing cache lines slow down large layers
+    Weight storeWeight(const Eigen::MatrixXf &matrix) {
+        void* data = nullptr;
+        if(posix_memalign(&data, binaryAlignment, std::max<size_t>(matrix.size(), 1) * sizeof(float)) != 0)
+            throw std::bad_alloc();
+        storage_.push_back(std::shared_ptr<const void>(data, free));
+        std::copy(matrix.data(), matrix.data() + matrix.size(), static_cast<float*>(data));
+        Weight weight;
+        weight.data = static_cast<const float*>(data);
+        weight.rows = matrix.rows();
+        weight.cols = matrix.cols();
+        return weight;
+    }
+
+    void reset() {
+        layerMap.clear();
+        layerList.clear();
+        storage_.clear();
+        ops_.clear();
+        inputLayer.reset();
+        outputLayer.reset();
+        has_normalization_ = false;
+        normalization_type.clear();
+        ensembleSize_ = 1;
+    }
+
+    void setupNormalization() {
+        if(normalization_type == "min_max") {
+            _inputShift = _inputMin;
+            _inputDivisor = _inputMax - _inputMin;
+            _outputFactor = _outputMax - _outputMin;
+            _outputShift = _outputMin;
+        } else if (normalization_type == "z_score") {
+            _inputShift = _inputCenter;
+            _inputDivisor = _inputScale;
+            _outputFactor = _outputScale;
+            _outputShift = _outputCenter;
+        } else {
+            ROS_WARN("unknown normalization type %s", normalization_type.c_str());
+            has_normalization_ = false;
+        }
+    }
 
     public:
     const Eigen::VectorXf &inputCenter() { return _inputCenter; }
     const Eigen::VectorXf &inputScale() { return _inputScale; }
     const Eigen::VectorXf &outputCenter() { return _outputCenter; }
     const Eigen::VectorXf &outputScale() { return _outputScale; }
+    const Eigen::VectorXf &inputMin() { return _inputMin; }
+    const Eigen::VectorXf &inputMax() { return _inputMax; }
+    const std::string &normalizationType() { return normalization_type; }
+
+    static bool isBinaryModel(const std::string &filename) {
+        char magic[binaryMagicSize] = {};
+        std::ifstream file(filename, std::ios::binary);
+        file.read(magic, sizeof(magic));
+        return file && memcmp(magic, binaryMagic(), sizeof(magic)) == 0;
+    }
 
+    // binary model of the format version read by loadBinary
+    static bool isCurrentBinaryModel(const std::string &filename) {
+        BinaryHeader header;
+        std::ifstream file(filename, std::ios::binary);
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        return file && memcmp(header.magic, binaryMagic(), binaryMagicSize) == 0 && header.version == binaryVersion;
+    }
+
+    /*
+     * Load a network from a binary model file or from a Keras YAML export,
+     * depending on the file contents.
+     */
     void load(const std::string &filename) {
+        profileName_ = filename.substr(filename.find_last_of('/') + 1);
+        profileName_ = profileName_.substr(0, profileName_.find('.'));
+        if(isBinaryModel(filename))
+            loadBinary(filename);
+        else
+            loadYAML(filename);
+    }
+
+    void loadYAML(const std::string &filename) {
         ROS_INFO("loading network %s", filename.c_str());
+        reset();
         YAML::Node yaml = YAML::LoadFile(filename);
 
         if(yaml["normalization"]){
@@ -114,6 +600,7 @@ class NeuralNetwork {
                 _outputCenter = yamlToVector(yaml["normalization"]["output"]["center"]);
                 _outputScale = yamlToVector(yaml["normalization"]["output"]["scale"]);
             }
+            setupNormalization();
         }
 
         YAML::Node yamlLayers = yaml["layers"];
@@ -129,7 +616,6 @@ class NeuralNetwork {
             std::string layerType = yamlLayer["class_name"].as<std::string>();
             std::shared_ptr<Layer> layer;
             if(sequentialModel && layerIndex == 0) {
-                struct Input : Layer {};
                 layer = std::make_shared<Input>();
                 layer->name = "input_layer";
                 layerMap[layer->name] = layer;
@@ -137,40 +623,14 @@ class NeuralNetwork {
                 lastLayer = layer;
             }
             else if(layerType == "InputLayer") {
-                struct Input : Layer {};
                 layer = std::make_shared<Input>();
             }
             if(layerType == "Dropout") {
-                continue;
+                auto dropout = std::make_shared<Dropout>();
+                dropout->rate = yamlLayer["config"]["rate"].as<float>();
+                layer = dropout;
             }
             if(layerType == "Dense") {
-                enum class Activation {
-                    linear = 0,
-                    relu,
-                    sigmoid,
-                };
-                struct Dense : Layer {
-                    Activation activation = Activation::linear;
-                    bool useBias = false;
-                    void run() {
-                        output = weights[0] * inputs[0];
-                        if(useBias) {
-                            output += weights[1];
-                        }
-                        switch(activation) {
-                            case Activation::relu:
-                                for(size_t i = 0; i < output.size(); i++) {
-                                    output[i] = std::max(0.0f, output[i]);
-                                }
-                                break;
-                            case Activation::sigmoid:
-                                for(size_t i = 0; i < output.size(); i++) {
-                                    output[i] = 1.0 / (1.0 + std::exp(-output[i]));
-                                }
-                                break;
-                        }
-                    }
-                };
                 auto dense = std::make_shared<Dense>();
                 dense->useBias = yamlLayer["config"]["use_bias"].as<bool>();
                 std::string activation = yamlLayer["config"]["activation"].as<std::string>();
@@ -179,38 +639,21 @@ class NeuralNetwork {
                 layer = dense;
             }
             if(layerType == "Multiply") {
-                struct Multiply : Layer {
-                    void run() {
-                        output = inputs[0];
-                        for(size_t i = 1; i < inputs.size(); i++) {
-                            output = output.cwiseProduct(inputs[i]);
-                        }
-                    }
-                };
                 layer = std::make_shared<Multiply>();
             }
             if(layerType == "Add") {
-                struct Add : Layer {
-                    void run() {
-                        output = inputs[0];
-                        for(size_t i = 1; i < inputs.size(); i++) {
-                            output += inputs[i];
-                        }
-                    }
-                };
                 layer = std::make_shared<Add>();
             }
             if(!layer) {
                 ROS_FATAL("unknown layer type %s", layerType.c_str());
                 throw 0;
             }
+            // vectors are exported as a single base64 string, matrices as one string per row
             auto yamlWeights = yaml["weights"][layerIndex];
-            std::vector<Eigen::MatrixXf> layerWeights;
             for(size_t i = 0; i < yamlWeights.size(); i++) {
-                try {
-                    layerWeights.push_back(yamlToWeightVector(yamlWeights[i]));
+                if(yamlWeights[i].IsScalar()) {
+                    layer->weights.push_back(storeWeight(yamlToWeightVector(yamlWeights[i])));
                     continue;
-                } catch(const YAML::BadConversion &e) {
                 }
                 Eigen::MatrixXf weights(yamlWeights[i].size(), yamlToWeightVector(yamlWeights[i][0]).size());
                 for(size_t row = 0; row < weights.rows(); row++) {
@@ -221,9 +664,8 @@ class NeuralNetwork {
                     }
                     weights.row(row) = r;
                 }
-                layerWeights.push_back(weights.transpose());
+                layer->weights.push_back(storeWeight(weights.transpose()));
             }
-            layer->weights = layerWeights;
 
             if(sequentialModel) {
                 layer->name = yamlLayer["config"]["name"].as<std::string>();
@@ -252,43 +694,1305 @@ class NeuralNetwork {
             inputLayer = layerMap[yamlLayers["input_layers"][0][0].as<std::string>()];
             outputLayer = layerMap[yamlLayers["output_layers"][0][0].as<std::string>()];
         }
+        compile();
         ROS_INFO("ready");
     }
 
-    bool hasNormalization() {
-        return has_normalization_;
+    /*
+     * Map a binary model file into memory. Weight views point directly into
+     * the read-only mapping, which stays alive as long as the network.
+     */
+    void loadBinary(const std::string &filename) {
+        ROS_INFO("mapping network %s", filename.c_str());
+        reset();
+
+        int fd = open(filename.c_str(), O_RDONLY);
+        struct stat fileStat;
+        if(fd < 0 || fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(BinaryHeader)) {
+            if(fd >= 0) close(fd);
+            ROS_FATAL("unable to open binary network %s", filename.c_str());
+            throw 0;
+        }
+        size_t fileSize = fileStat.st_size;
+        void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED) {
+            ROS_FATAL("unable to map binary network %s", filename.c_str());
+            throw 0;
+        }
+        storage_.push_back(std::shared_ptr<const void>(mapping, [fileSize](const void* data) {
+            munmap(const_cast<void*>(data), fileSize);
+        }));
+        const char* data = static_cast<const char*>(mapping);
+
+        const BinaryHeader* header = reinterpret_cast<const BinaryHeader*>(data);
+        if(memcmp(header->magic, binaryMagic(), binaryMagicSize) != 0 || header->version != binaryVersion
+                || header->fileSize != fileSize
+                || sizeof(BinaryHeader) + header->layerCount * sizeof(BinaryLayer) > fileSize
+                || header->inputLayer >= header->layerCount || header->outputLayer >= header->layerCount) {
+            ROS_FATAL("invalid binary network %s", filename.c_str());
+            throw 0;
+        }
+        auto array = [&](const BinaryArray& a) {
+            if(a.offset % binaryAlignment != 0 || a.offset + sizeof(float) * a.rows * a.cols > fileSize) {
+                ROS_FATAL("invalid array in binary network %s", filename.c_str());
+                throw 0;
+            }
+            Weight weight;
+            weight.data = reinterpret_cast<const float*>(data + a.offset);
+            weight.rows = a.rows;
+            weight.cols = a.cols;
+            return weight;
+        };
+
+        has_normalization_ = header->normalization != 0;
+        if(has_normalization_) {
+            Eigen::VectorXf *vectors[4] = { &_inputMin, &_inputMax, &_outputMin, &_outputMax };
+            normalization_type = "min_max";
+            if(header->normalization == 2) {
+                vectors[0] = &_inputCenter;
+                vectors[1] = &_inputScale;
+                vectors[2] = &_outputCenter;
+                vectors[3] = &_outputScale;
+                normalization_type = "z_score";
+            }
+            for(size_t i = 0; i < 4; i++) {
+                *vectors[i] = array(header->normalizationArrays[i]).vector();
+            }
+            setupNormalization();
+        }
+
+        const BinaryLayer* records = reinterpret_cast<const BinaryLayer*>(data + sizeof(BinaryHeader));
+        for(size_t i = 0; i < header->layerCount; i++) {
+            const BinaryLayer& record = records[i];
+            std::shared_ptr<Layer> layer = createLayer(static_cast<LayerType>(record.type));
+            if(!layer || record.inputCount > binaryMaxInputs || record.weightCount > 2) {
+                ROS_FATAL("invalid layer %i in binary network %s", (int)i, filename.c_str());
+                throw 0;
+            }
+            layer->name = std::string(record.name, strnlen(record.name, sizeof(record.name)));
+            for(size_t w = 0; w < record.weightCount; w++) {
+                layer->weights.push_back(array(record.weights[w]));
+            }
+            if(layer->type() == LayerType::dense) {
+                auto dense = std::static_pointer_cast<Dense>(layer);
+                dense->activation = static_cast<Activation>(record.activation);
+                dense->useBias = record.useBias != 0;
+                if(record.packed.rows > 0) {
+                    dense->packed = array(record.packed);
+                }
+                if(record.quantized.rows > 0) {
+                    dense->quantized = array(record.quantized);
+                }
+                if(record.sparse.rows > 0) {
+                    dense->sparse = array(record.sparse);
+                }
+            }
+            if(layer->type() == LayerType::dropout) {
+                std::static_pointer_cast<Dropout>(layer)->rate = record.rate;
+            }
+            layerList.push_back(layer);
+        }
+        for(size_t i = 0; i < header->layerCount; i++) {
+            for(size_t in = 0; in < records[i].inputCount; in++) {
+                if(records[i].inputs[in] >= header->layerCount) {
+                    ROS_FATAL("invalid layer input in binary network %s", filename.c_str());
+                    throw 0;
+                }
+                auto &input = layerList[records[i].inputs[in]];
+                layerList[i]->inputNames.push_back(input->name);
+                layerList[i]->inputLayers.push_back(input);
+            }
+            layerMap[layerList[i]->name] = layerList[i];
+        }
+        inputLayer = layerList[header->inputLayer];
+        outputLayer = layerList[header->outputLayer];
+        ensembleSize_ = std::max<uint32_t>(header->ensembleSize, 1);
+        compile();
+        if(outputSize() % ensembleSize_ != 0) {
+            ROS_FATAL("invalid ensemble size in binary network %s", filename.c_str());
+            throw 0;
+        }
+        ROS_INFO("ready");
     }
 
-    void run(const Eigen::VectorXf &input, Eigen::VectorXf &output) {
-        inputLayer->output = input;
-        if(has_normalization_){
-            if(normalization_type == "min_max") {
-                inputLayer->output = inputLayer->output - _inputMin;
-                inputLayer->output = inputLayer->output.cwiseQuotient(_inputMax - _inputMin);
-            } else if (normalization_type == "z_score") {
-                inputLayer->output = inputLayer->output - _inputCenter;
-                inputLayer->output = inputLayer->output.cwiseProduct(_inputScale.cwiseInverse());
+    /*
+     * Write the loaded network in the binary model format.
+     */
+    void saveBinary(const std::string &filename) const {
+        std::vector<char> image;
+        auto align = [&]() { image.resize((image.size() + binaryAlignment - 1) / binaryAlignment * binaryAlignment, 0); };
+        auto append = [&](const float* values, size_t rows, size_t cols) {
+            align();
+            BinaryArray a;
+            a.offset = image.size();
+            a.rows = rows;
+            a.cols = cols;
+            const char* bytes = reinterpret_cast<const char*>(values);
+            image.insert(image.end(), bytes, bytes + sizeof(float) * rows * cols);
+            return a;
+        };
+        std::unordered_map<const Layer*, uint32_t> layerIndex;
+        for(size_t i = 0; i < layerList.size(); i++) {
+            layerIndex[layerList[i].get()] = i;
+        }
+
+        BinaryHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, binaryMagic(), binaryMagicSize);
+        header.version = binaryVersion;
+        header.layerCount = layerList.size();
+        header.inputLayer = layerIndex.at(inputLayer.get());
+        header.outputLayer = layerIndex.at(outputLayer.get());
+        header.ensembleSize = ensembleSize_;
+        std::vector<BinaryLayer> records(layerList.size());
+        image.resize(sizeof(BinaryHeader) + records.size() * sizeof(BinaryLayer));
+
+        if(has_normalization_) {
+            const Eigen::VectorXf *vectors[4] = { &_inputMin, &_inputMax, &_outputMin, &_outputMax };
+            header.normalization = 1;
+            if(normalization_type == "z_score") {
+                vectors[0] = &_inputCenter;
+                vectors[1] = &_inputScale;
+                vectors[2] = &_outputCenter;
+                vectors[3] = &_outputScale;
+                header.normalization = 2;
+            }
+            for(size_t i = 0; i < 4; i++) {
+                header.normalizationArrays[i] = append(vectors[i]->data(), vectors[i]->size(), 1);
             }
         }
 
+        for(size_t i = 0; i < layerList.size(); i++) {
+            const Layer& layer = *layerList[i];
+            BinaryLayer& record = records[i];
+            memset(&record, 0, sizeof(record));
+            strncpy(record.name, layer.name.c_str(), sizeof(record.name) - 1);
+            record.type = static_cast<uint32_t>(layer.type());
+            if(layer.type() == LayerType::dense) {
+                const Dense& dense = static_cast<const Dense&>(layer);
+                record.activation = static_cast<uint32_t>(dense.activation);
+                record.useBias = dense.useBias;
+            }
+            if(layer.type() == LayerType::dropout) {
+                record.rate = static_cast<const Dropout&>(layer).rate;
+            }
+            if(layer.inputLayers.size() > binaryMaxInputs || layer.weights.size() > 2) {
+                ROS_ERROR("layer %s can't be stored in the binary format", layer.name.c_str());
+                throw 0;
+            }
+            record.inputCount = layer.inputLayers.size();
+            for(size_t in = 0; in < layer.inputLayers.size(); in++) {
+                record.inputs[in] = layerIndex.at(layer.inputLayers[in].get());
+            }
+            record.weightCount = layer.weights.size();
+            for(size_t w = 0; w < layer.weights.size(); w++) {
+                record.weights[w] = append(layer.weights[w].data, layer.weights[w].rows, layer.weights[w].cols);
+            }
+            if(layer.type() == LayerType::dense) {
+                const Dense& dense = static_cast<const Dense&>(layer);
+                // compile() repacks sparse layers for jacobian() and bounds()
+                if(!dense.sparse.data) {
+                    record.packed = append(dense.packed.data, dense.packed.rows, dense.packed.cols);
+                }
+                if(dense.quantized.data) {
+                    record.quantized = append(dense.quantized.data, dense.quantized.rows, dense.quantized.cols);
+                }
+                if(dense.sparse.data) {
+                    record.sparse = append(dense.sparse.data, dense.sparse.rows, dense.sparse.cols);
+                }
+            }
+        }
+        align();
+        header.fileSize = image.size();
+        memcpy(image.data(), &header, sizeof(header));
+        memcpy(image.data() + sizeof(header), records.data(), records.size() * sizeof(BinaryLayer));
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        file.write(image.data(), image.size());
+        if(!file) {
+            ROS_ERROR("unable to write binary network %s", filename.c_str());
+            throw 0;
+        }
+    }
+
+    /*
+     * Replace the network by an ensemble of networks with the same layer graph
+     * (layer types, connections and activations, the layer sizes may differ) and
+     * the same input: every layer output is the concatenation of the member outputs,
+     * so one pass evaluates all members and the outputs of member m are rows
+     * m * n ... (m + 1) * n - 1. Dense layers reading the network input stack the
+     * member weights, later Dense layers are block-diagonal and run the dense kernel
+     * on the block of every member (see compile). Input normalizations that differ between the members
+     * are folded into the first layers. Transforms of the members
+     * (transformInputs/transformOutputs) are not carried over.
+     */
+    void stack(const std::vector<std::shared_ptr<const NeuralNetwork>> &members) {
+        if(members.empty()) {
+            ROS_FATAL("an ensemble needs at least one network");
+            throw 0;
+        }
+        const NeuralNetwork &first = *members[0];
+        auto index = [](const NeuralNetwork &network, const std::shared_ptr<Layer> &layer) {
+            if(layer == network.inputLayer)
+                return -1;
+            return (int)(std::find(network.ops_.begin(), network.ops_.end(), layer) - network.ops_.begin());
+        };
+        bool sameInputNormalization = true;
+        for(auto &member : members) {
+            bool valid = member.get() != this && member->ensembleSize_ == 1 && member->inputSize_ == first.inputSize_
+                && member->outputSize() == first.outputSize() && member->ops_.size() == first.ops_.size()
+                && member->has_normalization_ == first.has_normalization_;
+            for(size_t k = 0; valid && k < first.ops_.size(); k++) {
+                const Layer &layer = *member->ops_[k], &reference = *first.ops_[k];
+                valid = layer.type() == reference.type() && layer.inputLayers.size() == reference.inputLayers.size();
+                for(size_t i = 0; valid && i < layer.inputLayers.size(); i++) {
+                    valid = index(*member, layer.inputLayers[i]) == index(first, reference.inputLayers[i]);
+                    // only Dense layers can read the shared input
+                    valid = valid && (layer.type() == LayerType::dense || layer.inputLayers[i] != member->inputLayer);
+                }
+                if(valid && layer.type() == LayerType::dense)
+                    valid = static_cast<const Dense&>(layer).activation == static_cast<const Dense&>(reference).activation;
+                if(valid && layer.type() == LayerType::dropout)
+                    valid = static_cast<const Dropout&>(layer).rate == static_cast<const Dropout&>(reference).rate;
+            }
+            if(!valid) {
+                ROS_FATAL("ensemble member %s differs from %s", member->profileName_.c_str(), first.profileName_.c_str());
+                throw 0;
+            }
+            if(member->has_normalization_)
+                sameInputNormalization = sameInputNormalization && member->_inputShift == first._inputShift
+                    && member->_inputDivisor == first._inputDivisor;
+        }
+
+        reset();
+        ensembleSize_ = members.size();
+        profileName_ = "ensemble";
+        inputLayer = createLayer(LayerType::input);
+        inputLayer->name = first.inputLayer->name;
+        layerList.push_back(inputLayer);
+        for(size_t k = 0; k < first.ops_.size(); k++) {
+            const Layer &reference = *first.ops_[k];
+            std::shared_ptr<Layer> layer = createLayer(reference.type());
+            layer->name = reference.name;
+            for(auto &in : reference.inputLayers) {
+                int i = index(first, in);
+                layer->inputLayers.push_back(i < 0 ? inputLayer : layerList[i + 1]);
+                layer->inputNames.push_back(layer->inputLayers.back()->name);
+            }
+            if(layer->type() == LayerType::dropout)
+                std::static_pointer_cast<Dropout>(layer)->rate = static_cast<const Dropout&>(reference).rate;
+            if(layer->type() == LayerType::dense) {
+                auto dense = std::static_pointer_cast<Dense>(layer);
+                dense->activation = static_cast<const Dense&>(reference).activation;
+                const bool readsInput = reference.inputLayers[0] == first.inputLayer;
+                size_t rows = 0, cols = 0;
+                for(auto &member : members) {
+                    const Dense &part = static_cast<const Dense&>(*member->ops_[k]);
+                    rows += part.weights[0].rows;
+                    cols = readsInput ? part.weights[0].cols : cols + part.weights[0].cols;
+                    dense->useBias = dense->useBias || part.useBias;
+                }
+                Eigen::MatrixXf w = Eigen::MatrixXf::Zero(rows, cols);
+                Eigen::VectorXf b = Eigen::VectorXf::Zero(rows);
+                size_t row = 0, col = 0;
+                for(auto &member : members) {
+                    const Dense &part = static_cast<const Dense&>(*member->ops_[k]);
+                    auto block = w.block(row, readsInput ? 0 : col, part.weights[0].rows, part.weights[0].cols);
+                    block = part.weights[0].matrix();
+                    if(part.useBias)
+                        b.segment(row, part.weights[0].rows) = part.weights[1].vector();
+                    // x' = (x - shift) / divisor
+                    if(readsInput && member->has_normalization_ && !sameInputNormalization) {
+                        b.segment(row, part.weights[0].rows) -= block * member->_inputShift.cwiseQuotient(member->_inputDivisor);
+                        block = block * member->_inputDivisor.cwiseInverse().asDiagonal();
+                    }
+                    row += part.weights[0].rows;
+                    col += part.weights[0].cols;
+                }
+                dense->weights.push_back(storeWeight(w));
+                if(dense->useBias)
+                    dense->weights.push_back(storeWeight(b));
+            }
+            layerList.push_back(layer);
+            if(first.ops_[k] == first.outputLayer)
+                outputLayer = layer;
+        }
         for(auto &layer : layerList) {
-            layer->inputs.resize(layer->inputLayers.size());
+            layerMap[layer->name] = layer;
+        }
+
+        // the output normalization of every member applies to its rows
+        if(first.has_normalization_) {
+            has_normalization_ = true;
+            normalization_type = first.normalization_type;
+            for(auto &member : members) {
+                if(member->normalization_type != normalization_type)
+                    normalization_type = "z_score";
+            }
+            auto concat = [&](const Eigen::VectorXf NeuralNetwork::*vector) {
+                Eigen::VectorXf result(first.outputSize() * members.size());
+                for(size_t m = 0; m < members.size(); m++) {
+                    result.segment(m * first.outputSize(), first.outputSize()) = (*members[m]).*vector;
+                }
+                return result;
+            };
+            const Eigen::VectorXf zero = Eigen::VectorXf::Zero(first.inputSize_), one = Eigen::VectorXf::Ones(first.inputSize_);
+            if(normalization_type == first.normalization_type && normalization_type == "min_max") {
+                _inputMin = sameInputNormalization ? first._inputMin : zero;
+                _inputMax = sameInputNormalization ? first._inputMax : one;
+                _outputMin = concat(&NeuralNetwork::_outputMin);
+                _outputMax = concat(&NeuralNetwork::_outputMax);
+            } else if(normalization_type == first.normalization_type) {
+                _inputCenter = sameInputNormalization ? first._inputCenter : zero;
+                _inputScale = sameInputNormalization ? first._inputScale : one;
+                _outputCenter = concat(&NeuralNetwork::_outputCenter);
+                _outputScale = concat(&NeuralNetwork::_outputScale);
+            } else {
+                _inputCenter = sameInputNormalization ? first._inputShift : zero;
+                _inputScale = sameInputNormalization ? first._inputDivisor : one;
+                _outputCenter = concat(&NeuralNetwork::_outputShift);
+                _outputScale = concat(&NeuralNetwork::_outputFactor);
+            }
+            setupNormalization();
+        }
+        compile();
+    }
+
+    size_t ensembleSize() const {
+        return ensembleSize_;
+    }
+
+    /*
+     * Diagonal blocks of a block-diagonal weight matrix, found from its zero pattern:
+     * a block ends after a row if none of the rows up to it reads a later column and
+     * none of the following rows reads an earlier one. Empty for a single block.
+     */
+    static std::vector<Dense::Block> diagonalBlocks(const Weight &weight) {
+        auto w = weight.matrix();
+        const size_t rows = w.rows(), cols = w.cols();
+        // first and one past the last nonzero column of every row
+        std::vector<size_t> first(rows, cols), last(rows, 0);
+        for(size_t c = 0; c < cols; c++) {
+            for(size_t r = 0; r < rows; r++) {
+                if(w(r, c) != 0.0f) {
+                    first[r] = std::min(first[r], c);
+                    last[r] = c + 1;
+                }
+            }
+        }
+        // first column read by the rows from r on
+        std::vector<size_t> after(rows + 1, cols);
+        for(size_t r = rows; r-- > 0;) {
+            after[r] = std::min(after[r + 1], first[r]);
+        }
+        std::vector<Dense::Block> blocks;
+        Dense::Block block;
+        size_t reach = 0;
+        for(size_t r = 0; r + 1 < rows; r++) {
+            reach = std::max(reach, last[r]);
+            const size_t col = std::max(reach, block.col + 1);
+            if(col < cols && after[r + 1] >= col) {
+                block.rows = r + 1 - block.row;
+                block.cols = col - block.col;
+                blocks.push_back(block);
+                block.row = r + 1;
+                block.col = reach = col;
+            }
+        }
+        block.rows = rows - block.row;
+        block.cols = cols - block.col;
+        blocks.push_back(block);
+        if(blocks.size() < 2)
+            blocks.clear();
+        return blocks;
+    }
+
+    // pack the diagonal blocks of a Dense layer for the dense kernels, at the offsets of the blocks
+    static void packBlocks(const Dense &dense, const Eigen::Ref<const Eigen::MatrixXf> &w, const float* bias, const float* floor, float* packed) {
+        for(auto &block : dense.blocks) {
+            const Eigen::MatrixXf part = w.block(block.row, block.col, block.rows, block.cols);
+            push_prediction::kernels::packDense(part.data(), bias ? bias + block.row : nullptr, floor ? floor + block.row : nullptr,
+                    block.rows, block.cols, packed + block.packed);
+        }
+    }
+
+    /*
+     * Sort the layer graph topologically into a flat op list and assign every
+     * layer output a fixed slot in one contiguous arena. Slots are padded to
+     * 64 bytes, so with the 64 byte aligned arena of InferenceContext each of
+     * them starts on a cache line.
+     */
+    void compile() {
+        ops_.clear();
+        std::unordered_map<Layer*, bool> visited;
+        std::function<void(const std::shared_ptr<Layer>&)> visit = [&](const std::shared_ptr<Layer>& layer) {
+            if(!layer) {
+                ROS_FATAL("network graph references an unknown layer");
+                throw 0;
+            }
+            if(visited.count(layer.get())) {
+                if(!visited[layer.get()]) {
+                    ROS_FATAL("network graph contains a cycle at layer %s", layer->name.c_str());
+                    throw 0;
+                }
+                return;
+            }
+            visited[layer.get()] = false;
+            for(auto &in : layer->inputLayers) {
+                visit(in);
+            }
+            visited[layer.get()] = true;
+            ops_.push_back(layer);
+        };
+        visit(outputLayer);
+
+        // the input size is given by the first Dense layer reading from it
+        inputSize_ = 0;
+        for(auto &layer : ops_) {
             for(size_t i = 0; i < layer->inputLayers.size(); i++) {
-                layer->inputs[i] = layer->inputLayers[i]->output;
+                if(layer->inputLayers[i] == inputLayer && !layer->weights.empty()) {
+                    inputSize_ = layer->weights[0].cols;
+                }
             }
-            layer->run();
         }
-        output = outputLayer->output;
+        if(inputSize_ == 0) {
+            ROS_FATAL("unable to infer network input size");
+            throw 0;
+        }
 
-        if(has_normalization_){
-            if(normalization_type == "min_max") {
-                output = output.cwiseProduct(_outputMax - _outputMin);
-                output = _outputMin + output;
-            } else if (normalization_type == "z_score") {
-                output = output.cwiseProduct(_outputScale);
-                output = output + _outputCenter;
+        std::unordered_map<Layer*, size_t> consumers;
+        for(auto &layer : ops_) {
+            for(auto &in : layer->inputLayers) {
+                consumers[in.get()]++;
             }
         }
 
+        const size_t alignment = 64 / sizeof(float);
+        size_t arenaSize = 0;
+        for(auto &layer : ops_) {
+            layer->inputSlots.clear();
+            for(auto &in : layer->inputLayers) {
+                layer->inputSlots.push_back(in->outputSlot);
+            }
+            // a Dropout works in place if nothing else reads its input
+            if(layer->type() == LayerType::dropout && consumers[layer->inputLayers[0].get()] == 1 && layer->inputLayers[0] != outputLayer) {
+                layer->outputSlot = layer->inputSlots[0];
+                continue;
+            }
+            layer->outputSlot.offset = arenaSize;
+            layer->outputSlot.size = layer == inputLayer ? inputSize_ : layer->outputSize();
+            arenaSize += (layer->outputSlot.size + alignment - 1) / alignment * alignment;
+        }
+        arenaSize_ = arenaSize;
+
+        // the input layer is filled by run() directly
+        ops_.erase(std::remove(ops_.begin(), ops_.end(), inputLayer), ops_.end());
+
+        for(auto &layer : ops_) {
+            layer->profile = PUSH_PREDICTION_PROFILE_STATISTIC(profileName_ + "/layer/" + layer->name + " ns");
+        }
+        runProfile_ = PUSH_PREDICTION_PROFILE_STATISTIC(profileName_ + "/run ns");
+        batchProfile_ = PUSH_PREDICTION_PROFILE_STATISTIC(profileName_ + "/runBatch ns");
+        batchSizeProfile_ = PUSH_PREDICTION_PROFILE_STATISTIC(profileName_ + "/runBatch samples");
+        transformProfile_ = PUSH_PREDICTION_PROFILE_STATISTIC(profileName_ + "/normalization ns");
+
+        // pack Dense weights for the fused kernels unless the model file provided them
+        for(auto &layer : ops_) {
+            if(layer->type() != LayerType::dense)
+                continue;
+            auto dense = std::static_pointer_cast<Dense>(layer);
+            const Weight& w = dense->weights[0];
+            size_t packedSize = push_prediction::kernels::packedSize(w.rows, w.cols);
+            if(dense->packed.rows * dense->packed.cols != packedSize) {
+                if(dense->packed.data) {
+                    ROS_WARN("repacking Dense weights of layer %s", dense->name.c_str());
+                }
+                Eigen::MatrixXf packed(packedSize, 1);
+                push_prediction::kernels::packDense(w.data, dense->useBias ? dense->weights[1].data : nullptr, nullptr,
+                        w.rows, w.cols, packed.data());
+                dense->packed = storeWeight(packed);
+            }
+            Eigen::MatrixXf absolute = w.matrix().cwiseAbs();
+            dense->absolute.resize(packedSize);
+            push_prediction::kernels::packDense(absolute.data(), nullptr, nullptr, w.rows, w.cols, dense->absolute.data());
+            if(dense->sparse.data && dense->sparse.rows * dense->sparse.cols != push_prediction::kernels::sparsePackedSize(w.data, w.rows, w.cols)) {
+                ROS_FATAL("invalid sparse weights in layer %s", dense->name.c_str());
+                throw 0;
+            }
+
+            // the block-diagonal layers of an ensemble run the dense kernel per member block,
+            // which is faster than the block-sparse kernels on the whole layer
+            dense->blocks.clear();
+            dense->blockPacked = Weight();
+            if(ensembleSize_ > 1 && dense->inputLayers[0] != inputLayer && !dense->sparse.data)
+                dense->blocks = diagonalBlocks(w);
+            if(dense->blocks.empty())
+                continue;
+            size_t blockPackedSize = 0;
+            for(auto &block : dense->blocks) {
+                block.packed = blockPackedSize;
+                blockPackedSize += (push_prediction::kernels::packedSize(block.rows, block.cols) + alignment - 1) / alignment * alignment;
+            }
+            Eigen::MatrixXf blockPacked(blockPackedSize, 1);
+            packBlocks(*dense, w.matrix(), dense->useBias ? dense->weights[1].data : nullptr, nullptr, blockPacked.data());
+            dense->blockPacked = storeWeight(blockPacked);
+        }
+
+        inScale_.setOnes(inputSize_);
+        inOffset_.setZero(inputSize_);
+        outScale_.setOnes(outputSize());
+        outOffset_.setZero(outputSize());
+        inputTransform_ = outputTransform_ = has_normalization_;
+        if(has_normalization_) {
+            inScale_ = _inputDivisor.cwiseInverse();
+            inOffset_ = -_inputShift.cwiseQuotient(_inputDivisor);
+            outScale_ = _outputFactor;
+            outOffset_ = _outputShift;
+        }
+
+        // quantized weights from a binary model are used if every Dense layer has them
+        bool quantized = false;
+        for(auto &layer : ops_) {
+            if(layer->type() != LayerType::dense)
+                continue;
+            auto dense = std::static_pointer_cast<Dense>(layer);
+            const Weight& w = dense->weights[0];
+            if(!dense->quantized.data) {
+                quantized = false;
+                break;
+            }
+            if(dense->quantized.rows * dense->quantized.cols * sizeof(float) != push_prediction::kernels::quantizedSize(w.rows, w.cols)) {
+                ROS_FATAL("invalid quantized weights in layer %s", dense->name.c_str());
+                throw 0;
+            }
+            quantized = true;
+        }
+        // the generic int8 kernel is much slower than the float kernels, it is only used if requested explicitly
+        if(quantized && std::string(quantizedKernel_->name) == "generic" && !std::getenv("PUSH_PREDICTION_QUANTIZED_KERNEL")) {
+            ROS_WARN("no 8 bit dot-product kernel for this CPU, running the quantized model with its float weights "
+                    "(set PUSH_PREDICTION_QUANTIZED_KERNEL=generic to force the int8 weights)");
+            quantized = false;
+        }
+        setQuantized(quantized);
+    }
+
+    /*
+     * Quantize all Dense layers to int8. The input range of every layer is
+     * calibrated by running the float network on representative inputs
+     * (one sample per column, e.g. recorded pushes).
+     */
+    void quantize(const Eigen::MatrixXf &calibrationInputs) {
+        std::unordered_map<Layer*, float> inputRange;
+        calibrate(calibrationInputs, [&](const float* arena, size_t batch) {
+            for(auto &layer : ops_) {
+                if(layer->type() == LayerType::dense) {
+                    float range = layer->input(arena, 0, batch).cwiseAbs().maxCoeff();
+                    inputRange[layer.get()] = std::max(inputRange[layer.get()], range);
+                }
+            }
+        });
+        for(auto &layer : ops_) {
+            if(layer->type() != LayerType::dense)
+                continue;
+            auto dense = std::static_pointer_cast<Dense>(layer);
+            const Weight& w = dense->weights[0];
+            Eigen::MatrixXf quantized(push_prediction::kernels::quantizedSize(w.rows, w.cols) / sizeof(float), 1);
+            push_prediction::kernels::quantizeDense(w.data, dense->useBias ? dense->weights[1].data : nullptr,
+                    w.rows, w.cols, inputRange[layer.get()], reinterpret_cast<uint8_t*>(quantized.data()));
+            dense->quantized = storeWeight(quantized);
+        }
+        setQuantized(true);
+    }
+
+    /*
+     * Switch between the int8 and the float weights of a quantized network.
+     */
+    void setQuantized(bool quantized) {
+        for(auto &layer : ops_) {
+            if(layer->type() == LayerType::dense && quantized && !std::static_pointer_cast<Dense>(layer)->quantized.data) {
+                ROS_FATAL("layer %s is not quantized", layer->name.c_str());
+                throw 0;
+            }
+        }
+        quantized_ = quantized;
+        setupKernels();
+    }
+
+    bool isQuantized() const {
+        return quantized_;
+    }
+
+    /*
+     * Structured pruning: remove the hidden units of Dense layers that are dead or
+     * nearly constant on the calibration inputs. A unit is replaced by its mean value,
+     * folded into the bias of the Dense layers reading it, if that changes each of
+     * their inputs by at most tolerance (max |value - mean| * max |w|) on the calibration
+     * inputs.
+     * Units are only removed if all readers are Dense layers, directly or through
+     * Dropout (Monte-Carlo dropout then no longer drops them), and every layer keeps
+     * at least one unit. The network is recompiled without int8 and block-sparse
+     * weights. Returns the number of removed units.
+     */
+    size_t pruneNeurons(const Eigen::MatrixXf &calibrationInputs, float tolerance) {
+        std::unordered_map<Layer*, Eigen::VectorXf> minimum, maximum, mean;
+        calibrate(calibrationInputs, [&](const float* arena, size_t batch) {
+            for(auto &layer : ops_) {
+                if(layer->type() != LayerType::dense)
+                    continue;
+                Eigen::Map<const Eigen::MatrixXf> output(arena + layer->outputSlot.offset * batch, layer->outputSlot.size, batch);
+                Eigen::VectorXf &lower = minimum[layer.get()], &upper = maximum[layer.get()], &sum = mean[layer.get()];
+                if(lower.size() == 0) {
+                    lower = output.rowwise().minCoeff();
+                    upper = output.rowwise().maxCoeff();
+                    sum = output.rowwise().sum();
+                } else {
+                    lower = lower.cwiseMin(output.rowwise().minCoeff());
+                    upper = upper.cwiseMax(output.rowwise().maxCoeff());
+                    sum += output.rowwise().sum();
+                }
+            }
+        });
+
+        std::unordered_map<Layer*, std::vector<std::shared_ptr<Layer>>> consumers;
+        for(auto &layer : ops_) {
+            for(auto &in : layer->inputLayers) {
+                consumers[in.get()].push_back(layer);
+            }
+        }
+        auto discard = [](Dense &dense) {
+            dense.packed = Weight();
+            dense.quantized = Weight();
+            dense.sparse = Weight();
+        };
+
+        size_t removed = 0;
+        for(auto &layer : ops_) {
+            if(layer->type() != LayerType::dense || layer == outputLayer)
+                continue;
+            // Dense layers reading the units, directly or through Dropout
+            std::vector<std::shared_ptr<Dense>> readers;
+            bool prunable = true;
+            std::function<void(Layer*)> collect = [&](Layer* producer) {
+                for(auto &consumer : consumers[producer]) {
+                    if(consumer->type() == LayerType::dense)
+                        readers.push_back(std::static_pointer_cast<Dense>(consumer));
+                    else if(consumer->type() == LayerType::dropout && consumer != outputLayer)
+                        collect(consumer.get());
+                    else
+                        prunable = false;
+                }
+            };
+            collect(layer.get());
+            if(!prunable || readers.empty())
+                continue;
+
+            auto dense = std::static_pointer_cast<Dense>(layer);
+            const Eigen::VectorXf center = mean[layer.get()] / calibrationInputs.cols();
+            const Eigen::VectorXf radius = (maximum[layer.get()] - center).cwiseMax(center - minimum[layer.get()]);
+            std::vector<int> keep, drop;
+            for(int unit = 0; unit < center.size(); unit++) {
+                float weight = 0.0f;
+                for(auto &reader : readers) {
+                    weight = std::max(weight, reader->weights[0].matrix().col(unit).cwiseAbs().maxCoeff());
+                }
+                if(radius(unit) * weight <= tolerance)
+                    drop.push_back(unit);
+                else
+                    keep.push_back(unit);
+            }
+            if(keep.empty()) {
+                keep.push_back(drop.back());
+                drop.pop_back();
+            }
+            if(drop.empty())
+                continue;
+
+            for(auto &reader : readers) {
+                const auto w = reader->weights[0].matrix();
+                Eigen::VectorXf bias = reader->useBias ? Eigen::VectorXf(reader->weights[1].vector()) : Eigen::VectorXf::Zero(w.rows());
+                for(int unit : drop) {
+                    bias += w.col(unit) * center(unit);
+                }
+                Eigen::MatrixXf kept(w.rows(), keep.size());
+                for(size_t i = 0; i < keep.size(); i++) {
+                    kept.col(i) = w.col(keep[i]);
+                }
+                reader->weights.resize(2);
+                reader->weights[0] = storeWeight(kept);
+                reader->weights[1] = storeWeight(bias);
+                reader->useBias = true;
+                discard(*reader);
+            }
+            const auto w = dense->weights[0].matrix();
+            Eigen::MatrixXf kept(keep.size(), w.cols());
+            Eigen::VectorXf bias(keep.size());
+            for(size_t i = 0; i < keep.size(); i++) {
+                kept.row(i) = w.row(keep[i]);
+                if(dense->useBias)
+                    bias(i) = dense->weights[1].vector()(keep[i]);
+            }
+            dense->weights[0] = storeWeight(kept);
+            if(dense->useBias)
+                dense->weights[1] = storeWeight(bias);
+            discard(*dense);
+            removed += drop.size();
+        }
+        if(removed == 0)
+            return 0;
+
+        // compile() resets the transforms to the normalization
+        const Eigen::VectorXf inScale = inScale_, inOffset = inOffset_, outScale = outScale_, outOffset = outOffset_;
+        const bool inputTransform = inputTransform_, outputTransform = outputTransform_;
+        compile();
+        inScale_ = inScale;
+        inOffset_ = inOffset;
+        outScale_ = outScale;
+        outOffset_ = outOffset;
+        inputTransform_ = inputTransform;
+        outputTransform_ = outputTransform;
+        setupKernels();
+        return removed;
+    }
+
+    /*
+     * Block sparsity: zero the blocks of PANEL_ROWS weights of a single input whose
+     * contribution to the layer outputs stays within tolerance on the calibration
+     * inputs (max |w| * max |x|). Layers with at most 3/4 of their blocks left run on
+     * the block-sparse kernels, which skip the zero blocks, other layers are not changed.
+     * Returns the number of zero blocks of the sparse layers.
+     */
+    size_t sparsify(const Eigen::MatrixXf &calibrationInputs, float tolerance) {
+        std::unordered_map<Layer*, Eigen::VectorXf> inputRange;
+        calibrate(calibrationInputs, [&](const float* arena, size_t batch) {
+            for(auto &layer : ops_) {
+                if(layer->type() != LayerType::dense)
+                    continue;
+                Eigen::VectorXf range = layer->input(arena, 0, batch).cwiseAbs().rowwise().maxCoeff();
+                Eigen::VectorXf &stored = inputRange[layer.get()];
+                stored = stored.size() ? stored.cwiseMax(range) : range;
+            }
+        });
+
+        const int P = push_prediction::kernels::PANEL_ROWS;
+        size_t zero = 0;
+        for(auto &layer : ops_) {
+            if(layer->type() != LayerType::dense)
+                continue;
+            auto dense = std::static_pointer_cast<Dense>(layer);
+            Eigen::MatrixXf w = dense->weights[0].matrix();
+            const Eigen::VectorXf &range = inputRange[layer.get()];
+            size_t blocks = 0, zeroBlocks = 0;
+            for(int row = 0; row < w.rows(); row += P) {
+                for(int col = 0; col < w.cols(); col++) {
+                    auto block = w.block(row, col, std::min<int>(P, w.rows() - row), 1);
+                    blocks++;
+                    if(block.cwiseAbs().maxCoeff() * range(col) <= tolerance) {
+                        block.setZero();
+                        zeroBlocks++;
+                    }
+                }
+            }
+            if(zeroBlocks * 4 < blocks)
+                continue;
+
+            const float* bias = dense->useBias ? dense->weights[1].data : nullptr;
+            dense->weights[0] = storeWeight(w);
+            Eigen::MatrixXf packed(push_prediction::kernels::packedSize(w.rows(), w.cols()), 1);
+            push_prediction::kernels::packDense(w.data(), bias, nullptr, w.rows(), w.cols(), packed.data());
+            dense->packed = storeWeight(packed);
+            Eigen::MatrixXf absolute = w.cwiseAbs();
+            push_prediction::kernels::packDense(absolute.data(), nullptr, nullptr, w.rows(), w.cols(), dense->absolute.data());
+            Eigen::MatrixXf sparse(push_prediction::kernels::sparsePackedSize(w.data(), w.rows(), w.cols()), 1);
+            push_prediction::kernels::packSparseDense(w.data(), bias, nullptr, w.rows(), w.cols(), sparse.data());
+            dense->sparse = storeWeight(sparse);
+            dense->quantized = Weight();
+            zero += zeroBlocks;
+        }
+        setupKernels();
+        return zero;
+    }
+
+    /*
+     * Units, inputs and stored weight blocks of every Dense layer, one line per layer.
+     */
+    std::string denseSummary() const {
+        const size_t P = push_prediction::kernels::PANEL_ROWS;
+        std::string summary;
+        for(auto &layer : ops_) {
+            if(layer->type() != LayerType::dense)
+                continue;
+            const Dense &dense = static_cast<const Dense&>(*layer);
+            const Weight &w = dense.weights[0];
+            size_t blocks = (w.rows + P - 1) / P * w.cols;
+            size_t stored = blocks;
+            if(dense.sparse.data) {
+                stored = 0;
+                for(size_t row = 0; row < w.rows; row += P) {
+                    for(size_t col = 0; col < w.cols; col++) {
+                        stored += !w.matrix().block(row, col, std::min(P, w.rows - row), 1).isZero(0.0f);
+                    }
+                }
+            }
+            char line[160];
+            snprintf(line, sizeof(line), "%-16s %5zu units %5zu inputs %7zu/%zu blocks%s\n", dense.name.c_str(),
+                    w.rows, w.cols, stored, blocks, dense.sparse.data ? " (sparse)" : "");
+            summary += line;
+        }
+        return summary;
+    }
+
+    /*
+     * Select the Dense kernel by name ("avx512", "avx2", "neon", "generic"),
+     * "eigen" disables the fused kernels. Defaults to the fastest kernel
+     * supported by the CPU or the PUSH_PREDICTION_KERNEL environment variable.
+     */
+    void setKernel(const std::string &name) {
+        const push_prediction::kernels::DenseKernel* kernel = nullptr;
+        if(name != "eigen") {
+            kernel = push_prediction::kernels::findKernel(name);
+            if(!kernel) {
+                ROS_FATAL("Dense kernel %s is not available on this CPU", name.c_str());
+                throw 0;
+            }
+        }
+        setKernel(kernel);
+    }
+
+    const char* kernelName() const {
+        if(quantized_)
+            return quantizedKernel_->name;
+        return kernel_ ? kernel_->name : "eigen";
+    }
+
+    /*
+     * Compose affine maps with the network inputs and outputs: afterwards the
+     * network takes inputs u for which scale * u + offset is the previous input
+     * and returns scale * y + offset for the previous output y. With the fused
+     * float kernels the maps are folded into the weights of the first and last
+     * Dense layer (a ReLU output layer requires non-negative output scales),
+     * otherwise they are applied as separate passes.
+     */
+    void transformInputs(const Eigen::VectorXf &scale, const Eigen::VectorXf &offset) {
+        if((size_t)scale.size() != inputSize_ || (size_t)offset.size() != inputSize_) {
+            ROS_FATAL("input transform has size %i, expected %i", (int)scale.size(), (int)inputSize_);
+            throw 0;
+        }
+        inOffset_ = inScale_.cwiseProduct(offset) + inOffset_;
+        inScale_ = inScale_.cwiseProduct(scale);
+        inputTransform_ = true;
+        setupKernels();
+    }
+
+    void transformOutputs(const Eigen::VectorXf &scale, const Eigen::VectorXf &offset) {
+        if((size_t)scale.size() != outputSize() || (size_t)offset.size() != outputSize()) {
+            ROS_FATAL("output transform has size %i, expected %i", (int)scale.size(), (int)outputSize());
+            throw 0;
+        }
+        outOffset_ = scale.cwiseProduct(outOffset_) + offset;
+        outScale_ = scale.cwiseProduct(outScale_);
+        outputTransform_ = true;
+        setupKernels();
+    }
+
+    /*
+     * Enable or disable folding of the input/output transforms (enabled by default).
+     */
+    void setFolding(bool folding) {
+        folding_ = folding;
+        setupKernels();
+    }
+
+    bool inputsFolded() const {
+        return inputFolded_;
+    }
+
+    bool outputsFolded() const {
+        return outputFolded_;
+    }
+
+    /*
+     * Maximum absolute difference between the outputs of the folded
+     * and the unfolded network for the given inputs.
+     */
+    float verifyFolding(const Eigen::MatrixXf &inputs) {
+        if(inputs.cols() == 0)
+            return 0.0f;
+        Eigen::MatrixXf folded, unfolded;
+        runBatch(inputs, folded);
+        bool folding = folding_;
+        setFolding(false);
+        runBatch(inputs, unfolded);
+        setFolding(folding);
+        return (folded - unfolded).cwiseAbs().maxCoeff();
+    }
+
+    bool hasNormalization() const {
+        return has_normalization_;
+    }
+
+    size_t inputSize() const {
+        return inputSize_;
+    }
+
+    size_t outputSize() const {
+        return outputLayer->outputSlot.size;
+    }
+
+    /*
+     * Scratch memory of a forward pass. Inference doesn't modify the network,
+     * so any number of threads can share it, each running with its own context.
+     * Changing the network (loading, kernels, quantization, transforms) is not
+     * thread-safe.
+     */
+    // distinct seeds for all contexts of the process (splitmix64)
+    static uint64_t randomSeed() {
+        static const uint64_t base = std::random_device()();
+        static std::atomic<uint64_t> counter(0);
+        uint64_t z = base + ++counter * 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return (z ^ (z >> 31)) | 1;
+    }
+
+    // float array starting at a 64 byte aligned address (binaryAlignment), the contents are lost on resize
+    class AlignedBuffer {
+        public:
+        size_t size() const { return size_; }
+        float* data() { return data_.get(); }
+        void resize(size_t size) {
+            void* data = nullptr;
+            if(posix_memalign(&data, binaryAlignment, std::max<size_t>(size, 1) * sizeof(float)) != 0)
+                throw std::bad_alloc();
+            data_.reset(static_cast<float*>(data));
+            size_ = size;
+        }
+        private:
+        struct Free { void operator()(float* data) const { free(data); } };
+        std::unique_ptr<float, Free> data_;
+        size_t size_ = 0;
+    };
+
+    struct InferenceContext {
+        // 64 byte aligned, so every slot starts on a cache line (see compile)
+        AlignedBuffer arena;
+        // derivatives of all layer outputs, used by jacobian()
+        AlignedBuffer tangents;
+        // interval bounds of all layer outputs, used by bounds()
+        AlignedBuffer bounds;
+        // states of the dropout mask generators (xorshift64*, nonzero)
+        uint64_t random[4] = {randomSeed(), randomSeed(), randomSeed(), randomSeed()};
+    };
+
+    // run with a context of the calling thread
+    void run(const Eigen::VectorXf &input, Eigen::VectorXf &output) const {
+        run(threadContext(), input, output);
+    }
+
+    void runBatch(const Eigen::MatrixXf &inputs, Eigen::MatrixXf &outputs) const {
+        runBatch(threadContext(), inputs, outputs);
+    }
+
+    void run(InferenceContext &context, const Eigen::VectorXf &input, Eigen::VectorXf &output) const {
+        PUSH_PREDICTION_PROFILE_SCOPE(runProfile_);
+        if((size_t)input.size() != inputSize_) {
+            ROS_ERROR("network input has size %i, expected %i", (int)input.size(), (int)inputSize_);
+            throw 0;
+        }
+        output = forward(context, input, 1);
+        if(outputTransform_ && !outputFolded_) {
+            PUSH_PREDICTION_PROFILE_SCOPE(transformProfile_);
+            output = output.cwiseProduct(outScale_) + outOffset_;
+        }
+    }
+
+    /*
+     * Evaluate a batch of samples stored column-wise in inputs.
+     * Every layer processes the whole batch at once, so Dense layers
+     * run as matrix-matrix products instead of one GEMV per sample.
+     */
+    void runBatch(InferenceContext &context, const Eigen::MatrixXf &inputs, Eigen::MatrixXf &outputs) const {
+        PUSH_PREDICTION_PROFILE_SCOPE(batchProfile_);
+#ifdef PUSH_PREDICTION_PROFILING
+        batchSizeProfile_->record(inputs.cols());
+#endif
+        if((size_t)inputs.rows() != inputSize_) {
+            ROS_ERROR("network input has size %i, expected %i", (int)inputs.rows(), (int)inputSize_);
+            throw 0;
+        }
+        if(inputs.cols() == 0) {
+            outputs.resize(outputLayer->outputSlot.size, 0);
+            return;
+        }
+        forwardBlocks(context, inputs, outputs, false);
+    }
+
+    bool hasDropout() const {
+        for(auto &layer : ops_) {
+            if(layer->type() == LayerType::dropout)
+                return true;
+        }
+        return false;
+    }
+
+    /*
+     * Monte-Carlo dropout: evaluate one input under `samples` random dropout
+     * masks, run as a single batch. outputs holds one prediction per column.
+     */
+    void runDropout(InferenceContext &context, const Eigen::VectorXf &input, size_t samples, Eigen::MatrixXf &outputs) const {
+        if((size_t)input.size() != inputSize_) {
+            ROS_ERROR("network input has size %i, expected %i", (int)input.size(), (int)inputSize_);
+            throw 0;
+        }
+        forwardBlocks(context, input.replicate(1, samples), outputs, true);
+    }
+
+    void runDropout(const Eigen::VectorXf &input, size_t samples, Eigen::MatrixXf &outputs) const {
+        runDropout(threadContext(), input, samples, outputs);
+    }
+
+    // Monte-Carlo dropout for a batch: every column of inputs runs under its own random mask
+    void runDropoutBatch(InferenceContext &context, const Eigen::MatrixXf &inputs, Eigen::MatrixXf &outputs) const {
+        if((size_t)inputs.rows() != inputSize_) {
+            ROS_ERROR("network input has size %i, expected %i", (int)inputs.rows(), (int)inputSize_);
+            throw 0;
+        }
+        forwardBlocks(context, inputs, outputs, true);
+    }
+
+    void runDropoutBatch(const Eigen::MatrixXf &inputs, Eigen::MatrixXf &outputs) const {
+        runDropoutBatch(threadContext(), inputs, outputs);
+    }
+
+    /*
+     * Evaluate the network and its Jacobian (outputs x inputs) at a single input,
+     * including the input and output transforms. The derivatives are propagated
+     * forward through the layers with one tangent column per input, so this costs
+     * a forward pass plus a batch of inputSize samples. The activation pattern is taken
+     * from the forward pass of the selected kernels; with a quantized network the
+     * Jacobian is that of the float weights at the quantized activations.
+     */
+    void jacobian(InferenceContext &context, const Eigen::VectorXf &input, Eigen::VectorXf &output, Eigen::MatrixXf &jacobian) const {
+        run(context, input, output);
+        const size_t inputs = inputSize_;
+        if((size_t)context.tangents.size() < arenaSize_ * inputs) {
+            context.tangents.resize(arenaSize_ * inputs);
+        }
+        float* tangents = context.tangents.data();
+        if(inputTransform_) {
+            inputLayer->output(tangents, inputs) = inScale_.asDiagonal();
+        } else {
+            inputLayer->output(tangents, inputs).setIdentity();
+        }
+        for(auto &layer : ops_) {
+            layer->tangent(context.arena.data(), tangents, inputs);
+        }
+        jacobian = outputLayer->output(tangents, inputs);
+        if(outputTransform_) {
+            jacobian = outScale_.asDiagonal() * jacobian;
+        }
+    }
+
+    void jacobian(const Eigen::VectorXf &input, Eigen::VectorXf &output, Eigen::MatrixXf &jacobian) const {
+        this->jacobian(threadContext(), input, output, jacobian);
+    }
+
+    /*
+     * Interval bound propagation: bounds on the outputs for all inputs in the box
+     * [lower, upper], including the input and output transforms. The bounds hold for
+     * the float weights up to rounding and are usually loose for wide boxes, as every
+     * layer bounds its outputs independently. Costs about two forward passes.
+     */
+    void bounds(InferenceContext &context, const Eigen::VectorXf &lower, const Eigen::VectorXf &upper,
+            Eigen::VectorXf &outputLower, Eigen::VectorXf &outputUpper) const {
+        if((size_t)lower.size() != inputSize_ || (size_t)upper.size() != inputSize_) {
+            ROS_ERROR("network input bounds have size %i, expected %i", (int)lower.size(), (int)inputSize_);
+            throw 0;
+        }
+        if((size_t)context.bounds.size() < arenaSize_ * 2) {
+            context.bounds.resize(arenaSize_ * 2);
+        }
+        float* bounds = context.bounds.data();
+        auto input = inputLayer->output(bounds, 2);
+        input.col(0) = lower;
+        input.col(1) = upper;
+        if(inputTransform_) {
+            input = (input.array().colwise() * inScale_.array()).colwise() + inOffset_.array();
+            swapNegative(input, inScale_);
+        }
+        for(auto &layer : ops_) {
+            layer->bound(bounds);
+        }
+        auto output = outputLayer->output(bounds, 2);
+        if(outputTransform_) {
+            output = (output.array().colwise() * outScale_.array()).colwise() + outOffset_.array();
+            swapNegative(output, outScale_);
+        }
+        outputLower = output.col(0);
+        outputUpper = output.col(1);
+    }
+
+    void bounds(const Eigen::VectorXf &lower, const Eigen::VectorXf &upper, Eigen::VectorXf &outputLower, Eigen::VectorXf &outputUpper) const {
+        this->bounds(threadContext(), lower, upper, outputLower, outputUpper);
+    }
+
+    private:
+
+    /*
+     * Run the float network without folded transforms on calibration inputs
+     * (one sample per column) and pass the arena of every block to record.
+     */
+    void calibrate(const Eigen::MatrixXf &inputs, const std::function<void(const float*, size_t)> &record) {
+        if((size_t)inputs.rows() != inputSize_ || inputs.cols() == 0) {
+            ROS_FATAL("calibration needs inputs of size %i", (int)inputSize_);
+            throw 0;
+        }
+        setQuantized(false);
+        bool folding = folding_;
+        folding_ = false;
+        setupKernels();
+        InferenceContext context;
+        const size_t blockSize = 256;
+        for(size_t col = 0; col < (size_t)inputs.cols(); col += blockSize) {
+            size_t batch = std::min(blockSize, (size_t)inputs.cols() - col);
+            forward(context, inputs.middleCols(col, batch), batch);
+            record(context.arena.data(), batch);
+        }
+        folding_ = folding;
+        setupKernels();
+    }
+
+    // large batches are split into blocks whose activations stay in cache
+    template <class Derived>
+    void forwardBlocks(InferenceContext &context, const Eigen::MatrixBase<Derived> &inputs, Eigen::MatrixXf &outputs, bool dropout) const {
+        const size_t blockSize = 256;
+        outputs.resize(outputLayer->outputSlot.size, inputs.cols());
+        for(size_t col = 0; col < (size_t)inputs.cols(); col += blockSize) {
+            size_t batch = std::min(blockSize, (size_t)inputs.cols() - col);
+            auto block = outputs.middleCols(col, batch);
+            block = forward(context, inputs.middleCols(col, batch), batch, dropout);
+            if(outputTransform_ && !outputFolded_) {
+                PUSH_PREDICTION_PROFILE_SCOPE(transformProfile_);
+                block = (block.array().colwise() * outScale_.array()).colwise() + outOffset_.array();
+            }
+        }
+    }
+
+    // a negative scale turns the lower into the upper bound
+    static void swapNegative(Eigen::Map<Eigen::MatrixXf, Eigen::Aligned> bounds, const Eigen::VectorXf &scale) {
+        for(int i = 0; i < scale.size(); i++) {
+            if(scale(i) < 0.0f)
+                std::swap(bounds(i, 0), bounds(i, 1));
+        }
+    }
+
+    // the arena only grows, so one context per thread serves all networks
+    static InferenceContext &threadContext() {
+        static thread_local InferenceContext context;
+        return context;
+    }
+
+    void setKernel(const push_prediction::kernels::DenseKernel* kernel) {
+        kernel_ = kernel;
+        setupKernels();
+    }
+
+    /*
+     * Assign the selected kernels to all Dense layers and fold the input and
+     * output transforms into the first and last Dense layers where possible.
+     */
+    void setupKernels() {
+        if(!outputLayer)
+            return;
+        const bool fold = folding_ && kernel_ && !quantized_;
+        inputFolded_ = fold && inputTransform_;
+        outputFolded_ = fold && outputTransform_ && outputLayer->type() == LayerType::dense;
+        for(auto &layer : ops_) {
+            for(auto &in : layer->inputLayers) {
+                if(in == inputLayer && layer->type() != LayerType::dense)
+                    inputFolded_ = false;
+                if(in == outputLayer)
+                    outputFolded_ = false;
+            }
+        }
+        if(outputFolded_) {
+            Activation activation = std::static_pointer_cast<Dense>(outputLayer)->activation;
+            if(activation == Activation::sigmoid || (activation == Activation::relu && (outScale_.array() < 0.0f).any()))
+                outputFolded_ = false;
+        }
+
+        for(auto &layer : ops_) {
+            if(layer->type() != LayerType::dense)
+                continue;
+            auto dense = std::static_pointer_cast<Dense>(layer);
+            dense->kernel = kernel_;
+            dense->quantizedKernel = quantized_ ? quantizedKernel_ : nullptr;
+            dense->folded.resize(0);
+            dense->foldedFloor.resize(0);
+            dense->blockFolded.resize(0);
+            bool foldInput = inputFolded_ && dense->inputLayers[0] == inputLayer;
+            bool foldOutput = outputFolded_ && dense == outputLayer;
+            if(!foldInput && !foldOutput)
+                continue;
+
+            // W' = diag(outScale) W diag(inScale), b' = outScale (b + W inOffset) + outOffset,
+            // a ReLU becomes max(W'x + b', outOffset)
+            Eigen::MatrixXf w = dense->weights[0].matrix();
+            Eigen::VectorXf b = dense->useBias ? Eigen::VectorXf(dense->weights[1].vector()) : Eigen::VectorXf::Zero(w.rows());
+            Eigen::VectorXf floor = Eigen::VectorXf::Zero(w.rows());
+            if(foldInput) {
+                b += w * inOffset_;
+                w = w * inScale_.asDiagonal();
+            }
+            if(foldOutput) {
+                w = outScale_.asDiagonal() * w;
+                b = outScale_.cwiseProduct(b) + outOffset_;
+                floor = outOffset_;
+            }
+            if(foldOutput)
+                dense->foldedFloor = floor;
+            if(dense->sparse.data) {
+                // diagonal scaling keeps the zero blocks
+                dense->folded.resize(push_prediction::kernels::sparsePackedSize(w.data(), w.rows(), w.cols()));
+                push_prediction::kernels::packSparseDense(w.data(), b.data(), floor.data(), w.rows(), w.cols(), dense->folded.data());
+                continue;
+            }
+            if(!dense->blocks.empty()) {
+                dense->blockFolded.resize(dense->blockPacked.rows);
+                packBlocks(*dense, w, b.data(), floor.data(), dense->blockFolded.data());
+                continue;
+            }
+            dense->folded.resize(push_prediction::kernels::packedSize(w.rows(), w.cols()));
+            push_prediction::kernels::packDense(w.data(), b.data(), floor.data(), w.rows(), w.cols(), dense->folded.data());
+        }
+    }
+
+    /*
+     * Normalize the inputs into the input slot, run all ops on the arena
+     * and return a view of the (unnormalized) output slot. With dropout,
+     * Dropout layers apply random masks.
+     */
+    template <class Derived>
+    Eigen::Map<Eigen::MatrixXf, Eigen::Aligned> forward(InferenceContext &context, const Eigen::MatrixBase<Derived> &input, size_t batch, bool dropout = false) const {
+        if((size_t)context.arena.size() < arenaSize_ * batch) {
+            context.arena.resize(arenaSize_ * batch);
+        }
+        float* arena = context.arena.data();
+        auto networkInput = inputLayer->output(arena, batch);
+        if(inputTransform_ && !inputFolded_) {
+            PUSH_PREDICTION_PROFILE_SCOPE(transformProfile_);
+            networkInput = (input.array().colwise() * inScale_.array()).colwise() + inOffset_.array();
+        } else {
+            networkInput = input;
+        }
+
+        for(auto &layer : ops_) {
+            PUSH_PREDICTION_PROFILE_SCOPE(layer->profile);
+            if(dropout && layer->type() == LayerType::dropout)
+                static_cast<const Dropout&>(*layer).sample(arena, batch, context.random);
+            else
+                layer->run(arena, batch);
+        }
+        return outputLayer->output(arena, batch);
     }
 };
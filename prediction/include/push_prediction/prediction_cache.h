@@ -0,0 +1,128 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace push_prediction {
+
+    /*
+     * Bounded cache of predictions keyed by a quantized control vector: all controls
+     * in the same cell of the grid with spacing `resolution` share one prediction.
+     *
+     * The table uses open addressing with a fixed probe window per key. A new key takes
+     * the first empty slot of its window or replaces the least recently used one, so
+     * the memory stays at capacity slots and no entries are ever deleted.
+     * Lookups are lock-free: every slot is guarded by a sequence counter that is odd
+     * while the slot is written, a lookup overlapping a write of its slot is a miss.
+     * Insertions are serialized by a flag; an insertion finding the flag taken is dropped
+     * instead of waiting, so no thread ever blocks on the cache.
+     */
+    class PredictionCache {
+        public:
+            static constexpr size_t KEY_SIZE = 5;
+            static constexpr size_t VALUE_SIZE = 3;
+            // slots probed per key
+            static constexpr size_t WINDOW = 8;
+
+            typedef std::array<int32_t, KEY_SIZE> Key;
+
+            struct Statistics {
+                uint64_t hits = 0;
+                uint64_t misses = 0;
+                uint64_t insertions = 0;
+                uint64_t evictions = 0;
+                // insertions skipped while another thread inserted
+                uint64_t dropped = 0;
+                size_t size = 0;
+                size_t capacity = 0;
+            };
+
+            // capacity is rounded up to a power of two of at least WINDOW slots
+            PredictionCache(size_t capacity, double resolution);
+
+            /*
+             * Cell of the first `size` (at most KEY_SIZE) values, the others are zero.
+             * Returns false for values too large to quantize, which should not be cached.
+             */
+            bool quantize(const float* values, size_t size, Key& key) const;
+
+            // copies the VALUE_SIZE values stored for the key
+            bool lookup(const Key& key, float* value) const;
+
+            void insert(const Key& key, const float* value);
+
+            void clear();
+
+            Statistics statistics() const;
+
+            size_t capacity() const {
+                return mask_ + 1;
+            }
+
+            double resolution() const {
+                return resolution_;
+            }
+
+        private:
+            struct Slot {
+                // odd while the slot is written
+                std::atomic<uint32_t> sequence;
+                // clock of the last insertion or hit, 0 for empty slots
+                std::atomic<uint32_t> used;
+                std::atomic<int32_t> key[KEY_SIZE];
+                std::atomic<float> value[VALUE_SIZE];
+            };
+
+            size_t window(const Key& key) const;
+
+            const double resolution_;
+            const size_t mask_;
+            std::unique_ptr<Slot[]> slots_;
+
+            // advanced by every insertion
+            std::atomic<uint32_t> clock_;
+            std::atomic_flag writing_ = ATOMIC_FLAG_INIT;
+
+            mutable std::atomic<uint64_t> hits_;
+            mutable std::atomic<uint64_t> misses_;
+            std::atomic<uint64_t> insertions_;
+            std::atomic<uint64_t> evictions_;
+            std::atomic<uint64_t> dropped_;
+    };
+}
@@ -0,0 +1,214 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+
+/* Author: Lars Henning Kayser */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <push_prediction/profiling_config.h>
+
+/*
+ * Optional inference profiling, enabled by building tams_ur5_push_prediction with
+ * cmake -DPUSH_PREDICTION_PROFILING=ON, which defines PUSH_PREDICTION_PROFILING in the
+ * generated profiling_config.h. Without it the macros below expand to
+ * nothing and no clock is read.
+ *
+ * Statistics are registered once by name and then updated lock-free from any thread.
+ * Each keeps the count, sum, maximum and a log2 histogram of its values
+ * (durations in ns, batch sizes, ...); report() formats all of them.
+ */
+namespace push_prediction {
+  namespace profiling {
+
+    class Statistic {
+      public:
+        static const int BUCKETS = 64;
+
+        void record(uint64_t value) {
+          count_.fetch_add(1, std::memory_order_relaxed);
+          sum_.fetch_add(value, std::memory_order_relaxed);
+          uint64_t max = max_.load(std::memory_order_relaxed);
+          while(value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed));
+          buckets_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+        uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+        uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+        // upper bound of the bucket containing the given quantile
+        uint64_t quantile(double q) const {
+          uint64_t total = count();
+          uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * total + 0.5));
+          uint64_t seen = 0;
+          for(int i = 0; i < BUCKETS; i++) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if(seen >= rank)
+              return std::min(max(), i == 0 ? 1 : (i >= 63 ? UINT64_MAX : (uint64_t(2) << i) - 1));
+          }
+          return max();
+        }
+
+        void reset() {
+          count_ = 0;
+          sum_ = 0;
+          max_ = 0;
+          for(auto &bucket : buckets_)
+            bucket = 0;
+        }
+
+      private:
+        // bucket i holds values in [2^i, 2^(i+1)), bucket 0 also holds 0
+        static int bucket(uint64_t value) {
+          return value ? 63 - __builtin_clzll(value) : 0;
+        }
+
+        std::atomic<uint64_t> count_{0};
+        std::atomic<uint64_t> sum_{0};
+        std::atomic<uint64_t> max_{0};
+        std::atomic<uint64_t> buckets_[BUCKETS] = {};
+    };
+
+    class Registry {
+      public:
+        static Registry& instance() {
+          static Registry registry;
+          return registry;
+        }
+
+        // statistics are never removed, so the returned reference stays valid
+        Statistic& statistic(const std::string& name) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          auto& statistic = statistics_[name];
+          if(!statistic)
+            statistic.reset(new Statistic());
+          return *statistic;
+        }
+
+        std::string report() {
+          std::lock_guard<std::mutex> lock(mutex_);
+          std::string text;
+          char line[256];
+          snprintf(line, sizeof(line), "%-40s %10s %12s %10s %10s %10s %10s %10s\n",
+              "statistic", "count", "sum", "mean", "p50", "p90", "p99", "max");
+          text += line;
+          for(auto& entry : statistics_) {
+            const Statistic& s = *entry.second;
+            if(!s.count())
+              continue;
+            snprintf(line, sizeof(line), "%-40s %10llu %12llu %10.1f %10llu %10llu %10llu %10llu\n",
+                entry.first.c_str(), (unsigned long long)s.count(), (unsigned long long)s.sum(),
+                (double)s.sum() / s.count(), (unsigned long long)s.quantile(0.5),
+                (unsigned long long)s.quantile(0.9), (unsigned long long)s.quantile(0.99),
+                (unsigned long long)s.max());
+            text += line;
+          }
+          return text;
+        }
+
+        void reset() {
+          std::lock_guard<std::mutex> lock(mutex_);
+          for(auto& entry : statistics_)
+            entry.second->reset();
+        }
+
+      private:
+        std::mutex mutex_;
+        std::map<std::string, std::unique_ptr<Statistic>> statistics_;
+    };
+
+    inline Statistic& statistic(const std::string& name) { return Registry::instance().statistic(name); }
+
+    // all recorded statistics as a table, quantiles are log2 bucket bounds
+    inline std::string report() { return Registry::instance().report(); }
+
+    inline void reset() { Registry::instance().reset(); }
+
+    inline uint64_t now() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // records the lifetime of the scope in ns, does nothing for a null statistic
+    class ScopedTimer {
+      public:
+        explicit ScopedTimer(Statistic* statistic) : statistic_(statistic), start_(statistic ? now() : 0) {}
+        ~ScopedTimer() {
+          if(statistic_)
+            statistic_->record(now() - start_);
+        }
+
+      private:
+        Statistic* statistic_;
+        uint64_t start_;
+    };
+  }
+}
+
+#define PUSH_PREDICTION_PROFILE_CONCAT_(a, b) a ## b
+#define PUSH_PREDICTION_PROFILE_CONCAT(a, b) PUSH_PREDICTION_PROFILE_CONCAT_(a, b)
+
+#ifdef PUSH_PREDICTION_PROFILING
+// pointer to the named statistic (nullptr if profiling is disabled)
+#define PUSH_PREDICTION_PROFILE_STATISTIC(name) (&push_prediction::profiling::statistic(name))
+// time the enclosing scope into a statistic pointer
+#define PUSH_PREDICTION_PROFILE_SCOPE(statistic) \
+  push_prediction::profiling::ScopedTimer PUSH_PREDICTION_PROFILE_CONCAT(profile_timer_, __LINE__)(statistic)
+// time the enclosing scope into a named statistic, looked up once per call site
+#define PUSH_PREDICTION_PROFILE_NAMED_SCOPE(name) \
+  static push_prediction::profiling::Statistic& PUSH_PREDICTION_PROFILE_CONCAT(profile_statistic_, __LINE__) = \
+      push_prediction::profiling::statistic(name); \
+  PUSH_PREDICTION_PROFILE_SCOPE(&PUSH_PREDICTION_PROFILE_CONCAT(profile_statistic_, __LINE__))
+// record a value into a named statistic, looked up once per call site
+#define PUSH_PREDICTION_PROFILE_RECORD(name, value) do { \
+    static push_prediction::profiling::Statistic& profile_statistic = push_prediction::profiling::statistic(name); \
+    profile_statistic.record(value); \
+  } while(0)
+#else
+#define PUSH_PREDICTION_PROFILE_STATISTIC(name) (static_cast<push_prediction::profiling::Statistic*>(nullptr))
+#define PUSH_PREDICTION_PROFILE_SCOPE(statistic)
+#define PUSH_PREDICTION_PROFILE_NAMED_SCOPE(name)
+#define PUSH_PREDICTION_PROFILE_RECORD(name, value) do {} while(0)
+#endif
@@ -38,8 +38,14 @@
 #include <tams_ur5_push_msgs/Push.h>
 #include <geometry_msgs/Pose.h>
 #include <push_prediction/neural_network.h>
+#include <push_prediction/control_table.h>
+#include <push_prediction/prediction_cache.h>
 #include <tf/transform_datatypes.h>
 
+#include <memory>
+#include <string>
+#include <vector>
+
 //#include <eigen3/Eigen/Geometry>
 //#include <eigen3/Eigen/Core>
 #include <Eigen/Dense>
@@ -49,36 +55,215 @@ const std::vector<double> MINV = {-0.04123226483869708, -0.031217403199005074, -
 
 namespace push_prediction {
     class PushPredictor {
+        public:
+            /*
+             * Per-thread prediction state: network scratch memory. predict() is const,
+             * so threads can share one predictor by passing their own context.
+             */
+            struct Context {
+                NeuralNetwork::InferenceContext network;
+                // network input and output of the last prediction, kept to reuse their memory
+                Eigen::VectorXf input;
+                Eigen::VectorXf output;
+                // Monte-Carlo dropout predictions, one per column
+                Eigen::MatrixXf samples;
+
+                // predictions of a batch that are neither in the table nor in the cache,
+                // run through the network together (see predictBatch)
+                struct Pending {
+                    int column;
+                    bool cached;
+                    PredictionCache::Key key;
+                };
+                std::vector<Pending> pending;
+                Eigen::MatrixXf batch_inputs;
+                Eigen::MatrixXf batch_outputs;
+            };
+
         private:
-            NeuralNetwork network_;
-            bool reuseSolutions_ = false;
-            
-            tams_ur5_push_msgs::Push last_push;
-            geometry_msgs::Pose last_pose;
+            // shared with all predictors of the same model (see ModelRegistry)
+            std::shared_ptr<const NeuralNetwork> network_;
+            // predictions of quantized controls (see setCache), shared by all threads
+            std::shared_ptr<PredictionCache> cache_;
+
+            // interpolated predictions of the pushes of planner controls (see setLookupTable)
+            std::shared_ptr<const ControlTable> table_;
 
+            // single predictions through the generated forward pass of the YAML export of the default model
+            // (PUSH_PREDICTION_STATIC_MODEL), everything else uses network_
+            bool use_static_model_ = false;
 
         protected:
+            // network input of a push for models with and without normalization
+            void createInput(const tams_ur5_push_msgs::Push& push, Eigen::VectorXf& input_vec) const;
+
+            // network input of a planner control (see predictControl)
+            void createInput(const double* control, Eigen::VectorXf& input_vec) const;
+
             void normalizePushInput(const tams_ur5_push_msgs::Push& push, Eigen::VectorXf& input_vec) const;
 
-            void denormalizePoseOutput(Eigen::VectorXf output_vec, geometry_msgs::Pose& pose) const;
+            // (x, y, yaw) predicted for a network input, from the cache if enabled
+            void predictInput(Context& context, const Eigen::VectorXf& input_vec, float* output) const;
+
+            // answer the input in context.input from the cache or queue it for runPending
+            void queueInput(Context& context, int column, Eigen::Matrix3Xd& steps) const;
+
+            // run the queued inputs as one network batch and write their (x, y, yaw) to steps
+            void runPending(Context& context, Eigen::Matrix3Xd& steps) const;
+
+            // compose the steps with the start poses (one column, or one per step)
+            static void applySteps(const Eigen::Matrix3Xd& starts, const Eigen::Matrix3Xd& steps, Eigen::Matrix3Xd& results);
+
+            // mean and covariance of the predictions of one push (3 rows per ensemble member, one column per sample)
+            static void poolSamples(const Eigen::Ref<const Eigen::MatrixXf>& samples, size_t members, Eigen::Vector3d& mean,
+                    Eigen::Matrix3d& covariance);
+
+            void denormalizePoseOutput(const Eigen::Ref<const Eigen::VectorXf>& output_vec, geometry_msgs::Pose& pose) const;
         public:
             PushPredictor();
 
             PushPredictor(const std::string& model_file);
 
+            /*
+             * Ensemble of models with the same layer graph and inputs, evaluated in a single
+             * pass (see NeuralNetwork::stack). Predictions are the mean of the members,
+             * the uncertainty estimates include the spread between the members.
+             */
+            PushPredictor(const std::vector<std::string>& model_files);
+
+            /*
+             * Cache predictions of up to `capacity` pushes. Pushes are keyed by their control
+             * (approach point, normal yaw and angle normalized by the object size and the
+             * control ranges, distance by the maximum push distance) quantized to `resolution`,
+             * so pushes closer than that share one prediction. A capacity of 0 disables the cache.
+             * Not thread-safe with concurrent predictions, configure the cache before planning.
+             */
+            void setCache(size_t capacity, double resolution = DEFAULT_CACHE_RESOLUTION);
+
+            // null without a cache
+            std::shared_ptr<const PredictionCache> cache() const {
+                return cache_;
+            }
+
+            /*
+             * Answer predict() for pushes of planner controls by interpolating the table instead of
+             * running the network, other pushes still use the network. The table has to be built
+             * from the same model (see build_control_table). Null disables the table.
+             */
+            void setLookupTable(std::shared_ptr<const ControlTable> table);
+
+            std::shared_ptr<const ControlTable> lookupTable() const {
+                return table_;
+            }
+
+            // enables a cache with the default capacity and resolution if there is none, or disables caching
             void setReuseSolutions(bool reuseSolutions);
 
-            bool pushesEqual(const tams_ur5_push_msgs::Push& first, const tams_ur5_push_msgs::Push& second) {
-                return first.approach.point.x == second.approach.point.x 
-                    && first.approach.point.y == second.approach.point.y
-                    && first.approach.normal.w == second.approach.normal.w
-                    && first.approach.normal.x == second.approach.normal.x
-                    && first.approach.normal.y == second.approach.normal.y
-                    && first.approach.normal.z == second.approach.normal.z
-                    && first.approach.angle == second.approach.angle
-                    && first.distance == second.distance;
+            static constexpr size_t DEFAULT_CACHE_CAPACITY = 1 << 16;
+            static constexpr double DEFAULT_CACHE_RESOLUTION = 1e-3;
+
+            // predict with a context of the calling thread
+            bool predict(const tams_ur5_push_msgs::Push& push, geometry_msgs::Pose& pose) const;
+
+            bool predict(Context& context, const tams_ur5_push_msgs::Push& push, geometry_msgs::Pose& pose) const;
+
+            /*
+             * Predict the push of a planner control (pivot, angle, distance in [0, 1] as converted by
+             * convertControlToPush of push_planning, for the default object size), returning the
+             * displacement of the object without building any messages. Same result as predict()
+             * for the converted push.
+             */
+            bool predictControl(const double* control, double& dx, double& dy, double& dyaw) const;
+
+            bool predictControl(Context& context, const double* control, double& dx, double& dy, double& dyaw) const;
+
+            /*
+             * Predict many planner controls (one per column, see predictControl) or pushes at once.
+             * Controls found in the table or the cache are answered directly, the others run through
+             * the network as a single batch. steps holds the displacement (dx, dy, dyaw) of each push.
+             */
+            bool predictBatch(const Eigen::Matrix3Xd& controls, Eigen::Matrix3Xd& steps) const;
+
+            bool predictBatch(Context& context, const Eigen::Matrix3Xd& controls, Eigen::Matrix3Xd& steps) const;
+
+            bool predictBatch(const std::vector<tams_ur5_push_msgs::Push>& pushes, Eigen::Matrix3Xd& steps) const;
+
+            bool predictBatch(Context& context, const std::vector<tams_ur5_push_msgs::Push>& pushes, Eigen::Matrix3Xd& steps) const;
+
+            /*
+             * Poses (x, y, yaw) reached by applying each push to its start pose, given as a single
+             * column for all pushes or one column per push. The yaw is wrapped by fmod(yaw + pi, 2 pi) - pi.
+             */
+            bool predictBatch(const Eigen::Matrix3Xd& controls, const Eigen::Matrix3Xd& starts, Eigen::Matrix3Xd& results) const;
+
+            bool predictBatch(Context& context, const Eigen::Matrix3Xd& controls, const Eigen::Matrix3Xd& starts,
+                    Eigen::Matrix3Xd& results) const;
+
+            bool predictBatch(const std::vector<tams_ur5_push_msgs::Push>& pushes, const Eigen::Matrix3Xd& starts,
+                    Eigen::Matrix3Xd& results) const;
+
+            bool predictBatch(Context& context, const std::vector<tams_ur5_push_msgs::Push>& pushes,
+                    const Eigen::Matrix3Xd& starts, Eigen::Matrix3Xd& results) const;
+
+            /*
+             * Predict a push and the derivatives of the pose (x, y, yaw) with respect to
+             * (approach.point.x, approach.point.y, approach.angle, distance), computed by the
+             * network (not the generated model). Solutions are not reused or memoized.
+             */
+            bool predict(const tams_ur5_push_msgs::Push& push, geometry_msgs::Pose& pose, Eigen::Matrix<double, 3, 4>& jacobian) const;
+
+            bool predict(Context& context, const tams_ur5_push_msgs::Push& push, geometry_msgs::Pose& pose,
+                    Eigen::Matrix<double, 3, 4>& jacobian) const;
+
+            /*
+             * Monte-Carlo dropout estimate of the resulting pose: mean and covariance of
+             * (x, y, yaw) over `samples` predictions with random dropout masks, evaluated
+             * as one batch. Ensembles pool the predictions of all members, single models
+             * without Dropout layers yield a zero covariance.
+             */
+            bool predictUncertainty(const tams_ur5_push_msgs::Push& push, Eigen::Vector3d& mean,
+                    Eigen::Matrix3d& covariance, size_t samples = 32) const;
+
+            bool predictUncertainty(Context& context, const tams_ur5_push_msgs::Push& push, Eigen::Vector3d& mean,
+                    Eigen::Matrix3d& covariance, size_t samples = 32) const;
+
+            /*
+             * Same for many pushes, with the dropout samples of all pushes evaluated as one batch.
+             * means holds one column and covariances one matrix per push.
+             */
+            bool predictUncertainty(const std::vector<tams_ur5_push_msgs::Push>& pushes, Eigen::Matrix3Xd& means,
+                    std::vector<Eigen::Matrix3d>& covariances, size_t samples = 32) const;
+
+            bool predictUncertainty(Context& context, const std::vector<tams_ur5_push_msgs::Push>& pushes,
+                    Eigen::Matrix3Xd& means, std::vector<Eigen::Matrix3d>& covariances, size_t samples = 32) const;
+
+            /*
+             * Predictions of all ensemble members (one column per member) from one pass,
+             * their mean and covariance (zero for a single model).
+             */
+            bool predictEnsemble(const tams_ur5_push_msgs::Push& push, Eigen::Matrix3Xd& predictions,
+                    Eigen::Vector3d& mean, Eigen::Matrix3d& covariance) const;
+
+            bool predictEnsemble(Context& context, const tams_ur5_push_msgs::Push& push, Eigen::Matrix3Xd& predictions,
+                    Eigen::Vector3d& mean, Eigen::Matrix3d& covariance) const;
+
+            /*
+             * Guaranteed bounds on the predicted (x, y, yaw) for all network inputs in the box spanned by
+             * the inputs of the given pushes (interval bound propagation, see NeuralNetwork::bounds),
+             * for ensembles the bounds hold for every member.
+             */
+            bool predictBounds(const std::vector<tams_ur5_push_msgs::Push>& pushes, Eigen::Vector3d& lower,
+                    Eigen::Vector3d& upper) const;
+
+            bool predictBounds(Context& context, const std::vector<tams_ur5_push_msgs::Push>& pushes,
+                    Eigen::Vector3d& lower, Eigen::Vector3d& upper) const;
+
+            bool hasUncertainty() const {
+                return network_->hasDropout() || network_->ensembleSize() > 1;
             }
 
-            bool predict(const tams_ur5_push_msgs::Push& push, geometry_msgs::Pose& pose);
+            size_t ensembleSize() const {
+                return network_->ensembleSize();
+            }
     };
 }
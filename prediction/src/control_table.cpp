@@ -0,0 +1,320 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+#include <ros/ros.h>
+#include <tf/transform_datatypes.h>
+#include <push_prediction/control_table.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace push_prediction {
+
+    constexpr size_t ControlTable::SIDES;
+    constexpr size_t ControlTable::VALUES;
+    constexpr double ControlTable::DEFAULT_OBJECT_X;
+    constexpr double ControlTable::DEFAULT_OBJECT_Y;
+    constexpr double ControlTable::MAX_ANGLE;
+    constexpr double ControlTable::MAX_DISTANCE;
+
+    namespace {
+        const char tableMagic[8] = { 'P', 'U', 'S', 'H', 'L', 'U', 'T', '\0' };
+        const uint32_t tableVersion = 1;
+
+        struct TableHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t pivot_nodes[ControlTable::SIDES];
+            uint32_t angle_nodes;
+            uint32_t distance_nodes;
+            float corner_refinement;
+            double object_x;
+            double object_y;
+            float max_error[ControlTable::VALUES];
+            float error_bound[ControlTable::VALUES];
+        };
+
+        // accepted distance of a push from the border and of its normal from the side normal
+        const double borderTolerance = 1e-6;
+        const double normalTolerance = 1e-3;
+
+        // approach normals of the sides as created by getPoseFromBoxBorder
+        const double sideYaw[ControlTable::SIDES] = { 0.5 * M_PI, M_PI, 1.5 * M_PI, 0.0 };
+
+        // index of the lower node of the cell containing position (0 to 1) and the weight of the upper node
+        inline size_t cell(double position, size_t nodes, double& weight)
+        {
+            const double u = std::min(std::max(position, 0.0), 1.0) * (nodes - 1);
+            const size_t index = std::min(static_cast<size_t>(u), nodes - 2);
+            weight = u - index;
+            return index;
+        }
+
+        // same for the nodes at the given positions
+        inline size_t cell(double position, const std::vector<double>& positions, double& weight)
+        {
+            position = std::min(std::max(position, 0.0), 1.0);
+            const size_t index = std::min<size_t>(std::upper_bound(positions.begin() + 1, positions.end() - 1, position)
+                - positions.begin() - 1, positions.size() - 2);
+            weight = (position - positions[index]) / (positions[index + 1] - positions[index]);
+            return index;
+        }
+    }
+
+    ControlTable::ControlTable(size_t pivot_nodes, size_t angle_nodes, size_t distance_nodes, double corner_refinement,
+            double object_x, double object_y)
+        : object_x_(object_x), object_y_(object_y), corner_refinement_(std::min(std::max(corner_refinement, 0.0), 1.0)),
+          angle_nodes_(std::max<size_t>(angle_nodes, 2)), distance_nodes_(std::max<size_t>(distance_nodes, 2))
+    {
+        const double perimeter = 2 * (object_x_ + object_y_);
+        for (size_t side = 0; side < SIDES; side++)
+            pivot_nodes_[side] = std::max<size_t>(std::lround(pivot_nodes * sideLength(side) / perimeter), 2);
+        setupOffsets();
+    }
+
+    void ControlTable::setupOffsets()
+    {
+        size_t offset = 0;
+        double start = 0.0;
+        for (size_t side = 0; side < SIDES; side++) {
+            side_start_[side] = start / (2 * (object_x_ + object_y_));
+            start += sideLength(side);
+            side_offset_[side] = offset;
+            offset += pivot_nodes_[side];
+            // blend of uniform and cosine spacing, the latter places nodes densely at the corners
+            pivot_positions_[side].resize(pivot_nodes_[side]);
+            for (size_t i = 0; i < pivot_nodes_[side]; i++) {
+                const double u = double(i) / (pivot_nodes_[side] - 1);
+                pivot_positions_[side][i] = (1 - corner_refinement_) * u + corner_refinement_ * 0.5 * (1 - std::cos(M_PI * u));
+            }
+            pivot_positions_[side].back() = 1.0;
+        }
+        side_start_[SIDES] = 1.0;
+        values_.assign(offset * angle_nodes_ * distance_nodes_ * VALUES, 0.0f);
+    }
+
+    void ControlTable::load(const std::string& filename)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        TableHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            ROS_FATAL("unable to read control table %s", filename.c_str());
+            throw 0;
+        }
+        bool valid = std::memcmp(header.magic, tableMagic, sizeof(tableMagic)) == 0 && header.version == tableVersion
+            && header.angle_nodes >= 2 && header.distance_nodes >= 2 && header.object_x > 0 && header.object_y > 0
+            && header.corner_refinement >= 0 && header.corner_refinement <= 1;
+        for (size_t side = 0; side < SIDES; side++)
+            valid = valid && header.pivot_nodes[side] >= 2;
+        if (!valid) {
+            ROS_FATAL("invalid control table %s", filename.c_str());
+            throw 0;
+        }
+
+        object_x_ = header.object_x;
+        object_y_ = header.object_y;
+        corner_refinement_ = header.corner_refinement;
+        std::copy(header.pivot_nodes, header.pivot_nodes + SIDES, pivot_nodes_);
+        angle_nodes_ = header.angle_nodes;
+        distance_nodes_ = header.distance_nodes;
+        std::copy(header.max_error, header.max_error + VALUES, max_error_);
+        std::copy(header.error_bound, header.error_bound + VALUES, error_bound_);
+        setupOffsets();
+        if (!file.read(reinterpret_cast<char*>(values_.data()), values_.size() * sizeof(float))) {
+            ROS_FATAL("truncated control table %s", filename.c_str());
+            throw 0;
+        }
+    }
+
+    void ControlTable::save(const std::string& filename) const
+    {
+        TableHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, tableMagic, sizeof(tableMagic));
+        header.version = tableVersion;
+        std::copy(pivot_nodes_, pivot_nodes_ + SIDES, header.pivot_nodes);
+        header.angle_nodes = angle_nodes_;
+        header.distance_nodes = distance_nodes_;
+        header.object_x = object_x_;
+        header.object_y = object_y_;
+        header.corner_refinement = corner_refinement_;
+        std::copy(max_error_, max_error_ + VALUES, header.max_error);
+        std::copy(error_bound_, error_bound_ + VALUES, header.error_bound);
+
+        std::ofstream file(filename, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(values_.data()), values_.size() * sizeof(float));
+        if (!file) {
+            ROS_FATAL("unable to write control table %s", filename.c_str());
+            throw 0;
+        }
+    }
+
+    double ControlTable::sideStart(size_t side) const
+    {
+        return side_start_[side];
+    }
+
+    double ControlTable::pivotControl(size_t side, double position) const
+    {
+        return side_start_[side] + position * (side_start_[side + 1] - side_start_[side]);
+    }
+
+    void ControlTable::nodeControl(size_t node, size_t& side, double* control) const
+    {
+        const size_t pivot_node = node / (angle_nodes_ * distance_nodes_);
+        side = SIDES - 1;
+        while (side > 0 && pivot_node < side_offset_[side])
+            side--;
+        control[0] = pivotControl(side, pivot_positions_[side][pivot_node - side_offset_[side]]);
+        control[1] = double(node / distance_nodes_ % angle_nodes_) / (angle_nodes_ - 1);
+        control[2] = double(node % distance_nodes_) / (distance_nodes_ - 1);
+    }
+
+    bool ControlTable::pivotSide(double pivot, size_t& side, double& position) const
+    {
+        if (!(pivot >= 0.0 && pivot <= 1.0))
+            return false;
+        side = sideOfPivot(pivot, object_x_, object_y_);
+        position = std::min(std::max((pivot - side_start_[side]) / (side_start_[side + 1] - side_start_[side]), 0.0), 1.0);
+        return true;
+    }
+
+    size_t ControlTable::sideOfPivot(double pivot, double object_x, double object_y)
+    {
+        const double p = pivot * 2 * (object_x + object_y);
+        if (p <= object_x)
+            return 0;
+        if (p <= object_x + object_y)
+            return 1;
+        if (p <= 2 * object_x + object_y)
+            return 2;
+        return 3;
+    }
+
+    void ControlTable::borderPoint(size_t side, double pivot, double& x, double& y, double object_x, double object_y)
+    {
+        const double p = pivot * 2 * (object_x + object_y);
+        switch (side) {
+            case 0: x = p; y = 0; break;
+            case 1: x = object_x; y = p - object_x; break;
+            case 2: x = 2 * object_x + object_y - p; y = object_y; break;
+            default: x = 0; y = 2 * (object_x + object_y) - p; break;
+        }
+        x -= 0.5 * object_x;
+        y -= 0.5 * object_y;
+    }
+
+    double ControlTable::sideNormal(size_t side)
+    {
+        return sideYaw[side];
+    }
+
+    void ControlTable::controlToPush(size_t side, const double* control, tams_ur5_push_msgs::Push& push) const
+    {
+        borderPoint(side, control[0], push.approach.point.x, push.approach.point.y, object_x_, object_y_);
+        push.approach.point.z = 0.0;
+        push.approach.normal = tf::createQuaternionMsgFromYaw(sideYaw[side]);
+        push.approach.angle = (control[1] - 0.5) * 2 * MAX_ANGLE;
+        push.distance = control[2] * MAX_DISTANCE;
+    }
+
+    bool ControlTable::pushToControl(const tams_ur5_push_msgs::Push& push, size_t& side, double* control) const
+    {
+        const double yaw = tf::getYaw(push.approach.normal);
+        for (side = 0; side < SIDES; side++)
+            if (std::fabs(std::remainder(yaw - sideYaw[side], 2 * M_PI)) < normalTolerance)
+                break;
+        if (side == SIDES)
+            return false;
+
+        const double x = push.approach.point.x + 0.5 * object_x_;
+        const double y = push.approach.point.y + 0.5 * object_y_;
+        double border, p;
+        switch (side) {
+            case 0: border = y; p = x; break;
+            case 1: border = x - object_x_; p = object_x_ + y; break;
+            case 2: border = y - object_y_; p = 2 * object_x_ + object_y_ - x; break;
+            default: border = x; p = 2 * (object_x_ + object_y_) - y; break;
+        }
+        const double start = sideStart(side) * 2 * (object_x_ + object_y_);
+        if (std::fabs(border) > borderTolerance || p < start - borderTolerance || p > start + sideLength(side) + borderTolerance)
+            return false;
+
+        control[0] = p / (2 * (object_x_ + object_y_));
+        control[1] = push.approach.angle / (2 * MAX_ANGLE) + 0.5;
+        control[2] = push.distance / MAX_DISTANCE;
+        return control[1] >= 0.0 && control[1] <= 1.0 && control[2] >= 0.0 && control[2] <= 1.0;
+    }
+
+    bool ControlTable::interpolate(const double* control, float* values) const
+    {
+        size_t side;
+        double position;
+        return pivotSide(control[0], side, position) && interpolate(side, control, values);
+    }
+
+    bool ControlTable::interpolate(size_t side, const double* control, float* values) const
+    {
+        if (values_.empty() || !(control[1] >= 0.0 && control[1] <= 1.0 && control[2] >= 0.0 && control[2] <= 1.0))
+            return false;
+        const double position = (control[0] - side_start_[side]) / (side_start_[side + 1] - side_start_[side]);
+        double wp, wa, wd;
+        const size_t p = cell(position, pivot_positions_[side], wp);
+        const size_t a = cell(control[1], angle_nodes_, wa);
+        const size_t d = cell(control[2], distance_nodes_, wd);
+
+        const size_t pivot_stride = angle_nodes_ * distance_nodes_ * VALUES;
+        const size_t angle_stride = distance_nodes_ * VALUES;
+        const float* corner = values_.data() + (side_offset_[side] + p) * pivot_stride + a * angle_stride + d * VALUES;
+        for (size_t v = 0; v < VALUES; v++) {
+            const float* c = corner + v;
+            const double c00 = c[0] + wd * (c[VALUES] - c[0]);
+            const double c01 = c[angle_stride] + wd * (c[angle_stride + VALUES] - c[angle_stride]);
+            const double c10 = c[pivot_stride] + wd * (c[pivot_stride + VALUES] - c[pivot_stride]);
+            const double c11 = c[pivot_stride + angle_stride]
+                + wd * (c[pivot_stride + angle_stride + VALUES] - c[pivot_stride + angle_stride]);
+            const double c0 = c00 + wa * (c01 - c00);
+            const double c1 = c10 + wa * (c11 - c10);
+            values[v] = c0 + wp * (c1 - c0);
+        }
+        return true;
+    }
+
+    void ControlTable::setError(const float* max_error, const float* error_bound)
+    {
+        std::copy(max_error, max_error + VALUES, max_error_);
+        std::copy(error_bound, error_bound + VALUES, error_bound_);
+    }
+}
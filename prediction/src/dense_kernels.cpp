@@ -0,0 +1,1155 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+
+#include <push_prediction/dense_kernels.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PUSH_PREDICTION_X86_KERNELS
+// AVX-VNNI (256 bit vpdpbusd) needs GCC 11 or clang 12
+#if (defined(__clang__) && __clang_major__ >= 12) || (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 11)
+#define PUSH_PREDICTION_AVXVNNI_KERNEL
+#endif
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define PUSH_PREDICTION_NEON_KERNELS
+// the 8 bit dot product (sdot) of ARMv8.2 is detected at runtime on Linux
+#if defined(__linux__) && ((defined(__clang__) && __clang_major__ >= 10) || (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 10))
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#ifdef HWCAP_ASIMDDP
+#define PUSH_PREDICTION_NEON_DOT_KERNEL
+#endif
+#endif
+#endif
+
+namespace push_prediction {
+  namespace kernels {
+
+    const size_t P = PANEL_ROWS;
+
+    // range reduction and polynomial of the Cephes expf approximation
+    const float EXP_HI = 88.3762626647949f;
+    const float EXP_LO = -88.3762626647949f;
+    const float LOG2E = 1.44269504088896341f;
+    const float LN2_HI = 0.693359375f;
+    const float LN2_LO = -2.12194440e-4f;
+    const float EXP_P0 = 1.9875691500E-4f;
+    const float EXP_P1 = 1.3981999507E-3f;
+    const float EXP_P2 = 8.3334519073E-3f;
+    const float EXP_P3 = 4.1665795894E-2f;
+    const float EXP_P4 = 1.6666665459E-1f;
+    const float EXP_P5 = 5.0000001201E-1f;
+
+    size_t packedSize(size_t rows, size_t cols)
+    {
+      return (rows + P - 1) / P * (cols + 2) * P;
+    }
+
+    void packDense(const float* weights, const float* bias, const float* floor, size_t rows, size_t cols,
+        float* packed)
+    {
+      std::fill(packed, packed + packedSize(rows, cols), 0.0f);
+      for (size_t row = 0; row < rows; row++) {
+        float* panel = packed + row / P * (cols + 2) * P;
+        const size_t r = row % P;
+        if (bias)
+          panel[r] = bias[row];
+        if (floor)
+          panel[P + r] = floor[row];
+        for (size_t col = 0; col < cols; col++)
+          panel[(col + 2) * P + r] = weights[col * rows + row];
+      }
+    }
+
+    // number of values holding the block count and indices of a sparse panel
+    static inline size_t sparseHeader(size_t blocks)
+    {
+      return (1 + blocks + P - 1) / P * P;
+    }
+
+    static inline bool zeroBlock(const float* weights, size_t rows, size_t row, size_t col)
+    {
+      for (size_t r = row; r < std::min(row + P, rows); r++) {
+        if (weights[col * rows + r] != 0.0f)
+          return false;
+      }
+      return true;
+    }
+
+    size_t sparsePackedSize(const float* weights, size_t rows, size_t cols)
+    {
+      size_t size = 0;
+      for (size_t row = 0; row < rows; row += P) {
+        size_t blocks = 0;
+        for (size_t col = 0; col < cols; col++)
+          blocks += !zeroBlock(weights, rows, row, col);
+        size += 2 * P + sparseHeader(blocks) + blocks * P;
+      }
+      return size;
+    }
+
+    void packSparseDense(const float* weights, const float* bias, const float* floor, size_t rows, size_t cols,
+        float* sparse)
+    {
+      std::fill(sparse, sparse + sparsePackedSize(weights, rows, cols), 0.0f);
+      float* panel = sparse;
+      for (size_t row = 0; row < rows; row += P) {
+        const size_t valid = std::min(P, rows - row);
+        for (size_t r = 0; r < valid; r++) {
+          panel[r] = bias ? bias[row + r] : 0.0f;
+          panel[P + r] = floor ? floor[row + r] : 0.0f;
+        }
+        std::vector<uint32_t> indices;
+        for (size_t col = 0; col < cols; col++) {
+          if (!zeroBlock(weights, rows, row, col))
+            indices.push_back(col);
+        }
+        const uint32_t blocks = indices.size();
+        std::memcpy(panel + 2 * P, &blocks, sizeof(blocks));
+        std::memcpy(panel + 2 * P + 1, indices.data(), indices.size() * sizeof(uint32_t));
+        float* w = panel + 2 * P + sparseHeader(blocks);
+        for (size_t b = 0; b < blocks; b++) {
+          for (size_t r = 0; r < valid; r++)
+            w[b * P + r] = weights[indices[b] * rows + row + r];
+        }
+        panel = w + blocks * P;
+      }
+    }
+
+    // block count, indices and weights of a sparse panel, returns the next panel
+    static inline const float* sparsePanel(const float* panel, size_t& blocks, const uint32_t*& indices, const float*& weights)
+    {
+      uint32_t count;
+      std::memcpy(&count, panel + 2 * P, sizeof(count));
+      blocks = count;
+      indices = reinterpret_cast<const uint32_t*>(panel + 2 * P + 1);
+      weights = panel + 2 * P + sparseHeader(blocks);
+      return weights + blocks * P;
+    }
+
+    /*
+     * 8 bit quantization: weights are symmetric int8 per output row, inputs are
+     * symmetric int8 shifted by 128 into the unsigned operand of the dot-product
+     * instructions. The shift is removed with the precomputed correction
+     * 128 * sum(w) of every row.
+     */
+    const size_t QUANTIZED_HEADER = 64;
+    const size_t GROUP = 4;
+
+    static inline size_t quantizedGroups(size_t cols)
+    {
+      return (cols + GROUP - 1) / GROUP;
+    }
+
+    static inline size_t quantizedPanelSize(size_t cols)
+    {
+      return 3 * P * sizeof(float) + quantizedGroups(cols) * GROUP * P;
+    }
+
+    size_t quantizedSize(size_t rows, size_t cols)
+    {
+      return QUANTIZED_HEADER + (rows + P - 1) / P * quantizedPanelSize(cols);
+    }
+
+    void quantizeDense(const float* weights, const float* bias, size_t rows, size_t cols, float inputRange,
+        uint8_t* quantized)
+    {
+      std::fill(quantized, quantized + quantizedSize(rows, cols), 0);
+      const float inputScale = inputRange > 0.0f ? 127.0f / inputRange : 1.0f;
+      std::memcpy(quantized, &inputScale, sizeof(inputScale));
+      for (size_t row = 0; row < rows; row++) {
+        uint8_t* panel = quantized + QUANTIZED_HEADER + row / P * quantizedPanelSize(cols);
+        const size_t r = row % P;
+        float maxWeight = 0.0f;
+        for (size_t col = 0; col < cols; col++)
+          maxWeight = std::max(maxWeight, std::fabs(weights[col * rows + row]));
+        const float weightScale = maxWeight > 0.0f ? maxWeight / 127.0f : 1.0f;
+        int32_t sum = 0;
+        for (size_t col = 0; col < cols; col++) {
+          const int8_t q = (int8_t)std::max(-127.0f, std::min(127.0f, std::round(weights[col * rows + row] / weightScale)));
+          panel[3 * P * sizeof(float) + (col / GROUP * P + r) * GROUP + col % GROUP] = (uint8_t)q;
+          sum += q;
+        }
+        const float scale = weightScale / inputScale;
+        const float offset = bias ? bias[row] : 0.0f;
+        const int32_t correction = 128 * sum;
+        std::memcpy(panel + r * sizeof(float), &scale, sizeof(float));
+        std::memcpy(panel + (P + r) * sizeof(float), &offset, sizeof(float));
+        std::memcpy(panel + (2 * P + r) * sizeof(float), &correction, sizeof(int32_t));
+      }
+    }
+
+    // quantize one input column into groups of unsigned bytes, zero padded
+    static inline void quantizeInput(const float* x, size_t cols, float scale, uint8_t* q)
+    {
+      for (size_t k = 0; k < cols; k++)
+        q[k] = (uint8_t)(std::lrint(std::max(-127.0f, std::min(127.0f, x[k] * scale))) + 128);
+      std::fill(q + cols, q + quantizedGroups(cols) * GROUP, 128);
+    }
+
+    static inline float quantizedInputScale(const uint8_t* quantized)
+    {
+      float scale;
+      std::memcpy(&scale, quantized, sizeof(scale));
+      return scale;
+    }
+
+    static inline float expApprox(float x)
+    {
+      x = std::min(std::max(x, EXP_LO), EXP_HI);
+      float fx = std::floor(x * LOG2E + 0.5f);
+      x = x - fx * LN2_HI - fx * LN2_LO;
+      float y = ((((EXP_P0 * x + EXP_P1) * x + EXP_P2) * x + EXP_P3) * x + EXP_P4) * x + EXP_P5;
+      y = y * x * x + x + 1.0f;
+      return std::ldexp(y, (int)fx);
+    }
+
+    static inline void activate(float* values, Activation activation, const float* floor)
+    {
+      if (activation == RELU) {
+        for (size_t r = 0; r < P; r++)
+          values[r] = std::max(values[r], floor ? floor[r] : 0.0f);
+      } else if (activation == SIGMOID) {
+        for (size_t r = 0; r < P; r++)
+          values[r] = 1.0f / (1.0f + expApprox(-values[r]));
+      }
+    }
+
+    /*
+     * Generic kernel written with GCC vector extensions, which compile to the
+     * baseline SIMD instructions of any target (or scalar code without SIMD).
+     * The panel accumulators are kept in registers across the input loop.
+     */
+    typedef float Vec4 __attribute__((vector_size(16)));
+
+    static inline Vec4 load4(const float* src)
+    {
+      Vec4 v;
+      std::memcpy(&v, src, sizeof(v));
+      return v;
+    }
+
+    static void denseGenericStrided(const float* packed, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch, size_t inputStride, size_t outputStride)
+    {
+      const size_t panels = (rows + P - 1) / P;
+      for (size_t p = 0; p < panels; p++) {
+        const float* panel = packed + p * (cols + 2) * P;
+        const size_t valid = std::min(P, rows - p * P);
+        for (size_t j = 0; j < batch; j++) {
+          const float* x = input + j * inputStride;
+          Vec4 a0 = load4(panel), a1 = load4(panel + 4), a2 = load4(panel + 8), a3 = load4(panel + 12);
+          for (size_t k = 0; k < cols; k++) {
+            const float* w = panel + (k + 2) * P;
+            const float xk = x[k];
+            a0 += load4(w) * xk;
+            a1 += load4(w + 4) * xk;
+            a2 += load4(w + 8) * xk;
+            a3 += load4(w + 12) * xk;
+          }
+          float acc[P];
+          std::memcpy(acc, &a0, sizeof(a0));
+          std::memcpy(acc + 4, &a1, sizeof(a1));
+          std::memcpy(acc + 8, &a2, sizeof(a2));
+          std::memcpy(acc + 12, &a3, sizeof(a3));
+          activate(acc, activation, panel + P);
+          std::copy(acc, acc + valid, output + j * outputStride + p * P);
+        }
+      }
+    }
+
+    static void denseGeneric(const float* packed, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      denseGenericStrided(packed, rows, cols, activation, input, output, batch, cols, rows);
+    }
+
+    static void sparseGeneric(const float* sparse, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      const size_t panels = (rows + P - 1) / P;
+      const float* panel = sparse;
+      for (size_t p = 0; p < panels; p++) {
+        size_t blocks;
+        const uint32_t* indices;
+        const float* weights;
+        const float* next = sparsePanel(panel, blocks, indices, weights);
+        const size_t valid = std::min(P, rows - p * P);
+        for (size_t j = 0; j < batch; j++) {
+          const float* x = input + j * cols;
+          Vec4 a0 = load4(panel), a1 = load4(panel + 4), a2 = load4(panel + 8), a3 = load4(panel + 12);
+          for (size_t b = 0; b < blocks; b++) {
+            const float* w = weights + b * P;
+            const float xk = x[indices[b]];
+            a0 += load4(w) * xk;
+            a1 += load4(w + 4) * xk;
+            a2 += load4(w + 8) * xk;
+            a3 += load4(w + 12) * xk;
+          }
+          float acc[P];
+          std::memcpy(acc, &a0, sizeof(a0));
+          std::memcpy(acc + 4, &a1, sizeof(a1));
+          std::memcpy(acc + 8, &a2, sizeof(a2));
+          std::memcpy(acc + 12, &a3, sizeof(a3));
+          activate(acc, activation, panel + P);
+          std::copy(acc, acc + valid, output + j * rows + p * P);
+        }
+        panel = next;
+      }
+    }
+
+    static void quantizedGeneric(const uint8_t* quantized, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      const size_t groups = quantizedGroups(cols);
+      const size_t panels = (rows + P - 1) / P;
+      const float inputScale = quantizedInputScale(quantized);
+      thread_local std::vector<uint8_t> q;
+      q.resize(groups * GROUP);
+      for (size_t j = 0; j < batch; j++) {
+        quantizeInput(input + j * cols, cols, inputScale, q.data());
+        for (size_t p = 0; p < panels; p++) {
+          const uint8_t* panel = quantized + QUANTIZED_HEADER + p * quantizedPanelSize(cols);
+          const int8_t* w = reinterpret_cast<const int8_t*>(panel + 3 * P * sizeof(float));
+          const size_t valid = std::min(P, rows - p * P);
+          int32_t acc[P] = {};
+          for (size_t g = 0; g < groups; g++) {
+            for (size_t r = 0; r < P; r++) {
+              for (size_t i = 0; i < GROUP; i++)
+                acc[r] += (int32_t)q[g * GROUP + i] * w[(g * P + r) * GROUP + i];
+            }
+          }
+          float scale[P], bias[P], values[P];
+          int32_t correction[P];
+          std::memcpy(scale, panel, sizeof(scale));
+          std::memcpy(bias, panel + P * sizeof(float), sizeof(bias));
+          std::memcpy(correction, panel + 2 * P * sizeof(float), sizeof(correction));
+          for (size_t r = 0; r < P; r++)
+            values[r] = scale[r] * (float)(acc[r] - correction[r]) + bias[r];
+          activate(values, activation, nullptr);
+          std::copy(values, values + valid, output + j * rows + p * P);
+        }
+      }
+    }
+
+#ifdef PUSH_PREDICTION_X86_KERNELS
+    /*
+     * AVX2/FMA kernel: a panel is held in two registers and four batch columns
+     * are processed together, so every panel load feeds eight FMAs.
+     */
+    __attribute__((target("avx2,fma")))
+    static inline __m256 exp256(__m256 x)
+    {
+      x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_LO)), _mm256_set1_ps(EXP_HI));
+      __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(LOG2E), _mm256_set1_ps(0.5f)));
+      x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(LN2_HI), x);
+      x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(LN2_LO), x);
+      __m256 y = _mm256_set1_ps(EXP_P0);
+      y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P1));
+      y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P2));
+      y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P3));
+      y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P4));
+      y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P5));
+      y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+      __m256i n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+      return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+    }
+
+    __attribute__((target("avx2,fma")))
+    static inline __m256 activate256(__m256 v, Activation activation, __m256 floor)
+    {
+      if (activation == RELU)
+        return _mm256_max_ps(v, floor);
+      if (activation == SIGMOID) {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        return _mm256_div_ps(one, _mm256_add_ps(one, exp256(_mm256_sub_ps(_mm256_setzero_ps(), v))));
+      }
+      return v;
+    }
+
+    __attribute__((target("avx2,fma")))
+    static inline void store256(float* dst, __m256 lo, __m256 hi, size_t valid)
+    {
+      if (valid == P) {
+        _mm256_storeu_ps(dst, lo);
+        _mm256_storeu_ps(dst + 8, hi);
+      } else {
+        alignas(32) float tmp[P];
+        _mm256_store_ps(tmp, lo);
+        _mm256_store_ps(tmp + 8, hi);
+        std::copy(tmp, tmp + valid, dst);
+      }
+    }
+
+    __attribute__((target("avx2,fma")))
+    static void denseAVX2Strided(const float* packed, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch, size_t inputStride, size_t outputStride)
+    {
+      const size_t panels = (rows + P - 1) / P;
+      for (size_t p = 0; p < panels; p++) {
+        const float* panel = packed + p * (cols + 2) * P;
+        const size_t valid = std::min(P, rows - p * P);
+        const __m256 bias_lo = _mm256_loadu_ps(panel);
+        const __m256 bias_hi = _mm256_loadu_ps(panel + 8);
+        const __m256 floor_lo = _mm256_loadu_ps(panel + P);
+        const __m256 floor_hi = _mm256_loadu_ps(panel + P + 8);
+        size_t j = 0;
+        for (; j + 4 <= batch; j += 4) {
+          const float* x0 = input + j * inputStride;
+          const float* x1 = x0 + inputStride;
+          const float* x2 = x1 + inputStride;
+          const float* x3 = x2 + inputStride;
+          __m256 a0 = bias_lo, b0 = bias_hi, a1 = bias_lo, b1 = bias_hi;
+          __m256 a2 = bias_lo, b2 = bias_hi, a3 = bias_lo, b3 = bias_hi;
+          for (size_t k = 0; k < cols; k++) {
+            const float* w = panel + (k + 2) * P;
+            const __m256 w_lo = _mm256_loadu_ps(w);
+            const __m256 w_hi = _mm256_loadu_ps(w + 8);
+            __m256 x = _mm256_broadcast_ss(x0 + k);
+            a0 = _mm256_fmadd_ps(w_lo, x, a0);
+            b0 = _mm256_fmadd_ps(w_hi, x, b0);
+            x = _mm256_broadcast_ss(x1 + k);
+            a1 = _mm256_fmadd_ps(w_lo, x, a1);
+            b1 = _mm256_fmadd_ps(w_hi, x, b1);
+            x = _mm256_broadcast_ss(x2 + k);
+            a2 = _mm256_fmadd_ps(w_lo, x, a2);
+            b2 = _mm256_fmadd_ps(w_hi, x, b2);
+            x = _mm256_broadcast_ss(x3 + k);
+            a3 = _mm256_fmadd_ps(w_lo, x, a3);
+            b3 = _mm256_fmadd_ps(w_hi, x, b3);
+          }
+          float* out = output + j * outputStride + p * P;
+          store256(out, activate256(a0, activation, floor_lo), activate256(b0, activation, floor_hi), valid);
+          store256(out + outputStride, activate256(a1, activation, floor_lo), activate256(b1, activation, floor_hi), valid);
+          store256(out + 2 * outputStride, activate256(a2, activation, floor_lo), activate256(b2, activation, floor_hi), valid);
+          store256(out + 3 * outputStride, activate256(a3, activation, floor_lo), activate256(b3, activation, floor_hi), valid);
+        }
+        for (; j < batch; j++) {
+          const float* x0 = input + j * inputStride;
+          // single columns split the input loop over two accumulator pairs
+          // to hide the FMA latency
+          __m256 a0 = bias_lo, b0 = bias_hi, a1 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps();
+          size_t k = 0;
+          for (; k + 2 <= cols; k += 2) {
+            const float* w = panel + (k + 2) * P;
+            const __m256 x = _mm256_broadcast_ss(x0 + k);
+            const __m256 y = _mm256_broadcast_ss(x0 + k + 1);
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(w), x, a0);
+            b0 = _mm256_fmadd_ps(_mm256_loadu_ps(w + 8), x, b0);
+            a1 = _mm256_fmadd_ps(_mm256_loadu_ps(w + P), y, a1);
+            b1 = _mm256_fmadd_ps(_mm256_loadu_ps(w + P + 8), y, b1);
+          }
+          if (k < cols) {
+            const float* w = panel + (k + 2) * P;
+            const __m256 x = _mm256_broadcast_ss(x0 + k);
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(w), x, a0);
+            b0 = _mm256_fmadd_ps(_mm256_loadu_ps(w + 8), x, b0);
+          }
+          a0 = _mm256_add_ps(a0, a1);
+          b0 = _mm256_add_ps(b0, b1);
+          store256(output + j * outputStride + p * P, activate256(a0, activation, floor_lo), activate256(b0, activation, floor_hi), valid);
+        }
+      }
+    }
+
+    __attribute__((target("avx2,fma")))
+    static void denseAVX2(const float* packed, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      denseAVX2Strided(packed, rows, cols, activation, input, output, batch, cols, rows);
+    }
+
+    __attribute__((target("avx2,fma")))
+    static void sparseAVX2(const float* sparse, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      const size_t panels = (rows + P - 1) / P;
+      const float* panel = sparse;
+      for (size_t p = 0; p < panels; p++) {
+        size_t blocks;
+        const uint32_t* indices;
+        const float* weights;
+        const float* next = sparsePanel(panel, blocks, indices, weights);
+        const size_t valid = std::min(P, rows - p * P);
+        const __m256 bias_lo = _mm256_loadu_ps(panel);
+        const __m256 bias_hi = _mm256_loadu_ps(panel + 8);
+        const __m256 floor_lo = _mm256_loadu_ps(panel + P);
+        const __m256 floor_hi = _mm256_loadu_ps(panel + P + 8);
+        size_t j = 0;
+        for (; j + 4 <= batch; j += 4) {
+          const float* x0 = input + j * cols;
+          const float* x1 = x0 + cols;
+          const float* x2 = x1 + cols;
+          const float* x3 = x2 + cols;
+          __m256 a0 = bias_lo, b0 = bias_hi, a1 = bias_lo, b1 = bias_hi;
+          __m256 a2 = bias_lo, b2 = bias_hi, a3 = bias_lo, b3 = bias_hi;
+          for (size_t b = 0; b < blocks; b++) {
+            const float* w = weights + b * P;
+            const size_t k = indices[b];
+            const __m256 w_lo = _mm256_loadu_ps(w);
+            const __m256 w_hi = _mm256_loadu_ps(w + 8);
+            __m256 x = _mm256_broadcast_ss(x0 + k);
+            a0 = _mm256_fmadd_ps(w_lo, x, a0);
+            b0 = _mm256_fmadd_ps(w_hi, x, b0);
+            x = _mm256_broadcast_ss(x1 + k);
+            a1 = _mm256_fmadd_ps(w_lo, x, a1);
+            b1 = _mm256_fmadd_ps(w_hi, x, b1);
+            x = _mm256_broadcast_ss(x2 + k);
+            a2 = _mm256_fmadd_ps(w_lo, x, a2);
+            b2 = _mm256_fmadd_ps(w_hi, x, b2);
+            x = _mm256_broadcast_ss(x3 + k);
+            a3 = _mm256_fmadd_ps(w_lo, x, a3);
+            b3 = _mm256_fmadd_ps(w_hi, x, b3);
+          }
+          float* out = output + j * rows + p * P;
+          store256(out, activate256(a0, activation, floor_lo), activate256(b0, activation, floor_hi), valid);
+          store256(out + rows, activate256(a1, activation, floor_lo), activate256(b1, activation, floor_hi), valid);
+          store256(out + 2 * rows, activate256(a2, activation, floor_lo), activate256(b2, activation, floor_hi), valid);
+          store256(out + 3 * rows, activate256(a3, activation, floor_lo), activate256(b3, activation, floor_hi), valid);
+        }
+        for (; j < batch; j++) {
+          const float* x0 = input + j * cols;
+          __m256 a0 = bias_lo, b0 = bias_hi, a1 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps();
+          size_t b = 0;
+          for (; b + 2 <= blocks; b += 2) {
+            const float* w = weights + b * P;
+            const __m256 x = _mm256_broadcast_ss(x0 + indices[b]);
+            const __m256 y = _mm256_broadcast_ss(x0 + indices[b + 1]);
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(w), x, a0);
+            b0 = _mm256_fmadd_ps(_mm256_loadu_ps(w + 8), x, b0);
+            a1 = _mm256_fmadd_ps(_mm256_loadu_ps(w + P), y, a1);
+            b1 = _mm256_fmadd_ps(_mm256_loadu_ps(w + P + 8), y, b1);
+          }
+          if (b < blocks) {
+            const float* w = weights + b * P;
+            const __m256 x = _mm256_broadcast_ss(x0 + indices[b]);
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(w), x, a0);
+            b0 = _mm256_fmadd_ps(_mm256_loadu_ps(w + 8), x, b0);
+          }
+          a0 = _mm256_add_ps(a0, a1);
+          b0 = _mm256_add_ps(b0, b1);
+          store256(output + j * rows + p * P, activate256(a0, activation, floor_lo), activate256(b0, activation, floor_hi), valid);
+        }
+        panel = next;
+      }
+    }
+
+    // gcc 12 reports the _mm512_undefined_* operands of unmasked AVX-512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+    /*
+     * AVX-512 kernel: a panel fills one register and eight batch columns are
+     * processed together. Partial panels are written with masked stores.
+     */
+    __attribute__((target("avx512f")))
+    static inline __m512 exp512(__m512 x)
+    {
+      x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_LO)), _mm512_set1_ps(EXP_HI));
+      __m512 fx = _mm512_floor_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(LOG2E), _mm512_set1_ps(0.5f)));
+      x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(LN2_HI), x);
+      x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(LN2_LO), x);
+      __m512 y = _mm512_set1_ps(EXP_P0);
+      y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P1));
+      y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P2));
+      y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P3));
+      y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P4));
+      y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P5));
+      y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+      return _mm512_scalef_ps(y, fx);
+    }
+
+    __attribute__((target("avx512f")))
+    static inline __m512 activate512(__m512 v, Activation activation, __m512 floor)
+    {
+      if (activation == RELU)
+        return _mm512_max_ps(v, floor);
+      if (activation == SIGMOID) {
+        const __m512 one = _mm512_set1_ps(1.0f);
+        return _mm512_div_ps(one, _mm512_add_ps(one, exp512(_mm512_sub_ps(_mm512_setzero_ps(), v))));
+      }
+      return v;
+    }
+
+    __attribute__((target("avx512f")))
+    static void denseAVX512Strided(const float* packed, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch, size_t inputStride, size_t outputStride)
+    {
+      const size_t panels = (rows + P - 1) / P;
+      for (size_t p = 0; p < panels; p++) {
+        const float* panel = packed + p * (cols + 2) * P;
+        const size_t valid = std::min(P, rows - p * P);
+        const __mmask16 mask = (__mmask16)((1u << valid) - 1);
+        const __m512 bias = _mm512_loadu_ps(panel);
+        const __m512 floor = _mm512_loadu_ps(panel + P);
+        size_t j = 0;
+        for (; j + 8 <= batch; j += 8) {
+          const float* x = input + j * inputStride;
+          __m512 acc[8];
+          #pragma GCC unroll 8
+          for (size_t c = 0; c < 8; c++)
+            acc[c] = bias;
+          for (size_t k = 0; k < cols; k++) {
+            const __m512 w = _mm512_loadu_ps(panel + (k + 2) * P);
+            #pragma GCC unroll 8
+            for (size_t c = 0; c < 8; c++)
+              acc[c] = _mm512_fmadd_ps(w, _mm512_set1_ps(x[c * inputStride + k]), acc[c]);
+          }
+          float* out = output + j * outputStride + p * P;
+          #pragma GCC unroll 8
+          for (size_t c = 0; c < 8; c++)
+            _mm512_mask_storeu_ps(out + c * outputStride, mask, activate512(acc[c], activation, floor));
+        }
+        for (; j < batch; j++) {
+          const float* x = input + j * inputStride;
+          // single columns split the input loop over four accumulators
+          // to hide the FMA latency
+          __m512 acc[4] = { bias, _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps() };
+          size_t k = 0;
+          for (; k + 4 <= cols; k += 4) {
+#pragma GCC unroll 4
+            for (size_t u = 0; u < 4; u++)
+              acc[u] = _mm512_fmadd_ps(_mm512_loadu_ps(panel + (k + u + 2) * P), _mm512_set1_ps(x[k + u]), acc[u]);
+          }
+          for (; k < cols; k++)
+            acc[0] = _mm512_fmadd_ps(_mm512_loadu_ps(panel + (k + 2) * P), _mm512_set1_ps(x[k]), acc[0]);
+          acc[0] = _mm512_add_ps(_mm512_add_ps(acc[0], acc[1]), _mm512_add_ps(acc[2], acc[3]));
+          _mm512_mask_storeu_ps(output + j * outputStride + p * P, mask, activate512(acc[0], activation, floor));
+        }
+      }
+    }
+
+    __attribute__((target("avx512f")))
+    static void denseAVX512(const float* packed, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      denseAVX512Strided(packed, rows, cols, activation, input, output, batch, cols, rows);
+    }
+
+    __attribute__((target("avx512f")))
+    static void sparseAVX512(const float* sparse, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      const size_t panels = (rows + P - 1) / P;
+      const float* panel = sparse;
+      for (size_t p = 0; p < panels; p++) {
+        size_t blocks;
+        const uint32_t* indices;
+        const float* weights;
+        const float* next = sparsePanel(panel, blocks, indices, weights);
+        const size_t valid = std::min(P, rows - p * P);
+        const __mmask16 mask = (__mmask16)((1u << valid) - 1);
+        const __m512 bias = _mm512_loadu_ps(panel);
+        const __m512 floor = _mm512_loadu_ps(panel + P);
+        size_t j = 0;
+        for (; j + 8 <= batch; j += 8) {
+          const float* x = input + j * cols;
+          __m512 acc[8];
+          #pragma GCC unroll 8
+          for (size_t c = 0; c < 8; c++)
+            acc[c] = bias;
+          for (size_t b = 0; b < blocks; b++) {
+            const __m512 w = _mm512_loadu_ps(weights + b * P);
+            const size_t k = indices[b];
+            #pragma GCC unroll 8
+            for (size_t c = 0; c < 8; c++)
+              acc[c] = _mm512_fmadd_ps(w, _mm512_set1_ps(x[c * cols + k]), acc[c]);
+          }
+          float* out = output + j * rows + p * P;
+          #pragma GCC unroll 8
+          for (size_t c = 0; c < 8; c++)
+            _mm512_mask_storeu_ps(out + c * rows, mask, activate512(acc[c], activation, floor));
+        }
+        for (; j < batch; j++) {
+          const float* x = input + j * cols;
+          __m512 acc[4] = { bias, _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps() };
+          size_t b = 0;
+          for (; b + 4 <= blocks; b += 4) {
+#pragma GCC unroll 4
+            for (size_t u = 0; u < 4; u++)
+              acc[u] = _mm512_fmadd_ps(_mm512_loadu_ps(weights + (b + u) * P), _mm512_set1_ps(x[indices[b + u]]), acc[u]);
+          }
+          for (; b < blocks; b++)
+            acc[0] = _mm512_fmadd_ps(_mm512_loadu_ps(weights + b * P), _mm512_set1_ps(x[indices[b]]), acc[0]);
+          acc[0] = _mm512_add_ps(_mm512_add_ps(acc[0], acc[1]), _mm512_add_ps(acc[2], acc[3]));
+          _mm512_mask_storeu_ps(output + j * rows + p * P, mask, activate512(acc[0], activation, floor));
+        }
+        panel = next;
+      }
+    }
+
+    /*
+     * AVX-512 VNNI kernel: vpdpbusd multiplies four unsigned input bytes with
+     * four signed weight bytes per row and accumulates in 32 bit, so one
+     * instruction covers a whole panel for four inputs. Up to four batch
+     * columns are quantized and processed together.
+     */
+    __attribute__((target("avx512f,avx512vnni")))
+    static inline __m512i broadcastGroup(const uint8_t* q)
+    {
+      int32_t group;
+      std::memcpy(&group, q, sizeof(group));
+      return _mm512_set1_epi32(group);
+    }
+
+    __attribute__((target("avx512f,avx512vnni")))
+    static inline void quantizeInput512(const float* x, size_t cols, float scale, uint8_t* q)
+    {
+      const __m512 s = _mm512_set1_ps(scale);
+      const __m512i lo = _mm512_set1_epi32(-127), hi = _mm512_set1_epi32(127), offset = _mm512_set1_epi32(128);
+      const size_t padded = quantizedGroups(cols) * GROUP;
+      for (size_t k = 0; k < padded; k += 16) {
+        const __mmask16 load = k + 16 <= cols ? (__mmask16)0xffff : k < cols ? (__mmask16)((1u << (cols - k)) - 1) : 0;
+        const __mmask16 store = k + 16 <= padded ? (__mmask16)0xffff : (__mmask16)((1u << (padded - k)) - 1);
+        __m512i v = _mm512_cvtps_epi32(_mm512_mul_ps(_mm512_maskz_loadu_ps(load, x + k), s));
+        v = _mm512_add_epi32(_mm512_min_epi32(_mm512_max_epi32(v, lo), hi), offset);
+        _mm512_mask_cvtepi32_storeu_epi8(q + k, store, v);
+      }
+    }
+
+    __attribute__((target("avx512f,avx512vnni")))
+    static void quantizedVNNI(const uint8_t* quantized, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      const size_t groups = quantizedGroups(cols);
+      const size_t stride = groups * GROUP;
+      const size_t panels = (rows + P - 1) / P;
+      const float inputScale = quantizedInputScale(quantized);
+      thread_local std::vector<uint8_t> q;
+      q.resize(4 * stride);
+      for (size_t j = 0; j < batch; j += 4) {
+        const size_t columns = std::min<size_t>(4, batch - j);
+        for (size_t c = 0; c < columns; c++)
+          quantizeInput512(input + (j + c) * cols, cols, inputScale, q.data() + c * stride);
+        for (size_t p = 0; p < panels; p++) {
+          const uint8_t* panel = quantized + QUANTIZED_HEADER + p * quantizedPanelSize(cols);
+          const uint8_t* w = panel + 3 * P * sizeof(float);
+          const size_t valid = std::min(P, rows - p * P);
+          const __mmask16 mask = (__mmask16)((1u << valid) - 1);
+          __m512i acc[4] = { _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512() };
+          if (columns == 4) {
+            for (size_t g = 0; g < groups; g++) {
+              const __m512i wg = _mm512_loadu_si512(w + g * GROUP * P);
+#pragma GCC unroll 4
+              for (size_t c = 0; c < 4; c++)
+                acc[c] = _mm512_dpbusd_epi32(acc[c], broadcastGroup(q.data() + c * stride + g * GROUP), wg);
+            }
+          } else {
+            // remaining columns alternate two accumulators to hide the latency
+            for (size_t c = 0; c < columns; c++) {
+              __m512i odd = _mm512_setzero_si512();
+              size_t g = 0;
+              for (; g + 2 <= groups; g += 2) {
+                acc[c] = _mm512_dpbusd_epi32(acc[c], broadcastGroup(q.data() + c * stride + g * GROUP),
+                    _mm512_loadu_si512(w + g * GROUP * P));
+                odd = _mm512_dpbusd_epi32(odd, broadcastGroup(q.data() + c * stride + (g + 1) * GROUP),
+                    _mm512_loadu_si512(w + (g + 1) * GROUP * P));
+              }
+              if (g < groups)
+                acc[c] = _mm512_dpbusd_epi32(acc[c], broadcastGroup(q.data() + c * stride + g * GROUP),
+                    _mm512_loadu_si512(w + g * GROUP * P));
+              acc[c] = _mm512_add_epi32(acc[c], odd);
+            }
+          }
+          const __m512 scale = _mm512_loadu_ps(reinterpret_cast<const float*>(panel));
+          const __m512 bias = _mm512_loadu_ps(reinterpret_cast<const float*>(panel) + P);
+          const __m512i correction = _mm512_loadu_si512(panel + 2 * P * sizeof(float));
+          for (size_t c = 0; c < columns; c++) {
+            const __m512 values = _mm512_fmadd_ps(_mm512_cvtepi32_ps(_mm512_sub_epi32(acc[c], correction)), scale, bias);
+            _mm512_mask_storeu_ps(output + (j + c) * rows + p * P, mask, activate512(values, activation, _mm512_setzero_ps()));
+          }
+        }
+      }
+    }
+
+    /*
+     * AVX2 kernel without 8 bit dot products: vpmaddubsw multiplies |x| with w
+     * carrying the sign of x, which stays below the int16 saturation for inputs
+     * and weights in [-127, 127], and vpmaddwd sums the pairs to 32 bit.
+     * Works on signed inputs, so no zero point correction is needed.
+     * A panel is held in two registers, up to four batch columns are processed together.
+     */
+    // quantizeInput with AVX2, signed (without the shift by 128) for the vpmaddubsw kernel
+    __attribute__((target("avx2,fma")))
+    static inline void quantizeInput256(const float* x, size_t cols, float scale, uint8_t* q, bool shift)
+    {
+      const __m256 s = _mm256_set1_ps(scale);
+      const __m256i lo = _mm256_set1_epi32(-127), hi = _mm256_set1_epi32(127);
+      const __m256i offset = _mm256_set1_epi32(shift ? 128 : 0);
+      size_t k = 0;
+      for (; k + 8 <= cols; k += 8) {
+        __m256i v = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(x + k), s));
+        v = _mm256_add_epi32(_mm256_min_epi32(_mm256_max_epi32(v, lo), hi), offset);
+        // the low four bytes of each lane hold its four values
+        const __m256i words = _mm256_packs_epi32(v, v);
+        const __m256i bytes = shift ? _mm256_packus_epi16(words, words) : _mm256_packs_epi16(words, words);
+        const int32_t low = _mm256_cvtsi256_si32(bytes), high = _mm256_extract_epi32(bytes, 4);
+        std::memcpy(q + k, &low, sizeof(low));
+        std::memcpy(q + k + 4, &high, sizeof(high));
+      }
+      for (; k < cols; k++)
+        q[k] = (uint8_t)(std::lrint(std::max(-127.0f, std::min(127.0f, x[k] * scale))) + (shift ? 128 : 0));
+      std::fill(q + cols, q + quantizedGroups(cols) * GROUP, shift ? 128 : 0);
+    }
+
+    __attribute__((target("avx2,fma")))
+    static inline __m256 quantizedOutput256(__m256i acc, const uint8_t* panel, size_t half, Activation activation)
+    {
+      const float* values = reinterpret_cast<const float*>(panel);
+      return activate256(_mm256_fmadd_ps(_mm256_cvtepi32_ps(acc), _mm256_loadu_ps(values + 8 * half),
+          _mm256_loadu_ps(values + P + 8 * half)), activation, _mm256_setzero_ps());
+    }
+
+    __attribute__((target("avx2,fma")))
+    static void quantizedAVX2(const uint8_t* quantized, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      const size_t groups = quantizedGroups(cols);
+      const size_t stride = groups * GROUP;
+      const size_t panels = (rows + P - 1) / P;
+      const float inputScale = quantizedInputScale(quantized);
+      const __m256i ones = _mm256_set1_epi16(1);
+      thread_local std::vector<uint8_t> q;
+      q.resize(4 * stride);
+      for (size_t j = 0; j < batch; j += 4) {
+        const size_t columns = std::min<size_t>(4, batch - j);
+        for (size_t c = 0; c < columns; c++)
+          quantizeInput256(input + (j + c) * cols, cols, inputScale, q.data() + c * stride, false);
+        for (size_t p = 0; p < panels; p++) {
+          const uint8_t* panel = quantized + QUANTIZED_HEADER + p * quantizedPanelSize(cols);
+          const uint8_t* w = panel + 3 * P * sizeof(float);
+          const size_t valid = std::min(P, rows - p * P);
+          __m256i lo[4], hi[4];
+          for (size_t c = 0; c < 4; c++)
+            lo[c] = hi[c] = _mm256_setzero_si256();
+          for (size_t g = 0; g < groups; g++) {
+            const __m256i w_lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + g * GROUP * P));
+            const __m256i w_hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + g * GROUP * P + 32));
+            for (size_t c = 0; c < columns; c++) {
+              int32_t group;
+              std::memcpy(&group, q.data() + c * stride + g * GROUP, sizeof(group));
+              const __m256i x = _mm256_set1_epi32(group);
+              const __m256i ax = _mm256_abs_epi8(x);
+              lo[c] = _mm256_add_epi32(lo[c], _mm256_madd_epi16(_mm256_maddubs_epi16(ax, _mm256_sign_epi8(w_lo, x)), ones));
+              hi[c] = _mm256_add_epi32(hi[c], _mm256_madd_epi16(_mm256_maddubs_epi16(ax, _mm256_sign_epi8(w_hi, x)), ones));
+            }
+          }
+          for (size_t c = 0; c < columns; c++)
+            store256(output + (j + c) * rows + p * P, quantizedOutput256(lo[c], panel, 0, activation),
+                quantizedOutput256(hi[c], panel, 1, activation), valid);
+        }
+      }
+    }
+
+#ifdef PUSH_PREDICTION_AVXVNNI_KERNEL
+    /*
+     * AVX-VNNI kernel: the 256 bit vpdpbusd of CPUs without AVX-512 VNNI, on the
+     * unsigned inputs with the zero point correction like the AVX-512 kernel.
+     */
+    __attribute__((target("avx2,fma,avxvnni")))
+    static void quantizedAVXVNNI(const uint8_t* quantized, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      const size_t groups = quantizedGroups(cols);
+      const size_t stride = groups * GROUP;
+      const size_t panels = (rows + P - 1) / P;
+      const float inputScale = quantizedInputScale(quantized);
+      thread_local std::vector<uint8_t> q;
+      q.resize(4 * stride);
+      for (size_t j = 0; j < batch; j += 4) {
+        const size_t columns = std::min<size_t>(4, batch - j);
+        for (size_t c = 0; c < columns; c++)
+          quantizeInput256(input + (j + c) * cols, cols, inputScale, q.data() + c * stride, true);
+        for (size_t p = 0; p < panels; p++) {
+          const uint8_t* panel = quantized + QUANTIZED_HEADER + p * quantizedPanelSize(cols);
+          const uint8_t* w = panel + 3 * P * sizeof(float);
+          const size_t valid = std::min(P, rows - p * P);
+          __m256i lo[4], hi[4];
+          for (size_t c = 0; c < 4; c++)
+            lo[c] = hi[c] = _mm256_setzero_si256();
+          for (size_t g = 0; g < groups; g++) {
+            const __m256i w_lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + g * GROUP * P));
+            const __m256i w_hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + g * GROUP * P + 32));
+            for (size_t c = 0; c < columns; c++) {
+              int32_t group;
+              std::memcpy(&group, q.data() + c * stride + g * GROUP, sizeof(group));
+              const __m256i x = _mm256_set1_epi32(group);
+              lo[c] = _mm256_dpbusd_avx_epi32(lo[c], x, w_lo);
+              hi[c] = _mm256_dpbusd_avx_epi32(hi[c], x, w_hi);
+            }
+          }
+          const __m256i* correction = reinterpret_cast<const __m256i*>(panel + 2 * P * sizeof(float));
+          const __m256i correction_lo = _mm256_loadu_si256(correction);
+          const __m256i correction_hi = _mm256_loadu_si256(correction + 1);
+          for (size_t c = 0; c < columns; c++)
+            store256(output + (j + c) * rows + p * P, quantizedOutput256(_mm256_sub_epi32(lo[c], correction_lo), panel, 0, activation),
+                quantizedOutput256(_mm256_sub_epi32(hi[c], correction_hi), panel, 1, activation), valid);
+        }
+      }
+    }
+#endif
+
+#pragma GCC diagnostic pop
+#endif
+
+#ifdef PUSH_PREDICTION_NEON_KERNELS
+    /*
+     * NEON kernel: a panel is held in four registers and two batch columns
+     * are processed together.
+     */
+    static inline float32x4_t exp128(float32x4_t x)
+    {
+      x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(EXP_LO)), vdupq_n_f32(EXP_HI));
+      float32x4_t fx = vrndmq_f32(vfmaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(LOG2E)));
+      x = vfmsq_f32(x, fx, vdupq_n_f32(LN2_HI));
+      x = vfmsq_f32(x, fx, vdupq_n_f32(LN2_LO));
+      float32x4_t y = vdupq_n_f32(EXP_P0);
+      y = vfmaq_f32(vdupq_n_f32(EXP_P1), y, x);
+      y = vfmaq_f32(vdupq_n_f32(EXP_P2), y, x);
+      y = vfmaq_f32(vdupq_n_f32(EXP_P3), y, x);
+      y = vfmaq_f32(vdupq_n_f32(EXP_P4), y, x);
+      y = vfmaq_f32(vdupq_n_f32(EXP_P5), y, x);
+      y = vfmaq_f32(vaddq_f32(x, vdupq_n_f32(1.0f)), y, vmulq_f32(x, x));
+      int32x4_t n = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(fx), vdupq_n_s32(127)), 23);
+      return vmulq_f32(y, vreinterpretq_f32_s32(n));
+    }
+
+    static inline float32x4_t activate128(float32x4_t v, Activation activation, float32x4_t floor)
+    {
+      if (activation == RELU)
+        return vmaxq_f32(v, floor);
+      if (activation == SIGMOID) {
+        const float32x4_t one = vdupq_n_f32(1.0f);
+        return vdivq_f32(one, vaddq_f32(one, exp128(vnegq_f32(v))));
+      }
+      return v;
+    }
+
+    static inline void store128(float* dst, const float32x4_t* acc, Activation activation, const float* floor,
+        size_t valid)
+    {
+      float tmp[P];
+      for (size_t i = 0; i < P / 4; i++)
+        vst1q_f32(tmp + 4 * i, activate128(acc[i], activation, vld1q_f32(floor + 4 * i)));
+      std::copy(tmp, tmp + valid, dst);
+    }
+
+    static void denseNEONStrided(const float* packed, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch, size_t inputStride, size_t outputStride)
+    {
+      const size_t panels = (rows + P - 1) / P;
+      for (size_t p = 0; p < panels; p++) {
+        const float* panel = packed + p * (cols + 2) * P;
+        const size_t valid = std::min(P, rows - p * P);
+        size_t j = 0;
+        for (; j + 2 <= batch; j += 2) {
+          const float* x0 = input + j * inputStride;
+          const float* x1 = x0 + inputStride;
+          float32x4_t a[P / 4], b[P / 4];
+          for (size_t i = 0; i < P / 4; i++)
+            a[i] = b[i] = vld1q_f32(panel + 4 * i);
+          for (size_t k = 0; k < cols; k++) {
+            const float* w = panel + (k + 2) * P;
+            for (size_t i = 0; i < P / 4; i++) {
+              const float32x4_t wi = vld1q_f32(w + 4 * i);
+              a[i] = vfmaq_n_f32(a[i], wi, x0[k]);
+              b[i] = vfmaq_n_f32(b[i], wi, x1[k]);
+            }
+          }
+          store128(output + j * outputStride + p * P, a, activation, panel + P, valid);
+          store128(output + (j + 1) * outputStride + p * P, b, activation, panel + P, valid);
+        }
+        for (; j < batch; j++) {
+          const float* x0 = input + j * inputStride;
+          float32x4_t a[P / 4];
+          for (size_t i = 0; i < P / 4; i++)
+            a[i] = vld1q_f32(panel + 4 * i);
+          for (size_t k = 0; k < cols; k++) {
+            const float* w = panel + (k + 2) * P;
+            for (size_t i = 0; i < P / 4; i++)
+              a[i] = vfmaq_n_f32(a[i], vld1q_f32(w + 4 * i), x0[k]);
+          }
+          store128(output + j * outputStride + p * P, a, activation, panel + P, valid);
+        }
+      }
+    }
+
+    static void denseNEON(const float* packed, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      denseNEONStrided(packed, rows, cols, activation, input, output, batch, cols, rows);
+    }
+
+#ifdef PUSH_PREDICTION_NEON_DOT_KERNEL
+    /*
+     * NEON dot-product kernel: sdot multiplies four signed input bytes with four
+     * signed weight bytes per row, so a panel takes four instructions per group.
+     * Works on signed inputs, so no zero point correction is needed.
+     */
+    __attribute__((target("+dotprod")))
+    static void quantizedNEON(const uint8_t* quantized, size_t rows, size_t cols, Activation activation,
+        const float* input, float* output, size_t batch)
+    {
+      const size_t groups = quantizedGroups(cols);
+      const size_t panels = (rows + P - 1) / P;
+      const float inputScale = quantizedInputScale(quantized);
+      thread_local std::vector<uint8_t> q;
+      q.resize(groups * GROUP);
+      for (size_t j = 0; j < batch; j++) {
+        // signed inputs: remove the shift of the unsigned quantization
+        quantizeInput(input + j * cols, cols, inputScale, q.data());
+        for (size_t k = 0; k < q.size(); k++)
+          q[k] ^= 0x80;
+        for (size_t p = 0; p < panels; p++) {
+          const uint8_t* panel = quantized + QUANTIZED_HEADER + p * quantizedPanelSize(cols);
+          const int8_t* w = reinterpret_cast<const int8_t*>(panel + 3 * P * sizeof(float));
+          const size_t valid = std::min(P, rows - p * P);
+          int32x4_t acc[P / 4];
+          for (size_t i = 0; i < P / 4; i++)
+            acc[i] = vdupq_n_s32(0);
+          for (size_t g = 0; g < groups; g++) {
+            int32_t group;
+            std::memcpy(&group, q.data() + g * GROUP, sizeof(group));
+            const int8x16_t x = vreinterpretq_s8_s32(vdupq_n_s32(group));
+            for (size_t i = 0; i < P / 4; i++)
+              acc[i] = vdotq_s32(acc[i], vld1q_s8(w + g * GROUP * P + 16 * i), x);
+          }
+          const float* scale = reinterpret_cast<const float*>(panel);
+          float32x4_t values[P / 4];
+          for (size_t i = 0; i < P / 4; i++)
+            values[i] = vfmaq_f32(vld1q_f32(scale + P + 4 * i), vcvtq_f32_s32(acc[i]), vld1q_f32(scale + 4 * i));
+          const float zero[P] = {};
+          store128(output + j * rows + p * P, values, activation, zero, valid);
+        }
+      }
+    }
+#endif
+#endif
+
+    static std::vector<DenseKernel> detectKernels()
+    {
+      std::vector<DenseKernel> kernels;
+#ifdef PUSH_PREDICTION_X86_KERNELS
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f"))
+        kernels.push_back({"avx512", &denseAVX512, &sparseAVX512, &denseAVX512Strided});
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        kernels.push_back({"avx2", &denseAVX2, &sparseAVX2, &denseAVX2Strided});
+#endif
+#ifdef PUSH_PREDICTION_NEON_KERNELS
+      // the generic sparse kernel compiles to NEON
+      kernels.push_back({"neon", &denseNEON, &sparseGeneric, &denseNEONStrided});
+#endif
+      kernels.push_back({"generic", &denseGeneric, &sparseGeneric, &denseGenericStrided});
+      return kernels;
+    }
+
+    const std::vector<DenseKernel>& availableKernels()
+    {
+      static const std::vector<DenseKernel> kernels = detectKernels();
+      return kernels;
+    }
+
+    const DenseKernel* findKernel(const std::string& name)
+    {
+      for (const DenseKernel& kernel : availableKernels()) {
+        if (name == kernel.name)
+          return &kernel;
+      }
+      return nullptr;
+    }
+
+    static std::vector<QuantizedDenseKernel> detectQuantizedKernels()
+    {
+      std::vector<QuantizedDenseKernel> kernels;
+#ifdef PUSH_PREDICTION_X86_KERNELS
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vnni"))
+        kernels.push_back({"vnni", &quantizedVNNI});
+#ifdef PUSH_PREDICTION_AVXVNNI_KERNEL
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("avxvnni"))
+        kernels.push_back({"avxvnni", &quantizedAVXVNNI});
+#endif
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        kernels.push_back({"avx2", &quantizedAVX2});
+#endif
+#ifdef PUSH_PREDICTION_NEON_DOT_KERNEL
+      if (getauxval(AT_HWCAP) & HWCAP_ASIMDDP)
+        kernels.push_back({"neon", &quantizedNEON});
+#endif
+      kernels.push_back({"generic", &quantizedGeneric});
+      return kernels;
+    }
+
+    const std::vector<QuantizedDenseKernel>& availableQuantizedKernels()
+    {
+      static const std::vector<QuantizedDenseKernel> kernels = detectQuantizedKernels();
+      return kernels;
+    }
+
+    const QuantizedDenseKernel* findQuantizedKernel(const std::string& name)
+    {
+      for (const QuantizedDenseKernel& kernel : availableQuantizedKernels()) {
+        if (name == kernel.name)
+          return &kernel;
+      }
+      return nullptr;
+    }
+
+    const QuantizedDenseKernel* defaultQuantizedKernel()
+    {
+      const char* name = std::getenv("PUSH_PREDICTION_QUANTIZED_KERNEL");
+      const QuantizedDenseKernel* kernel = name ? findQuantizedKernel(name) : nullptr;
+      return kernel ? kernel : &availableQuantizedKernels().front();
+    }
+
+    const DenseKernel* defaultKernel()
+    {
+      const char* name = std::getenv("PUSH_PREDICTION_KERNEL");
+      if (name && std::string(name) == "eigen")
+        return nullptr;
+      const DenseKernel* kernel = name ? findKernel(name) : nullptr;
+      return kernel ? kernel : &availableKernels().front();
+    }
+  }
+}
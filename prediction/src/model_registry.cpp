@@ -0,0 +1,103 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+
+/* Author: Lars Henning Kayser */
+
+#include <push_prediction/model_registry.h>
+
+namespace push_prediction {
+
+    ModelRegistry& ModelRegistry::instance()
+    {
+        static ModelRegistry registry;
+        return registry;
+    }
+
+    std::shared_ptr<const NeuralNetwork> ModelRegistry::get(const std::string& model_file, const Setup& setup)
+    {
+        // loading happens under the lock, so concurrent first requests load the model once
+        std::lock_guard<std::mutex> lock(mutex_);
+        return load(model_file, setup);
+    }
+
+    std::shared_ptr<const NeuralNetwork> ModelRegistry::getEnsemble(const std::vector<std::string>& model_files,
+            const Setup& setup)
+    {
+        std::string key = "ensemble";
+        for (const std::string& model_file : model_files)
+            key += ":" + model_file;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = networks_.find(key);
+        if (it != networks_.end())
+            return it->second;
+
+        // the members are registered as well, so their models are loaded once
+        std::vector<std::shared_ptr<const NeuralNetwork>> members;
+        for (const std::string& model_file : model_files)
+            members.push_back(load(model_file, setup));
+        auto network = std::make_shared<NeuralNetwork>();
+        network->stack(members);
+        if (setup)
+            setup(*network);
+        networks_[key] = network;
+        return network;
+    }
+
+    std::shared_ptr<const NeuralNetwork> ModelRegistry::load(const std::string& model_file, const Setup& setup)
+    {
+        auto it = networks_.find(model_file);
+        if (it != networks_.end())
+            return it->second;
+
+        auto network = std::make_shared<NeuralNetwork>();
+        network->load(model_file);
+        if (setup)
+            setup(*network);
+        networks_[model_file] = network;
+        return network;
+    }
+
+    bool ModelRegistry::contains(const std::string& model_file)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return networks_.count(model_file) > 0;
+    }
+
+    void ModelRegistry::clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        networks_.clear();
+    }
+}
@@ -0,0 +1,204 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+#include <push_prediction/prediction_cache.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace push_prediction {
+
+    static size_t roundCapacity(size_t capacity)
+    {
+        size_t rounded = PredictionCache::WINDOW;
+        while (rounded < capacity)
+            rounded *= 2;
+        return rounded;
+    }
+
+    PredictionCache::PredictionCache(size_t capacity, double resolution)
+        : resolution_(resolution), mask_(roundCapacity(capacity) - 1), slots_(new Slot[mask_ + 1]()),
+          clock_(0), hits_(0), misses_(0), insertions_(0), evictions_(0), dropped_(0)
+    {
+    }
+
+    bool PredictionCache::quantize(const float* values, size_t size, Key& key) const
+    {
+        key.fill(0);
+        for (size_t i = 0; i < size && i < KEY_SIZE; i++) {
+            const double cell = std::floor(values[i] / resolution_);
+            // also rejects NaN
+            if (!(std::fabs(cell) < 2147483647.0))
+                return false;
+            key[i] = static_cast<int32_t>(cell);
+        }
+        return true;
+    }
+
+    size_t PredictionCache::window(const Key& key) const
+    {
+        uint64_t hash = 0;
+        for (int32_t k : key)
+            hash = (hash ^ static_cast<uint32_t>(k)) * 0x9e3779b97f4a7c15ull;
+        return (hash ^ (hash >> 32)) & mask_;
+    }
+
+    bool PredictionCache::lookup(const Key& key, float* value) const
+    {
+        const size_t start = window(key);
+        for (size_t i = 0; i < WINDOW; i++) {
+            Slot& slot = slots_[(start + i) & mask_];
+            const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence & 1)
+                continue;
+            const uint32_t used = slot.used.load(std::memory_order_relaxed);
+            // keys are never removed, so the key is not stored beyond an empty slot
+            if (used == 0)
+                break;
+            bool match = true;
+            for (size_t k = 0; k < KEY_SIZE; k++)
+                match &= slot.key[k].load(std::memory_order_relaxed) == key[k];
+            if (!match)
+                continue;
+            float copy[VALUE_SIZE];
+            for (size_t v = 0; v < VALUE_SIZE; v++)
+                copy[v] = slot.value[v].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+                break;
+            std::copy(copy, copy + VALUE_SIZE, value);
+            // only touch the cache line if the entry was not used since the last insertion,
+            // and only if the slot was not cleared or replaced since it was read (an unconditional
+            // store could mark a cleared slot as used again)
+            uint32_t expected = used;
+            const uint32_t now = clock_.load(std::memory_order_relaxed);
+            if (used != now)
+                slot.used.compare_exchange_strong(expected, now, std::memory_order_relaxed);
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void PredictionCache::insert(const Key& key, const float* value)
+    {
+        if (writing_.test_and_set(std::memory_order_acquire)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        // skip 0, which marks empty slots
+        uint32_t now = clock_.load(std::memory_order_relaxed) + 1;
+        if (now == 0)
+            now = 1;
+        clock_.store(now, std::memory_order_relaxed);
+
+        // the slot of the key, the first empty slot or the least recently used one
+        const size_t start = window(key);
+        Slot* target = nullptr;
+        uint32_t oldest = 0;
+        bool evict = true;
+        for (size_t i = 0; i < WINDOW; i++) {
+            Slot& slot = slots_[(start + i) & mask_];
+            const uint32_t used = slot.used.load(std::memory_order_relaxed);
+            if (used == 0) {
+                target = &slot;
+                evict = false;
+                break;
+            }
+            bool match = true;
+            for (size_t k = 0; k < KEY_SIZE; k++)
+                match &= slot.key[k].load(std::memory_order_relaxed) == key[k];
+            if (match) {
+                target = &slot;
+                evict = false;
+                break;
+            }
+            const uint32_t age = now - used;
+            if (!target || age > oldest) {
+                target = &slot;
+                oldest = age;
+            }
+        }
+
+        const uint32_t sequence = target->sequence.load(std::memory_order_relaxed);
+        target->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t k = 0; k < KEY_SIZE; k++)
+            target->key[k].store(key[k], std::memory_order_relaxed);
+        for (size_t v = 0; v < VALUE_SIZE; v++)
+            target->value[v].store(value[v], std::memory_order_relaxed);
+        target->used.store(now, std::memory_order_relaxed);
+        target->sequence.store(sequence + 2, std::memory_order_release);
+
+        insertions_.fetch_add(1, std::memory_order_relaxed);
+        if (evict)
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        writing_.clear(std::memory_order_release);
+    }
+
+    void PredictionCache::clear()
+    {
+        while (writing_.test_and_set(std::memory_order_acquire))
+            ;
+        for (size_t i = 0; i <= mask_; i++) {
+            Slot& slot = slots_[i];
+            const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+            slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.used.store(0, std::memory_order_relaxed);
+            slot.sequence.store(sequence + 2, std::memory_order_release);
+        }
+        hits_.store(0, std::memory_order_relaxed);
+        misses_.store(0, std::memory_order_relaxed);
+        insertions_.store(0, std::memory_order_relaxed);
+        evictions_.store(0, std::memory_order_relaxed);
+        dropped_.store(0, std::memory_order_relaxed);
+        writing_.clear(std::memory_order_release);
+    }
+
+    PredictionCache::Statistics PredictionCache::statistics() const
+    {
+        Statistics statistics;
+        statistics.hits = hits_.load(std::memory_order_relaxed);
+        statistics.misses = misses_.load(std::memory_order_relaxed);
+        statistics.insertions = insertions_.load(std::memory_order_relaxed);
+        statistics.evictions = evictions_.load(std::memory_order_relaxed);
+        statistics.dropped = dropped_.load(std::memory_order_relaxed);
+        statistics.capacity = capacity();
+        for (size_t i = 0; i <= mask_; i++)
+            statistics.size += slots_[i].used.load(std::memory_order_relaxed) != 0;
+        return statistics;
+    }
+}
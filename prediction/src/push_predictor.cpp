@@ -33,87 +33,595 @@
 
 
 #include <ros/ros.h>
+#include <array>
 #include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sys/stat.h>
 #include <push_prediction/push_predictor.h>
+#include <push_prediction/model_registry.h>
+
+#ifdef PUSH_PREDICTION_STATIC_MODEL
+#include <push_prediction/generated/model_with_distance.h>
+#endif
 
 namespace push_prediction {
 
+    // the affine part of the input normalization and the output denormalization
+    // are folded into the network by the constructor
     void PushPredictor::normalizePushInput(const tams_ur5_push_msgs::Push& push, Eigen::VectorXf& input_vec) const
     {
         input_vec.resize(4);
-        input_vec(0) =  (0.081 + push.approach.point.x ) / 0.162;
-        input_vec(1) = (0.115 + push.approach.point.y ) / 0.23;
-        input_vec(2) = std::fmod(tf::getYaw(push.approach.normal), 2 * M_PI) / (2 * M_PI);
-        input_vec(3) = std::fmod(push.approach.angle, M_PI) / M_PI;
+        input_vec(0) = push.approach.point.x;
+        input_vec(1) = push.approach.point.y;
+        input_vec(2) = std::fmod(tf::getYaw(push.approach.normal), 2 * M_PI);
+        input_vec(3) = std::fmod(push.approach.angle, M_PI);
     }
 
-    void PushPredictor::denormalizePoseOutput(Eigen::VectorXf output_vec, geometry_msgs::Pose& pose) const 
+    void PushPredictor::denormalizePoseOutput(const Eigen::Ref<const Eigen::VectorXf>& output_vec, geometry_msgs::Pose& pose) const
     {
-        for (int i = 0; i < output_vec.size(); i++) {
-            output_vec(i) = MINV[i] + output_vec(i) * ( MAXV[i] - MINV[i] );
-        }
         pose.position.x = output_vec(0);
         pose.position.y = output_vec(1);
         pose.position.z = 0.0;
         tf::quaternionTFToMsg(tf::createQuaternionFromYaw(output_vec(2)), pose.orientation);
     }
 
+    // scale the inputs and outputs of models without normalization,
+    // applied once per model when the registry loads it
+    static void setupNetwork(NeuralNetwork& network)
+    {
+        if (!network.hasNormalization()) {
+            Eigen::VectorXf input_scale(4), input_offset(4), output_scale(3), output_offset(3);
+            input_scale << 1.0 / 0.162, 1.0 / 0.23, 1.0 / (2 * M_PI), 1.0 / M_PI;
+            input_offset << 0.081 / 0.162, 0.115 / 0.23, 0.0, 0.0;
+            output_scale.resize(network.outputSize());
+            output_offset.resize(network.outputSize());
+            // once per ensemble member
+            for (int i = 0; i < output_scale.size(); i++) {
+                output_scale(i) = MAXV[i % 3] - MINV[i % 3];
+                output_offset(i) = MINV[i % 3];
+            }
+            network.transformInputs(input_scale, input_offset);
+            network.transformOutputs(output_scale, output_offset);
+        }
+
+        // compare the folded network against the unfolded one
+        if (std::getenv("PUSH_PREDICTION_VERIFY_FOLDING")) {
+            float error = network.verifyFolding(Eigen::MatrixXf::Random(network.inputSize(), 1000));
+            if (error > 1e-4)
+                ROS_WARN("folded network differs from the unfolded network by %g", error);
+            else
+                ROS_INFO("folded network verified (max. difference %g)", error);
+        }
+    }
+
     PushPredictor::PushPredictor(const std::string& model_file)
+        : network_(ModelRegistry::instance().get(model_file, setupNetwork))
+    {
+    }
+
+    PushPredictor::PushPredictor(const std::vector<std::string>& model_files)
+        : network_(ModelRegistry::instance().getEnsemble(model_files, setupNetwork))
+    {
+    }
+
+    // mean of the rows of all members of an ensemble output
+    static Eigen::MatrixXf memberMean(const Eigen::MatrixXf& outputs, size_t members)
     {
-        network_.load(model_file);
+        const int rows = outputs.rows() / members;
+        Eigen::MatrixXf mean = outputs.topRows(rows);
+        for (size_t m = 1; m < members; m++)
+            mean += outputs.middleRows(m * rows, rows);
+        return mean / members;
+    }
+
+    // prefer the memory-mapped binary model generated by the build (PUSH_PREDICTION_BINARY_MODEL_DIR)
+    // over parsing the YAML export, unless it is missing, older than the export or of another format version;
+    // the package lookup is done once per process
+    static const std::string& defaultModelFile()
+    {
+        static const std::string model_file = [] {
+            const std::string yaml = ros::package::getPath("tams_ur5_push_prediction") + "/models/model_with_distance.yaml";
+            const std::string binary = PUSH_PREDICTION_BINARY_MODEL_DIR "/model_with_distance.bin";
+            struct stat binary_stat, yaml_stat;
+            if (stat(binary.c_str(), &binary_stat) != 0)
+                return yaml;
+            if (!NeuralNetwork::isCurrentBinaryModel(binary)) {
+                ROS_WARN("%s is not a binary model of the current format, loading the YAML export", binary.c_str());
+                return yaml;
+            }
+            if (stat(yaml.c_str(), &yaml_stat) == 0 && yaml_stat.st_mtime > binary_stat.st_mtime) {
+                ROS_WARN("%s is older than the YAML export, loading the YAML export", binary.c_str());
+                return yaml;
+            }
+            return binary;
+        }();
+        return model_file;
     }
 
     PushPredictor::PushPredictor()
-	    : PushPredictor(ros::package::getPath("tams_ur5_push_prediction") + "/models/model_with_distance.yaml"){}
+	    : PushPredictor(defaultModelFile())
+    {
+#ifdef PUSH_PREDICTION_STATIC_MODEL
+        use_static_model_ = true;
+#endif
+    }
+
 
+    constexpr size_t PushPredictor::DEFAULT_CACHE_CAPACITY;
+    constexpr double PushPredictor::DEFAULT_CACHE_RESOLUTION;
+
+    void PushPredictor::setCache(size_t capacity, double resolution) {
+        if (capacity == 0)
+            cache_.reset();
+        else
+            cache_ = std::make_shared<PredictionCache>(capacity, resolution);
+    }
+
+    void PushPredictor::setLookupTable(std::shared_ptr<const ControlTable> table) {
+        table_ = table;
+    }
 
     void PushPredictor::setReuseSolutions(bool reuseSolutions) {
-        reuseSolutions_ = reuseSolutions;
+        if (!reuseSolutions)
+            cache_.reset();
+        else if (!cache_)
+            setCache(DEFAULT_CACHE_CAPACITY);
     }
 
-    bool PushPredictor::predict(const tams_ur5_push_msgs::Push& push, geometry_msgs::Pose& pose) {
+    // ranges of the network inputs of a control (see convertControlToPush of push_planning):
+    // approach point along the object, normal yaw, approach angle of +-45 degrees, distance up to 5 cm
+    static const float CONTROL_RANGES[5] = { 0.162f, 0.23f, float(2 * M_PI), float(0.5 * M_PI), 0.05f };
 
-        // reuse last solution if request is the same
-        if(reuseSolutions_ && pushesEqual(push, last_push)) {
-            pose = last_pose;
-            return true;
-        }
-        
-        // declare in/out vectors
-        Eigen::VectorXf input_vec;
-        Eigen::VectorXf output_vec;
+    static bool cacheKey(const PredictionCache& cache, const Eigen::VectorXf& input_vec, PredictionCache::Key& key)
+    {
+        float control[5];
+        for (int i = 0; i < input_vec.size(); i++)
+            control[i] = input_vec(i) / CONTROL_RANGES[i];
+        return cache.quantize(control, input_vec.size(), key);
+    }
+
+    // network input of the yaw of an approach normal
+    static float yawInput(double yaw, bool normalization)
+    {
+        if (!normalization)
+            return std::fmod(yaw, 2 * M_PI);
+        yaw += M_PI / 2;
+        yaw = std::fmod(yaw, 1.5 * M_PI);
+        return yaw - M_PI / 2;
+    }
 
-        // initialize in vector
-        if (network_.hasNormalization()) {
+    void PushPredictor::createInput(const tams_ur5_push_msgs::Push& push, Eigen::VectorXf& input_vec) const
+    {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/input conversion ns");
+        if (network_->hasNormalization()) {
             input_vec.resize(5);
             input_vec(0) = push.approach.point.x;
             input_vec(1) = push.approach.point.y;
-            double yaw = tf::getYaw(push.approach.normal);
-            yaw += M_PI / 2;
-            yaw = std::fmod(yaw, 1.5 * M_PI);
-            input_vec(2) = yaw - M_PI / 2;
+            input_vec(2) = yawInput(tf::getYaw(push.approach.normal), true);
             input_vec(3) = push.approach.angle;
             input_vec(4) = push.distance;
         } else
             normalizePushInput(push, input_vec);
+    }
+
+    void PushPredictor::createInput(const double* control, Eigen::VectorXf& input_vec) const
+    {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/input conversion ns");
+        // the normals of the sides as converted from the quaternions of pushes,
+        // computed once so the inputs match those of the pushes exactly
+        static const std::array<float, 2 * ControlTable::SIDES> side_yaws = [] {
+            std::array<float, 2 * ControlTable::SIDES> yaws;
+            for (size_t side = 0; side < ControlTable::SIDES; side++) {
+                const double yaw = tf::getYaw(tf::createQuaternionMsgFromYaw(ControlTable::sideNormal(side)));
+                yaws[side] = yawInput(yaw, false);
+                yaws[ControlTable::SIDES + side] = yawInput(yaw, true);
+            }
+            return yaws;
+        }();
+
+        const size_t side = ControlTable::sideOfPivot(control[0]);
+        double x, y;
+        ControlTable::borderPoint(side, control[0], x, y);
+        const double angle = (control[1] - 0.5) * 2 * ControlTable::MAX_ANGLE;
+        if (network_->hasNormalization()) {
+            input_vec.resize(5);
+            input_vec(2) = side_yaws[ControlTable::SIDES + side];
+            input_vec(3) = angle;
+            input_vec(4) = control[2] * ControlTable::MAX_DISTANCE;
+        } else {
+            input_vec.resize(4);
+            input_vec(2) = side_yaws[side];
+            input_vec(3) = std::fmod(angle, M_PI);
+        }
+        input_vec(0) = x;
+        input_vec(1) = y;
+    }
+
+    void PushPredictor::predictInput(Context& context, const Eigen::VectorXf& input_vec, float* output) const
+    {
+        // reuse the prediction of a push in the same cell
+        PredictionCache::Key key;
+        const bool cached = cache_ && cacheKey(*cache_, input_vec, key);
+        if (cached) {
+            if (cache_->lookup(key, output)) {
+                PUSH_PREDICTION_PROFILE_RECORD("push_predictor/cache hits", 1);
+                return;
+            }
+            PUSH_PREDICTION_PROFILE_RECORD("push_predictor/cache misses", 1);
+        }
 
         // run prediction attempt
-        network_.run(input_vec, output_vec);
+#ifdef PUSH_PREDICTION_STATIC_MODEL
+        if (use_static_model_) {
+            generated::ModelWithDistance::Output static_output;
+            generated::ModelWithDistance::run(input_vec, static_output);
+            context.output = static_output;
+        } else
+#endif
+        network_->run(context.network, input_vec, context.output);
+
+        // mean of the ensemble members
+        const size_t members = network_->ensembleSize();
+        for (int i = 0; i < 3; i++) {
+            output[i] = context.output(i);
+            for (size_t m = 1; m < members; m++)
+                output[i] += context.output(m * 3 + i);
+            if (members > 1)
+                output[i] /= members;
+        }
+
+        if (cached)
+            cache_->insert(key, output);
+    }
+
+    bool PushPredictor::predict(const tams_ur5_push_msgs::Push& push, geometry_msgs::Pose& pose) const {
+        static thread_local Context context;
+        return predict(context, push, pose);
+    }
+
+    bool PushPredictor::predict(Context& context, const tams_ur5_push_msgs::Push& push, geometry_msgs::Pose& pose) const {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/predict ns");
+
+        float output[3];
+        size_t side;
+        double control[3];
+        if (table_ && table_->pushToControl(push, side, control) && table_->interpolate(side, control, output)) {
+            PUSH_PREDICTION_PROFILE_RECORD("push_predictor/table lookups", 1);
+        } else {
+            createInput(push, context.input);
+            predictInput(context, context.input, output);
+        }
 
         // create pose from out vector
-        if (network_.hasNormalization()) {
-            pose.position.x = output_vec(0);
-            pose.position.y = output_vec(1);
-            pose.position.z = 0.0;
-            tf::quaternionTFToMsg(tf::createQuaternionFromYaw(output_vec(2)), pose.orientation);
-        } else
-            denormalizePoseOutput(output_vec, pose);
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/output conversion ns");
+        denormalizePoseOutput(Eigen::Map<const Eigen::VectorXf>(output, 3), pose);
+        return true;
+    }
+
+    bool PushPredictor::predictControl(const double* control, double& dx, double& dy, double& dyaw) const {
+        static thread_local Context context;
+        return predictControl(context, control, dx, dy, dyaw);
+    }
+
+    bool PushPredictor::predictControl(Context& context, const double* control, double& dx, double& dy, double& dyaw) const {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/predict control ns");
+
+        float output[3];
+        if (table_ && table_->interpolate(control, output)) {
+            PUSH_PREDICTION_PROFILE_RECORD("push_predictor/table lookups", 1);
+        } else {
+            createInput(control, context.input);
+            predictInput(context, context.input, output);
+        }
+        dx = output[0];
+        dy = output[1];
+        dyaw = output[2];
+        return true;
+    }
+
+    void PushPredictor::queueInput(Context& context, int column, Eigen::Matrix3Xd& steps) const
+    {
+        Context::Pending pending;
+        pending.column = column;
+        pending.cached = cache_ && cacheKey(*cache_, context.input, pending.key);
+        if (pending.cached) {
+            float output[3];
+            if (cache_->lookup(pending.key, output)) {
+                PUSH_PREDICTION_PROFILE_RECORD("push_predictor/cache hits", 1);
+                steps.col(column) = Eigen::Map<const Eigen::Vector3f>(output).cast<double>();
+                return;
+            }
+            PUSH_PREDICTION_PROFILE_RECORD("push_predictor/cache misses", 1);
+        }
+        context.batch_inputs.col(context.pending.size()) = context.input;
+        context.pending.push_back(pending);
+    }
+
+    void PushPredictor::runPending(Context& context, Eigen::Matrix3Xd& steps) const
+    {
+        const size_t count = context.pending.size();
+        if (count == 0)
+            return;
+        context.batch_inputs.conservativeResize(Eigen::NoChange, count);
 
-        // persist last request and solution 
-        last_push = push;
-        last_pose = pose;
+        // batches always run the batched kernels of the network, the generated model only serves single predictions
+        network_->runBatch(context.network, context.batch_inputs, context.batch_outputs);
+
+        // mean of the ensemble members
+        const size_t members = network_->ensembleSize();
+        for (size_t i = 0; i < count; i++) {
+            const Context::Pending& pending = context.pending[i];
+            float output[3];
+            for (int r = 0; r < 3; r++) {
+                output[r] = context.batch_outputs(r, i);
+                for (size_t m = 1; m < members; m++)
+                    output[r] += context.batch_outputs(m * 3 + r, i);
+                if (members > 1)
+                    output[r] /= members;
+            }
+            if (pending.cached)
+                cache_->insert(pending.key, output);
+            steps.col(pending.column) = Eigen::Map<const Eigen::Vector3f>(output).cast<double>();
+        }
+    }
+
+    void PushPredictor::applySteps(const Eigen::Matrix3Xd& starts, const Eigen::Matrix3Xd& steps, Eigen::Matrix3Xd& results)
+    {
+        const bool shared_start = starts.cols() == 1;
+        results.resize(3, steps.cols());
+        for (int i = 0; i < steps.cols(); i++) {
+            const int start = shared_start ? 0 : i;
+            const double x = starts(0, start);
+            const double y = starts(1, start);
+            const double yaw = starts(2, start);
+            const double cos_yaw = std::cos(yaw);
+            const double sin_yaw = std::sin(yaw);
+            results(0, i) = x + cos_yaw * steps(0, i) - sin_yaw * steps(1, i);
+            results(1, i) = y + sin_yaw * steps(0, i) + cos_yaw * steps(1, i);
+            results(2, i) = std::fmod(yaw + steps(2, i) + M_PI, 2 * M_PI) - M_PI;
+        }
+    }
+
+    bool PushPredictor::predictBatch(const Eigen::Matrix3Xd& controls, Eigen::Matrix3Xd& steps) const {
+        static thread_local Context context;
+        return predictBatch(context, controls, steps);
+    }
+
+    bool PushPredictor::predictBatch(Context& context, const Eigen::Matrix3Xd& controls, Eigen::Matrix3Xd& steps) const {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/batch ns");
+        steps.resize(3, controls.cols());
+        context.pending.clear();
+        context.batch_inputs.resize(network_->inputSize(), controls.cols());
+        for (int i = 0; i < controls.cols(); i++) {
+            float output[3];
+            if (table_ && table_->interpolate(controls.col(i).data(), output)) {
+                PUSH_PREDICTION_PROFILE_RECORD("push_predictor/table lookups", 1);
+                steps.col(i) = Eigen::Map<const Eigen::Vector3f>(output).cast<double>();
+                continue;
+            }
+            createInput(controls.col(i).data(), context.input);
+            queueInput(context, i, steps);
+        }
+        runPending(context, steps);
         return true;
     }
+
+    bool PushPredictor::predictBatch(const std::vector<tams_ur5_push_msgs::Push>& pushes, Eigen::Matrix3Xd& steps) const {
+        static thread_local Context context;
+        return predictBatch(context, pushes, steps);
+    }
+
+    bool PushPredictor::predictBatch(Context& context, const std::vector<tams_ur5_push_msgs::Push>& pushes, Eigen::Matrix3Xd& steps) const {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/batch ns");
+        steps.resize(3, pushes.size());
+        context.pending.clear();
+        context.batch_inputs.resize(network_->inputSize(), pushes.size());
+        for (size_t i = 0; i < pushes.size(); i++) {
+            float output[3];
+            size_t side;
+            double control[3];
+            if (table_ && table_->pushToControl(pushes[i], side, control) && table_->interpolate(side, control, output)) {
+                PUSH_PREDICTION_PROFILE_RECORD("push_predictor/table lookups", 1);
+                steps.col(i) = Eigen::Map<const Eigen::Vector3f>(output).cast<double>();
+                continue;
+            }
+            createInput(pushes[i], context.input);
+            queueInput(context, i, steps);
+        }
+        runPending(context, steps);
+        return true;
+    }
+
+    bool PushPredictor::predictBatch(const Eigen::Matrix3Xd& controls, const Eigen::Matrix3Xd& starts,
+            Eigen::Matrix3Xd& results) const {
+        static thread_local Context context;
+        return predictBatch(context, controls, starts, results);
+    }
+
+    bool PushPredictor::predictBatch(Context& context, const Eigen::Matrix3Xd& controls, const Eigen::Matrix3Xd& starts,
+            Eigen::Matrix3Xd& results) const {
+        if (starts.cols() != 1 && starts.cols() != controls.cols()) {
+            ROS_ERROR("batch of %i controls has %i start poses", (int)controls.cols(), (int)starts.cols());
+            return false;
+        }
+        Eigen::Matrix3Xd steps;
+        predictBatch(context, controls, steps);
+        applySteps(starts, steps, results);
+        return true;
+    }
+
+    bool PushPredictor::predictBatch(const std::vector<tams_ur5_push_msgs::Push>& pushes, const Eigen::Matrix3Xd& starts,
+            Eigen::Matrix3Xd& results) const {
+        static thread_local Context context;
+        return predictBatch(context, pushes, starts, results);
+    }
+
+    bool PushPredictor::predictBatch(Context& context, const std::vector<tams_ur5_push_msgs::Push>& pushes,
+            const Eigen::Matrix3Xd& starts, Eigen::Matrix3Xd& results) const {
+        if (starts.cols() != 1 && (size_t)starts.cols() != pushes.size()) {
+            ROS_ERROR("batch of %i pushes has %i start poses", (int)pushes.size(), (int)starts.cols());
+            return false;
+        }
+        Eigen::Matrix3Xd steps;
+        predictBatch(context, pushes, steps);
+        applySteps(starts, steps, results);
+        return true;
+    }
+
+    bool PushPredictor::predict(Context& context, const tams_ur5_push_msgs::Push& push, geometry_msgs::Pose& pose,
+            Eigen::Matrix<double, 3, 4>& jacobian) const {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/jacobian ns");
+        Eigen::VectorXf input_vec;
+        Eigen::VectorXf output_vec;
+        Eigen::MatrixXf network_jacobian;
+        createInput(push, input_vec);
+        network_->jacobian(context.network, input_vec, output_vec, network_jacobian);
+        if (network_->ensembleSize() > 1) {
+            output_vec = memberMean(output_vec, network_->ensembleSize());
+            network_jacobian = memberMean(network_jacobian, network_->ensembleSize());
+        }
+        denormalizePoseOutput(output_vec, pose);
+
+        // the normal yaw is constant along a side of the object,
+        // only models with normalization take the distance as input
+        jacobian.col(0) = network_jacobian.col(0).cast<double>();
+        jacobian.col(1) = network_jacobian.col(1).cast<double>();
+        jacobian.col(2) = network_jacobian.col(3).cast<double>();
+        if (network_->hasNormalization())
+            jacobian.col(3) = network_jacobian.col(4).cast<double>();
+        else
+            jacobian.col(3).setZero();
+        return true;
+    }
+
+    bool PushPredictor::predict(const tams_ur5_push_msgs::Push& push, geometry_msgs::Pose& pose,
+            Eigen::Matrix<double, 3, 4>& jacobian) const {
+        static thread_local Context context;
+        return predict(context, push, pose, jacobian);
+    }
+
+    bool PushPredictor::predictUncertainty(Context& context, const tams_ur5_push_msgs::Push& push, Eigen::Vector3d& mean,
+            Eigen::Matrix3d& covariance, size_t samples) const {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/uncertainty ns");
+        Eigen::VectorXf input_vec;
+        createInput(push, input_vec);
+        const size_t members = network_->ensembleSize();
+        if (network_->hasDropout() && samples >= 2) {
+            network_->runDropout(context.network, input_vec, samples, context.samples);
+        } else {
+            Eigen::VectorXf output_vec;
+            network_->run(context.network, input_vec, output_vec);
+            context.samples = output_vec;
+        }
+        poolSamples(context.samples, members, mean, covariance);
+        return true;
+    }
+
+    bool PushPredictor::predictUncertainty(const tams_ur5_push_msgs::Push& push, Eigen::Vector3d& mean,
+            Eigen::Matrix3d& covariance, size_t samples) const {
+        static thread_local Context context;
+        return predictUncertainty(context, push, mean, covariance, samples);
+    }
+
+    bool PushPredictor::predictUncertainty(Context& context, const std::vector<tams_ur5_push_msgs::Push>& pushes,
+            Eigen::Matrix3Xd& means, std::vector<Eigen::Matrix3d>& covariances, size_t samples) const {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/uncertainty batch ns");
+        const size_t members = network_->ensembleSize();
+        // the samples of push i are the columns i * samples ... (i + 1) * samples - 1
+        if (!network_->hasDropout() || samples < 2)
+            samples = 1;
+        context.batch_inputs.resize(network_->inputSize(), pushes.size() * samples);
+        for (size_t i = 0; i < pushes.size(); i++) {
+            createInput(pushes[i], context.input);
+            context.batch_inputs.middleCols(i * samples, samples).colwise() = context.input;
+        }
+        if (samples > 1)
+            network_->runDropoutBatch(context.network, context.batch_inputs, context.samples);
+        else
+            network_->runBatch(context.network, context.batch_inputs, context.samples);
+
+        means.resize(3, pushes.size());
+        covariances.resize(pushes.size());
+        Eigen::Vector3d mean;
+        for (size_t i = 0; i < pushes.size(); i++) {
+            poolSamples(context.samples.middleCols(i * samples, samples), members, mean, covariances[i]);
+            means.col(i) = mean;
+        }
+        return true;
+    }
+
+    bool PushPredictor::predictUncertainty(const std::vector<tams_ur5_push_msgs::Push>& pushes, Eigen::Matrix3Xd& means,
+            std::vector<Eigen::Matrix3d>& covariances, size_t samples) const {
+        static thread_local Context context;
+        return predictUncertainty(context, pushes, means, covariances, samples);
+    }
+
+    void PushPredictor::poolSamples(const Eigen::Ref<const Eigen::MatrixXf>& samples, size_t members, Eigen::Vector3d& mean,
+            Eigen::Matrix3d& covariance) {
+        if (samples.cols() * members < 2) {
+            mean = samples.col(0).cast<double>();
+            covariance.setZero();
+            return;
+        }
+
+        // every member prediction is a sample
+        const int cols = samples.cols();
+        Eigen::MatrixXd pooled(3, cols * members);
+        for (size_t m = 0; m < members; m++)
+            pooled.middleCols(m * cols, cols) = samples.middleRows(m * 3, 3).cast<double>();
+        mean = pooled.rowwise().mean();
+        Eigen::MatrixXd centered = pooled.colwise() - mean;
+        covariance = centered * centered.transpose() / (pooled.cols() - 1);
+    }
+
+    bool PushPredictor::predictEnsemble(Context& context, const tams_ur5_push_msgs::Push& push,
+            Eigen::Matrix3Xd& predictions, Eigen::Vector3d& mean, Eigen::Matrix3d& covariance) const {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/ensemble ns");
+        Eigen::VectorXf input_vec, output_vec;
+        createInput(push, input_vec);
+        network_->run(context.network, input_vec, output_vec);
+        const size_t members = network_->ensembleSize();
+        predictions = Eigen::Map<const Eigen::MatrixXf>(output_vec.data(), 3, members).cast<double>();
+        mean = predictions.rowwise().mean();
+        Eigen::Matrix3Xd centered = predictions.colwise() - mean;
+        covariance = members > 1 ? Eigen::Matrix3d(centered * centered.transpose() / (members - 1)) : Eigen::Matrix3d::Zero();
+        return true;
+    }
+
+    bool PushPredictor::predictEnsemble(const tams_ur5_push_msgs::Push& push, Eigen::Matrix3Xd& predictions,
+            Eigen::Vector3d& mean, Eigen::Matrix3d& covariance) const {
+        static thread_local Context context;
+        return predictEnsemble(context, push, predictions, mean, covariance);
+    }
+
+    bool PushPredictor::predictBounds(Context& context, const std::vector<tams_ur5_push_msgs::Push>& pushes,
+            Eigen::Vector3d& lower, Eigen::Vector3d& upper) const {
+        PUSH_PREDICTION_PROFILE_NAMED_SCOPE("push_predictor/bounds ns");
+        if (pushes.empty())
+            return false;
+        Eigen::VectorXf input_vec, input_lower, input_upper;
+        for (size_t i = 0; i < pushes.size(); i++) {
+            createInput(pushes[i], input_vec);
+            input_lower = i == 0 ? input_vec : input_lower.cwiseMin(input_vec);
+            input_upper = i == 0 ? input_vec : input_upper.cwiseMax(input_vec);
+        }
+        Eigen::VectorXf output_lower, output_upper;
+        network_->bounds(context.network, input_lower, input_upper, output_lower, output_upper);
+        lower = output_lower.head(3).cast<double>();
+        upper = output_upper.head(3).cast<double>();
+        for (size_t m = 1; m < network_->ensembleSize(); m++) {
+            lower = lower.cwiseMin(output_lower.segment(m * 3, 3).cast<double>());
+            upper = upper.cwiseMax(output_upper.segment(m * 3, 3).cast<double>());
+        }
+        return true;
+    }
+
+    bool PushPredictor::predictBounds(const std::vector<tams_ur5_push_msgs::Push>& pushes, Eigen::Vector3d& lower,
+            Eigen::Vector3d& upper) const {
+        static thread_local Context context;
+        return predictBounds(context, pushes, lower, upper);
+    }
 }
 
 // For testing purposes
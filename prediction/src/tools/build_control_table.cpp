@@ -0,0 +1,182 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+/*
+ * Samples the predictions of a model on a grid over the planner controls and
+ * writes them as a control table (see push_prediction::ControlTable). The table
+ * stores the largest error of the interpolation on random controls and a bound
+ * of the error from the interval bounds of every grid cell.
+ *
+ * Usage: build_control_table <model file> <table file> [--pivot <nodes>] [--angle <nodes>] [--distance <nodes>] [--corners <0-1>] [--samples <count>]
+ */
+
+#include <push_prediction/push_predictor.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+using namespace push_prediction;
+
+static void poseValues(const geometry_msgs::Pose& pose, float* values)
+{
+  values[0] = pose.position.x;
+  values[1] = pose.position.y;
+  values[2] = tf::getYaw(pose.orientation);
+}
+
+int main(int argc, char** argv)
+{
+  size_t pivot_nodes = 129, angle_nodes = 33, distance_nodes = 17, samples = 100000;
+  double corner_refinement = 0.8;
+  bool valid = argc >= 3;
+  for (int i = 3; valid && i < argc; i += 2) {
+    valid = i + 1 < argc;
+    if (valid && strcmp(argv[i], "--pivot") == 0)
+      pivot_nodes = std::atoi(argv[i + 1]);
+    else if (valid && strcmp(argv[i], "--angle") == 0)
+      angle_nodes = std::atoi(argv[i + 1]);
+    else if (valid && strcmp(argv[i], "--distance") == 0)
+      distance_nodes = std::atoi(argv[i + 1]);
+    else if (valid && strcmp(argv[i], "--corners") == 0)
+      corner_refinement = std::atof(argv[i + 1]);
+    else if (valid && strcmp(argv[i], "--samples") == 0)
+      samples = std::atoi(argv[i + 1]);
+    else
+      valid = false;
+  }
+  if (!valid) {
+    std::cerr << "Usage: " << argv[0]
+              << " <model file> <table file> [--pivot <nodes>] [--angle <nodes>] [--distance <nodes>] [--corners <0-1>] [--samples <count>]"
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    PushPredictor predictor(argv[1]);
+    ControlTable table(pivot_nodes, angle_nodes, distance_nodes, corner_refinement);
+    tams_ur5_push_msgs::Push push;
+    geometry_msgs::Pose pose;
+    size_t side;
+    double control[3];
+
+    for (size_t node = 0; node < table.nodes(); node++) {
+      table.nodeControl(node, side, control);
+      table.controlToPush(side, control, push);
+      predictor.predict(push, pose);
+      poseValues(pose, table.nodeValues(node));
+    }
+
+    // the network and the interpolation both stay within the interval bounds of a cell
+    float error_bound[ControlTable::VALUES] = {};
+    std::vector<tams_ur5_push_msgs::Push> corners(2);
+    Eigen::Vector3d lower, upper;
+    for (side = 0; side < ControlTable::SIDES; side++) {
+      const std::vector<double>& positions = table.pivotPositions(side);
+      for (size_t p = 0; p + 1 < table.pivotNodes(side); p++) {
+        for (size_t a = 0; a + 1 < table.angleNodes(); a++) {
+          for (size_t d = 0; d + 1 < table.distanceNodes(); d++) {
+            for (size_t corner = 0; corner < 2; corner++) {
+              control[0] = table.pivotControl(side, positions[p + corner]);
+              control[1] = double(a + corner) / (table.angleNodes() - 1);
+              control[2] = double(d + corner) / (table.distanceNodes() - 1);
+              table.controlToPush(side, control, corners[corner]);
+            }
+            predictor.predictBounds(corners, lower, upper);
+            for (size_t v = 0; v < ControlTable::VALUES; v++)
+              error_bound[v] = std::max<float>(error_bound[v], upper(v) - lower(v));
+          }
+        }
+      }
+    }
+
+    // compare the interpolation against the network on random controls
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    float max_error[ControlTable::VALUES] = {}, mean_error[ControlTable::VALUES] = {};
+    float network[ControlTable::VALUES], interpolated[ControlTable::VALUES];
+    std::vector<tams_ur5_push_msgs::Push> pushes(samples);
+    for (size_t i = 0; i < samples; i++) {
+      double position;
+      for (double& c : control)
+        c = uniform(generator);
+      table.pivotSide(control[0], side, position);
+      table.controlToPush(side, control, pushes[i]);
+      predictor.predict(pushes[i], pose);
+      poseValues(pose, network);
+      table.interpolate(side, control, interpolated);
+      for (size_t v = 0; v < ControlTable::VALUES; v++) {
+        float error = std::fabs(interpolated[v] - network[v]);
+        max_error[v] = std::max(max_error[v], error);
+        mean_error[v] += error / samples;
+      }
+    }
+    table.setError(max_error, error_bound);
+    table.save(argv[2]);
+
+    // time predictions of the same pushes with and without the table
+    auto secondsPerPush = [&]() {
+      auto start = std::chrono::steady_clock::now();
+      for (const tams_ur5_push_msgs::Push& sample : pushes)
+        predictor.predict(sample, pose);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      return elapsed.count() / pushes.size();
+    };
+    double network_time = secondsPerPush();
+    predictor.setLookupTable(std::make_shared<ControlTable>(table));
+    double table_time = secondsPerPush();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < samples; i++) {
+      control[0] = double(i) / samples;
+      control[1] = control[2] = 0.5;
+      table.interpolate(control, interpolated);
+    }
+    std::chrono::duration<double> interpolation_time = std::chrono::steady_clock::now() - start;
+
+    printf("%i nodes (pivot %i/%i/%i/%i, angle %i, distance %i), %i kB\n", (int)table.nodes(),
+        (int)table.pivotNodes(0), (int)table.pivotNodes(1), (int)table.pivotNodes(2), (int)table.pivotNodes(3),
+        (int)table.angleNodes(), (int)table.distanceNodes(),
+        (int)(table.nodes() * ControlTable::VALUES * sizeof(float) / 1024));
+    printf("%-8s %14s %14s %14s\n", "output", "mean abs err", "max abs err", "error bound");
+    const char* names[] = { "x", "y", "yaw" };
+    for (size_t v = 0; v < ControlTable::VALUES; v++)
+      printf("%-8s %14.6g %14.6g %14.6g\n", names[v], mean_error[v], max_error[v], error_bound[v]);
+    printf("time per prediction: network %.0f ns, table %.0f ns (interpolation %.0f ns)\n",
+        network_time * 1e9, table_time * 1e9, interpolation_time.count() / samples * 1e9);
+  } catch (...) {
+    std::cerr << "Failed to build a control table for " << argv[1] << std::endl;
+    return 1;
+  }
+  return 0;
+}
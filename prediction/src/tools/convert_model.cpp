@@ -0,0 +1,81 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+
+/*
+ * Converts a Keras YAML model export into the binary model format, which
+ * NeuralNetwork::load maps into memory without parsing.
+ * With --int8 the model additionally stores int8 weights calibrated on the
+ * given network inputs and runs quantized when it is loaded.
+ *
+ * Usage: convert_model <model.yaml> <model.bin> [--int8 <calibration.csv>]
+ */
+
+#include <push_prediction/neural_network.h>
+#include "model_inputs.h"
+
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+  if (argc != 3 && !(argc == 5 && std::string(argv[3]) == "--int8")) {
+    std::cerr << "Usage: " << argv[0] << " <model.yaml> <model.bin> [--int8 <calibration.csv>]" << std::endl;
+    return 1;
+  }
+
+  try {
+    NeuralNetwork yaml_network;
+    yaml_network.load(argv[1]);
+    if (argc == 5)
+      yaml_network.quantize(loadInputsCSV(argv[4], yaml_network.inputSize()));
+    yaml_network.saveBinary(argv[2]);
+
+    // verify that the binary model reproduces the original network
+    NeuralNetwork binary_network;
+    binary_network.load(argv[2]);
+    Eigen::MatrixXf inputs = Eigen::MatrixXf::Random(yaml_network.inputSize(), 100);
+    Eigen::MatrixXf yaml_outputs, binary_outputs;
+    yaml_network.runBatch(inputs, yaml_outputs);
+    binary_network.runBatch(inputs, binary_outputs);
+    if (!yaml_outputs.isApprox(binary_outputs)) {
+      std::cerr << "Binary model output differs from " << argv[1] << std::endl;
+      return 1;
+    }
+  } catch (...) {
+    std::cerr << "Failed to convert " << argv[1] << std::endl;
+    return 1;
+  }
+  std::cout << "Wrote " << argv[2] << std::endl;
+  return 0;
+}
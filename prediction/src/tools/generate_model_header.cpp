@@ -0,0 +1,204 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+
+/*
+ * Generates a header with a fully specialized forward pass for a push model.
+ * All weights are stored in static arrays and used through fixed-size Eigen
+ * maps, layers are emitted as straight-line code in execution order and
+ * normalization constants are compiled in.
+ *
+ * Usage: generate_model_header <model file> <header> <struct name>
+ */
+
+#include <push_prediction/neural_network.h>
+
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+class NeuralNetworkCodeGenerator
+{
+  public:
+    NeuralNetworkCodeGenerator(const NeuralNetwork& network) : network_(network) {}
+
+    void generate(std::ostream& out, const std::string& model_file, const std::string& struct_name)
+    {
+      const std::string model_name = model_file.substr(model_file.find_last_of('/') + 1);
+      out << "// Generated by generate_model_header from " << model_name << " - do not edit\n\n";
+      out << "#pragma once\n\n";
+      out << "#include <Eigen/Dense>\n\n";
+      out << "namespace push_prediction {\n";
+      out << "  namespace generated {\n";
+      out << "    struct " << struct_name << " {\n";
+      out << "      static constexpr int InputSize = " << network_.inputSize_ << ";\n";
+      out << "      static constexpr int OutputSize = " << network_.outputLayer->outputSlot.size << ";\n";
+      out << "      static constexpr bool HasNormalization = " << (network_.has_normalization_ ? "true" : "false") << ";\n\n";
+      out << "      typedef Eigen::Matrix<float, InputSize, 1> Input;\n";
+      out << "      typedef Eigen::Matrix<float, OutputSize, 1> Output;\n\n";
+      out << "      template <class Derived>\n";
+      out << "      static inline void run(const Eigen::MatrixBase<Derived>& input, Output& output)\n";
+      out << "      {\n";
+
+      // static weight and normalization storage
+      if (network_.has_normalization_) {
+        emitArray(out, "input_shift", network_._inputShift.data(), network_._inputShift.size(), 1);
+        emitArray(out, "input_divisor", network_._inputDivisor.data(), network_._inputDivisor.size(), 1);
+        emitArray(out, "output_factor", network_._outputFactor.data(), network_._outputFactor.size(), 1);
+        emitArray(out, "output_shift", network_._outputShift.data(), network_._outputShift.size(), 1);
+      }
+      for (size_t i = 0; i < network_.ops_.size(); i++) {
+        const auto& layer = *network_.ops_[i];
+        for (size_t w = 0; w < layer.weights.size(); w++) {
+          const auto& weight = layer.weights[w];
+          emitArray(out, name(layer) + "_w" + std::to_string(w), weight.data, weight.rows, weight.cols);
+        }
+      }
+      out << "\n";
+
+      // input normalization
+      const std::string input_name = name(*network_.inputLayer);
+      out << "        const " << vectorType(network_.inputSize_) << " " << input_name << " = ";
+      if (network_.has_normalization_)
+        out << "(input - input_shift).cwiseQuotient(input_divisor);\n";
+      else
+        out << "input;\n";
+
+      // layers in execution order
+      for (size_t i = 0; i < network_.ops_.size(); i++) {
+        const auto& layer = *network_.ops_[i];
+        std::vector<std::string> inputs;
+        for (const auto& in : layer.inputLayers)
+          inputs.push_back(name(*in));
+        out << "        const " << vectorType(layer.outputSlot.size) << " " << name(layer) << " = ";
+        switch (layer.type()) {
+          case NeuralNetwork::LayerType::dense: {
+            const auto& dense = static_cast<const NeuralNetwork::Dense&>(layer);
+            std::string value = name(layer) + "_w0 * " + inputs[0];
+            if (dense.useBias)
+              value += " + " + name(layer) + "_w1";
+            if (dense.activation == NeuralNetwork::Activation::relu)
+              value = "(" + value + ").cwiseMax(0.0f)";
+            else if (dense.activation == NeuralNetwork::Activation::sigmoid)
+              value = "(1.0f + (-(" + value + ")).array().exp()).inverse().matrix()";
+            out << value << ";\n";
+            break;
+          }
+          case NeuralNetwork::LayerType::multiply:
+          case NeuralNetwork::LayerType::add: {
+            std::string value = inputs[0];
+            for (size_t in = 1; in < inputs.size(); in++) {
+              if (layer.type() == NeuralNetwork::LayerType::multiply)
+                value = "(" + value + ").cwiseProduct(" + inputs[in] + ")";
+              else
+                value = value + " + " + inputs[in];
+            }
+            out << value << ";\n";
+            break;
+          }
+          case NeuralNetwork::LayerType::dropout:
+            out << inputs[0] << ";\n";
+            break;
+          default:
+            throw std::runtime_error("unsupported layer " + layer.name);
+        }
+      }
+
+      // output denormalization
+      const std::string output_name = name(*network_.outputLayer);
+      if (network_.has_normalization_)
+        out << "        output = " << output_name << ".cwiseProduct(output_factor) + output_shift;\n";
+      else
+        out << "        output = " << output_name << ";\n";
+      out << "      }\n";
+      out << "    };\n";
+      out << "  }\n";
+      out << "}\n";
+    }
+
+  private:
+    const NeuralNetwork& network_;
+
+    std::string name(const NeuralNetwork::Layer& layer) const
+    {
+      std::string identifier = "layer_";
+      for (char c : layer.name)
+        identifier += std::isalnum(c) ? c : '_';
+      return identifier;
+    }
+
+    std::string vectorType(size_t size) const
+    {
+      return "Eigen::Matrix<float, " + std::to_string(size) + ", 1>";
+    }
+
+    void emitArray(std::ostream& out, const std::string& name, const float* data, size_t rows, size_t cols) const
+    {
+      const std::string type = "Eigen::Matrix<float, " + std::to_string(rows) + ", " + std::to_string(cols) + ">";
+      out << "        alignas(64) static const float " << name << "_data[" << rows * cols << "] = {";
+      // 9 significant digits round-trip every float exactly
+      std::ostringstream values;
+      values << std::scientific;
+      values.precision(8);
+      for (size_t i = 0; i < rows * cols; i++) {
+        values << (i % 8 == 0 ? "\n          " : " ") << data[i] << "f" << (i + 1 < rows * cols ? "," : "");
+      }
+      out << values.str() << "\n        };\n";
+      out << "        const Eigen::Map<const " << type << ", Eigen::Aligned> " << name << "(" << name << "_data);\n";
+    }
+};
+
+int main(int argc, char** argv)
+{
+  if (argc != 4) {
+    std::cerr << "Usage: " << argv[0] << " <model file> <header> <struct name>" << std::endl;
+    return 1;
+  }
+
+  try {
+    NeuralNetwork network;
+    network.load(argv[1]);
+    std::ofstream header(argv[2]);
+    NeuralNetworkCodeGenerator(network).generate(header, argv[1], argv[3]);
+    if (!header) {
+      std::cerr << "Failed to write " << argv[2] << std::endl;
+      return 1;
+    }
+  } catch (...) {
+    std::cerr << "Failed to generate code for " << argv[1] << std::endl;
+    return 1;
+  }
+  return 0;
+}
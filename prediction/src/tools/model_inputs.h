@@ -0,0 +1,101 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+
+/*
+ * Network inputs for the model tools: recorded samples from a CSV file or
+ * random samples from the input range of the network.
+ */
+
+#pragma once
+
+#include <push_prediction/neural_network.h>
+
+#include <fstream>
+#include <sstream>
+
+/*
+ * Read one network input per line (comma separated), lines that don't
+ * start with a number (e.g. a header) are skipped.
+ */
+inline Eigen::MatrixXf loadInputsCSV(const std::string& filename, size_t input_size)
+{
+  std::ifstream file(filename);
+  if (!file) {
+    ROS_FATAL("unable to read %s", filename.c_str());
+    throw 0;
+  }
+  std::vector<float> values;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream stream(line);
+    std::string cell;
+    std::vector<float> sample;
+    while (std::getline(stream, cell, ',')) {
+      char* end = nullptr;
+      float value = std::strtof(cell.c_str(), &end);
+      if (end == cell.c_str())
+        break;
+      sample.push_back(value);
+    }
+    if (sample.empty())
+      continue;
+    if (sample.size() != input_size) {
+      ROS_FATAL("%s: expected %i values per line, got %i", filename.c_str(), (int)input_size, (int)sample.size());
+      throw 0;
+    }
+    values.insert(values.end(), sample.begin(), sample.end());
+  }
+  return Eigen::Map<Eigen::MatrixXf>(values.data(), input_size, values.size() / input_size);
+}
+
+/*
+ * Uniform samples from the normalization range of the network inputs
+ * (+-2 standard deviations for z_score), [0, 1] for networks without
+ * normalization.
+ */
+inline Eigen::MatrixXf sampleInputs(NeuralNetwork& network, size_t count)
+{
+  Eigen::ArrayXXf uniform = (Eigen::ArrayXXf::Random(network.inputSize(), count) + 1.0f) * 0.5f;
+  Eigen::ArrayXf low = Eigen::ArrayXf::Zero(network.inputSize());
+  Eigen::ArrayXf high = Eigen::ArrayXf::Ones(network.inputSize());
+  if (network.hasNormalization() && network.normalizationType() == "min_max") {
+    low = network.inputMin();
+    high = network.inputMax();
+  } else if (network.hasNormalization()) {
+    low = network.inputCenter().array() - 2.0f * network.inputScale().array();
+    high = network.inputCenter().array() + 2.0f * network.inputScale().array();
+  }
+  return ((uniform.colwise() * (high - low)).colwise() + low).matrix();
+}
@@ -0,0 +1,162 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+
+/*
+ * Prunes the hidden units and zero weight blocks of a network (see
+ * NeuralNetwork::pruneNeurons and sparsify) and writes the result as a binary
+ * model. The report compares size, speed and accuracy against the original
+ * network. The tolerances apply to the normalized values inside the network.
+ * The recorded inputs are split into a calibration and an evaluation half,
+ * without a recording both sets are sampled from the input range.
+ *
+ * Usage: prune_model <model file> <pruned.bin> [--neurons <tolerance>] [--blocks <tolerance>] [--inputs <inputs.csv>]
+ */
+
+#include <push_prediction/neural_network.h>
+#include "model_inputs.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+
+static double secondsPerSample(NeuralNetwork& network, const Eigen::MatrixXf& inputs, bool batch)
+{
+  Eigen::MatrixXf outputs;
+  Eigen::VectorXf input, output;
+  const int repetitions = batch ? 20 : 2;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repetitions; i++) {
+    if (batch) {
+      network.runBatch(inputs, outputs);
+      continue;
+    }
+    for (int col = 0; col < inputs.cols(); col++) {
+      input = inputs.col(col);
+      network.run(input, output);
+    }
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (repetitions * inputs.cols());
+}
+
+static size_t fileSize(const char* filename)
+{
+  struct stat status;
+  return stat(filename, &status) == 0 ? status.st_size : 0;
+}
+
+int main(int argc, char** argv)
+{
+  float neuron_tolerance = 0.0f, block_tolerance = -1.0f;
+  const char* inputs_file = nullptr;
+  bool valid = argc >= 3;
+  for (int i = 3; valid && i < argc; i += 2) {
+    valid = i + 1 < argc;
+    if (valid && strcmp(argv[i], "--neurons") == 0)
+      neuron_tolerance = std::atof(argv[i + 1]);
+    else if (valid && strcmp(argv[i], "--blocks") == 0)
+      block_tolerance = std::atof(argv[i + 1]);
+    else if (valid && strcmp(argv[i], "--inputs") == 0)
+      inputs_file = argv[i + 1];
+    else
+      valid = false;
+  }
+  if (!valid) {
+    std::cerr << "Usage: " << argv[0]
+              << " <model file> <pruned.bin> [--neurons <tolerance>] [--blocks <tolerance>] [--inputs <inputs.csv>]"
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    NeuralNetwork network;
+    network.load(argv[1]);
+    network.setQuantized(false);
+
+    Eigen::MatrixXf calibration, evaluation;
+    if (inputs_file) {
+      Eigen::MatrixXf inputs = loadInputsCSV(inputs_file, network.inputSize());
+      if (inputs.cols() < 2) {
+        std::cerr << "Need at least two recorded inputs" << std::endl;
+        return 1;
+      }
+      calibration = inputs.leftCols(inputs.cols() / 2);
+      evaluation = inputs.rightCols(inputs.cols() - calibration.cols());
+    } else {
+      // units that are rarely active need a dense calibration set
+      calibration = sampleInputs(network, 20000);
+      evaluation = sampleInputs(network, 10000);
+    }
+
+    // the original network is written first to compare the file sizes
+    network.saveBinary(argv[2]);
+    size_t original_size = fileSize(argv[2]);
+    std::string original_summary = network.denseSummary();
+    Eigen::MatrixXf reference, pruned;
+    network.runBatch(evaluation, reference);
+    double original_batch = secondsPerSample(network, evaluation, true);
+    double original_single = secondsPerSample(network, evaluation, false);
+
+    size_t units = network.pruneNeurons(calibration, neuron_tolerance);
+    size_t blocks = block_tolerance >= 0.0f ? network.sparsify(calibration, block_tolerance) : 0;
+    network.saveBinary(argv[2]);
+    network.runBatch(evaluation, pruned);
+    double pruned_batch = secondsPerSample(network, evaluation, true);
+    double pruned_single = secondsPerSample(network, evaluation, false);
+
+    printf("%i calibration and %i evaluation samples, kernel %s\n",
+        (int)calibration.cols(), (int)evaluation.cols(), network.kernelName());
+    printf("original:\n%s", original_summary.c_str());
+    printf("pruned (%i units removed, %i zero blocks):\n%s", (int)units, (int)blocks, network.denseSummary().c_str());
+    printf("%-8s %14s %14s %14s %14s\n", "output", "range", "mean abs err", "max abs err", "rel. error");
+    const char* names[] = { "x", "y", "yaw" };
+    for (int i = 0; i < reference.rows(); i++) {
+      Eigen::ArrayXf error = (pruned.row(i) - reference.row(i)).array().abs();
+      float range = reference.row(i).maxCoeff() - reference.row(i).minCoeff();
+      std::string name = reference.rows() == 3 ? names[i] : std::to_string(i);
+      printf("%-8s %14.6g %14.6g %14.6g %13.3f%%\n", name.c_str(), range, error.mean(), error.maxCoeff(),
+          range > 0 ? 100.0 * error.mean() / range : 0.0);
+    }
+    printf("model size: original %i bytes, pruned %i bytes\n", (int)original_size, (int)fileSize(argv[2]));
+    printf("time per sample (batch): original %.0f ns, pruned %.0f ns\n", original_batch * 1e9, pruned_batch * 1e9);
+    printf("time per sample (single): original %.0f ns, pruned %.0f ns\n", original_single * 1e9, pruned_single * 1e9);
+  } catch (...) {
+    std::cerr << "Failed to prune " << argv[1] << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,112 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+
+/*
+ * Compares the int8 quantized network against the float network.
+ * The recorded inputs are split into a calibration and an evaluation half,
+ * without a recording both sets are sampled from the input range.
+ *
+ * Usage: quantization_report <model file> [<inputs.csv>]
+ */
+
+#include <push_prediction/neural_network.h>
+#include "model_inputs.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+static double secondsPerSample(NeuralNetwork& network, const Eigen::MatrixXf& inputs)
+{
+  Eigen::MatrixXf outputs;
+  const int repetitions = 20;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repetitions; i++)
+    network.runBatch(inputs, outputs);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (repetitions * inputs.cols());
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 2 && argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <model file> [<inputs.csv>]" << std::endl;
+    return 1;
+  }
+
+  try {
+    NeuralNetwork network;
+    network.load(argv[1]);
+    network.setQuantized(false);
+
+    Eigen::MatrixXf calibration, evaluation;
+    if (argc == 3) {
+      Eigen::MatrixXf inputs = loadInputsCSV(argv[2], network.inputSize());
+      if (inputs.cols() < 2) {
+        std::cerr << "Need at least two recorded inputs" << std::endl;
+        return 1;
+      }
+      calibration = inputs.leftCols(inputs.cols() / 2);
+      evaluation = inputs.rightCols(inputs.cols() - calibration.cols());
+    } else {
+      calibration = sampleInputs(network, 1000);
+      evaluation = sampleInputs(network, 10000);
+    }
+
+    Eigen::MatrixXf reference, quantized;
+    network.runBatch(evaluation, reference);
+    double float_time = secondsPerSample(network, evaluation);
+    network.quantize(calibration);
+    network.runBatch(evaluation, quantized);
+    double quantized_time = secondsPerSample(network, evaluation);
+
+    printf("%i calibration and %i evaluation samples, int8 kernel %s\n",
+        (int)calibration.cols(), (int)evaluation.cols(), network.kernelName());
+    printf("%-8s %14s %14s %14s %14s\n", "output", "range", "mean abs err", "max abs err", "rel. error");
+    const char* names[] = { "x", "y", "yaw" };
+    for (int i = 0; i < reference.rows(); i++) {
+      Eigen::ArrayXf error = (quantized.row(i) - reference.row(i)).array().abs();
+      float range = reference.row(i).maxCoeff() - reference.row(i).minCoeff();
+      std::string name = reference.rows() == 3 ? names[i] : std::to_string(i);
+      printf("%-8s %14.6g %14.6g %14.6g %13.3f%%\n", name.c_str(), range, error.mean(), error.maxCoeff(),
+          range > 0 ? 100.0 * error.mean() / range : 0.0);
+    }
+    printf("time per sample: float %.0f ns, int8 %.0f ns\n", float_time * 1e9, quantized_time * 1e9);
+  } catch (...) {
+    std::cerr << "Failed to evaluate " << argv[1] << std::endl;
+    return 1;
+  }
+  return 0;
+}
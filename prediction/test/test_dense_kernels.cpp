@@ -0,0 +1,188 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+#include <push_prediction/dense_kernels.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace push_prediction::kernels;
+
+namespace {
+
+  // plain W * x + b with the activation, W column-major (rows x cols), x one sample per column
+  std::vector<float> reference(const std::vector<float>& weights, const std::vector<float>& bias, size_t rows, size_t cols,
+      Activation activation, const std::vector<float>& input, size_t batch)
+  {
+    std::vector<float> output(rows * batch);
+    for (size_t j = 0; j < batch; j++) {
+      for (size_t r = 0; r < rows; r++) {
+        double sum = bias[r];
+        for (size_t c = 0; c < cols; c++)
+          sum += (double)weights[c * rows + r] * input[j * cols + c];
+        if (activation == RELU)
+          sum = std::max(sum, 0.0);
+        else if (activation == SIGMOID)
+          sum = 1.0 / (1.0 + std::exp(-sum));
+        output[j * rows + r] = sum;
+      }
+    }
+    return output;
+  }
+
+  std::vector<float> random(size_t size, std::mt19937& generator, float zeros = 0.0f)
+  {
+    std::uniform_real_distribution<float> value(-1.0f, 1.0f), uniform(0.0f, 1.0f);
+    std::vector<float> values(size);
+    for (float& v : values)
+      v = uniform(generator) < zeros ? 0.0f : value(generator);
+    return values;
+  }
+
+  // sizes around the panel width and the batch columns processed together by the kernels
+  const size_t ROWS[] = { 1, 3, 16, 17, 40 };
+  const size_t COLS[] = { 1, 2, 7, 33 };
+  const size_t BATCHES[] = { 1, 2, 3, 4, 5, 8, 9, 17 };
+  const Activation ACTIVATIONS[] = { LINEAR, RELU, SIGMOID };
+
+}
+
+TEST(DenseKernels, MatchReference)
+{
+  std::mt19937 generator(1);
+  for (const DenseKernel& kernel : availableKernels()) {
+    SCOPED_TRACE(kernel.name);
+    for (size_t rows : ROWS) for (size_t cols : COLS) for (size_t batch : BATCHES) for (Activation activation : ACTIVATIONS) {
+      const std::vector<float> weights = random(rows * cols, generator, 0.5f);
+      const std::vector<float> bias = random(rows, generator);
+      const std::vector<float> input = random(cols * batch, generator);
+      const std::vector<float> expected = reference(weights, bias, rows, cols, activation, input, batch);
+
+      std::vector<float> packed(packedSize(rows, cols)), sparse(sparsePackedSize(weights.data(), rows, cols));
+      packDense(weights.data(), bias.data(), nullptr, rows, cols, packed.data());
+      packSparseDense(weights.data(), bias.data(), nullptr, rows, cols, sparse.data());
+      std::vector<float> dense(rows * batch), blocks(rows * batch);
+      kernel.run(packed.data(), rows, cols, activation, input.data(), dense.data(), batch);
+      kernel.runSparse(sparse.data(), rows, cols, activation, input.data(), blocks.data(), batch);
+      for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_NEAR(dense[i], expected[i], 1e-5f) << rows << " x " << cols << ", batch " << batch << ", activation " << activation;
+        EXPECT_NEAR(blocks[i], expected[i], 1e-5f) << rows << " x " << cols << ", batch " << batch << ", activation " << activation;
+      }
+    }
+  }
+}
+
+TEST(DenseKernels, StridedRunsInPlace)
+{
+  std::mt19937 generator(2);
+  const size_t rows = 17, cols = 7, batch = 9, row = 5, col = 3, inputStride = 12, outputStride = 30;
+  const std::vector<float> weights = random(rows * cols, generator), bias = random(rows, generator);
+  const std::vector<float> input = random(inputStride * batch, generator);
+  std::vector<float> packed(packedSize(rows, cols));
+  packDense(weights.data(), bias.data(), nullptr, rows, cols, packed.data());
+
+  // the block of inputs (col ... col + cols - 1) of every sample
+  std::vector<float> block(cols * batch);
+  for (size_t j = 0; j < batch; j++)
+    std::copy(input.begin() + j * inputStride + col, input.begin() + j * inputStride + col + cols, block.begin() + j * cols);
+  const std::vector<float> expected = reference(weights, bias, rows, cols, RELU, block, batch);
+
+  for (const DenseKernel& kernel : availableKernels()) {
+    SCOPED_TRACE(kernel.name);
+    std::vector<float> output(outputStride * batch, -1.0f);
+    kernel.runStrided(packed.data(), rows, cols, RELU, input.data() + col, output.data() + row, batch, inputStride, outputStride);
+    for (size_t j = 0; j < batch; j++) {
+      for (size_t r = 0; r < outputStride; r++) {
+        if (r >= row && r < row + rows)
+          EXPECT_NEAR(output[j * outputStride + r], expected[j * rows + r - row], 1e-5f);
+        else
+          EXPECT_EQ(output[j * outputStride + r], -1.0f) << "wrote outside the block";
+      }
+    }
+  }
+}
+
+TEST(DenseKernels, QuantizedMatchReference)
+{
+  std::mt19937 generator(3);
+  for (const QuantizedDenseKernel& kernel : availableQuantizedKernels()) {
+    SCOPED_TRACE(kernel.name);
+    for (size_t rows : ROWS) for (size_t cols : COLS) for (size_t batch : BATCHES) for (Activation activation : ACTIVATIONS) {
+      const std::vector<float> weights = random(rows * cols, generator);
+      const std::vector<float> bias = random(rows, generator);
+      const std::vector<float> input = random(cols * batch, generator);
+      const std::vector<float> expected = reference(weights, bias, rows, cols, activation, input, batch);
+
+      std::vector<uint8_t> quantized(quantizedSize(rows, cols));
+      quantizeDense(weights.data(), bias.data(), rows, cols, 1.0f, quantized.data());
+      std::vector<float> output(rows * batch);
+      kernel.run(quantized.data(), rows, cols, activation, input.data(), output.data(), batch);
+      // 8 bit weights and inputs: the error grows with the square root of the inputs
+      for (size_t i = 0; i < expected.size(); i++)
+        EXPECT_NEAR(output[i], expected[i], 0.02f * std::sqrt((float)cols)) << rows << " x " << cols << ", batch " << batch;
+    }
+  }
+}
+
+TEST(DenseKernels, QuantizedKernelsAgree)
+{
+  std::mt19937 generator(4);
+  const size_t rows = 100, cols = 200, batch = 13;
+  const std::vector<float> weights = random(rows * cols, generator), bias = random(rows, generator);
+  const std::vector<float> input = random(cols * batch, generator);
+  std::vector<uint8_t> quantized(quantizedSize(rows, cols));
+  quantizeDense(weights.data(), bias.data(), rows, cols, 1.0f, quantized.data());
+  const QuantizedDenseKernel* generic = findQuantizedKernel("generic");
+  ASSERT_TRUE(generic);
+  for (const QuantizedDenseKernel& kernel : availableQuantizedKernels()) {
+    SCOPED_TRACE(kernel.name);
+    for (Activation activation : ACTIVATIONS) {
+      std::vector<float> expected(rows * batch), output(rows * batch);
+      generic->run(quantized.data(), rows, cols, activation, input.data(), expected.data(), batch);
+      kernel.run(quantized.data(), rows, cols, activation, input.data(), output.data(), batch);
+      for (size_t i = 0; i < expected.size(); i++)
+        EXPECT_NEAR(output[i], expected[i], 1e-4f);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
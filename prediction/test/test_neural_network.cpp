@@ -0,0 +1,300 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+#include <push_prediction/neural_network.h>
+#include "../src/tools/model_inputs.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+  const std::string MODELS[] = { "model_with_distance", "keras_model" };
+
+  std::string modelFile(const std::string& name)
+  {
+    return std::string(PUSH_PREDICTION_TEST_MODEL_DIR) + "/" + name + ".yaml";
+  }
+
+  // the fused kernels supported by this CPU
+  std::vector<std::string> kernelNames()
+  {
+    std::vector<std::string> names;
+    for (const push_prediction::kernels::DenseKernel& kernel : push_prediction::kernels::availableKernels())
+      names.push_back(kernel.name);
+    return names;
+  }
+
+  // unique file name in the temporary directory
+  std::string temporaryFile()
+  {
+    char name[] = "/tmp/test_neural_network_XXXXXX";
+    const int fd = mkstemp(name);
+    if (fd >= 0)
+      close(fd);
+    return name;
+  }
+
+  void expectNear(const Eigen::MatrixXf& actual, const Eigen::MatrixXf& expected, float tolerance)
+  {
+    ASSERT_EQ(actual.rows(), expected.rows());
+    ASSERT_EQ(actual.cols(), expected.cols());
+    for (int j = 0; j < expected.cols(); j++)
+      for (int i = 0; i < expected.rows(); i++)
+        EXPECT_NEAR(actual(i, j), expected(i, j), tolerance * std::max(1.0f, std::abs(expected(i, j)))) << "output " << i << ", sample " << j;
+  }
+
+}
+
+// run and runBatch on every fused kernel agree with the Eigen evaluation of the layers
+TEST(NeuralNetwork, KernelsMatchEigen)
+{
+  for (const std::string& model : MODELS) {
+    SCOPED_TRACE(model);
+    NeuralNetwork network;
+    network.load(modelFile(model));
+    // more samples than one block of forwardBlocks
+    const Eigen::MatrixXf inputs = sampleInputs(network, 300);
+    network.setKernel("eigen");
+    Eigen::MatrixXf expected;
+    network.runBatch(inputs, expected);
+
+    for (const std::string& kernel : kernelNames()) {
+      SCOPED_TRACE(kernel);
+      network.setKernel(kernel);
+      Eigen::MatrixXf batch, single(expected.rows(), expected.cols());
+      network.runBatch(inputs, batch);
+      for (int j = 0; j < inputs.cols(); j++) {
+        Eigen::VectorXf input = inputs.col(j), output;
+        network.run(input, output);
+        single.col(j) = output;
+      }
+      expectNear(batch, expected, 1e-4f);
+      expectNear(single, expected, 1e-4f);
+    }
+  }
+}
+
+// the stacked ensemble evaluates the members, on every kernel
+TEST(NeuralNetwork, StackedEnsembleMatchesMembers)
+{
+  for (const std::string& model : MODELS) {
+    SCOPED_TRACE(model);
+    auto member = std::make_shared<NeuralNetwork>();
+    member->load(modelFile(model));
+    member->setKernel("eigen");
+    NeuralNetwork ensemble;
+    ensemble.stack({ member, member, member });
+    ASSERT_EQ(ensemble.ensembleSize(), 3u);
+    const Eigen::MatrixXf inputs = sampleInputs(ensemble, 37);
+    Eigen::MatrixXf expected;
+    member->runBatch(inputs, expected);
+
+    std::vector<std::string> kernels = kernelNames();
+    kernels.push_back("eigen");
+    for (const std::string& kernel : kernels) {
+      SCOPED_TRACE(kernel);
+      ensemble.setKernel(kernel);
+      Eigen::MatrixXf outputs;
+      ensemble.runBatch(inputs, outputs);
+      ASSERT_EQ((size_t)outputs.rows(), 3 * expected.rows());
+      Eigen::VectorXf input = inputs.col(0), output;
+      ensemble.run(input, output);
+      for (int m = 0; m < 3; m++) {
+        expectNear(outputs.middleRows(m * expected.rows(), expected.rows()), expected, 1e-4f);
+        expectNear(output.segment(m * expected.rows(), expected.rows()), expected.col(0), 1e-4f);
+      }
+    }
+  }
+}
+
+// YAML export -> binary model -> memory-mapped network gives the same outputs
+TEST(NeuralNetwork, BinaryRoundTrip)
+{
+  for (const std::string& model : MODELS) {
+    SCOPED_TRACE(model);
+    NeuralNetwork network;
+    network.load(modelFile(model));
+    const Eigen::MatrixXf inputs = sampleInputs(network, 50);
+    const std::string binary = temporaryFile();
+
+    for (bool quantized : { false, true }) {
+      SCOPED_TRACE(quantized ? "quantized" : "float");
+      if (quantized)
+        network.quantize(inputs);
+      Eigen::MatrixXf expected, outputs;
+      network.runBatch(inputs, expected);
+      network.saveBinary(binary);
+      ASSERT_TRUE(NeuralNetwork::isBinaryModel(binary));
+      ASSERT_TRUE(NeuralNetwork::isCurrentBinaryModel(binary));
+
+      NeuralNetwork mapped;
+      mapped.load(binary);
+      EXPECT_EQ(mapped.inputSize(), network.inputSize());
+      EXPECT_EQ(mapped.outputSize(), network.outputSize());
+      EXPECT_EQ(mapped.isQuantized(), quantized);
+      mapped.runBatch(inputs, outputs);
+      // same packed weights, so the same results on the same kernel
+      expectNear(outputs, expected, 0.0f);
+    }
+    std::remove(binary.c_str());
+  }
+}
+
+// binary ensembles keep their members
+TEST(NeuralNetwork, BinaryEnsembleRoundTrip)
+{
+  auto member = std::make_shared<NeuralNetwork>();
+  member->load(modelFile(MODELS[0]));
+  NeuralNetwork ensemble;
+  ensemble.stack({ member, member });
+  const Eigen::MatrixXf inputs = sampleInputs(ensemble, 20);
+  Eigen::MatrixXf expected, outputs;
+  ensemble.runBatch(inputs, expected);
+  const std::string binary = temporaryFile();
+  ensemble.saveBinary(binary);
+
+  NeuralNetwork mapped;
+  mapped.load(binary);
+  EXPECT_EQ(mapped.ensembleSize(), 2u);
+  mapped.runBatch(inputs, outputs);
+  expectNear(outputs, expected, 0.0f);
+  std::remove(binary.c_str());
+}
+
+// the Jacobian matches finite differences of the network outputs
+TEST(NeuralNetwork, JacobianMatchesFiniteDifferences)
+{
+  // sampleInputs draws from std::rand
+  std::srand(1);
+  for (const std::string& model : MODELS) {
+    SCOPED_TRACE(model);
+    NeuralNetwork network;
+    network.load(modelFile(model));
+    const Eigen::MatrixXf inputs = sampleInputs(network, 20);
+    // steps relative to the spread of the sampled inputs
+    const Eigen::MatrixXf spread = sampleInputs(network, 100);
+    const Eigen::VectorXf range = spread.rowwise().maxCoeff() - spread.rowwise().minCoeff();
+
+    std::vector<std::string> kernels = kernelNames();
+    kernels.push_back("eigen");
+    for (const std::string& kernel : kernels) {
+      SCOPED_TRACE(kernel);
+      network.setKernel(kernel);
+      for (int j = 0; j < inputs.cols(); j++) {
+        Eigen::VectorXf input = inputs.col(j), output;
+        Eigen::MatrixXf jacobian;
+        network.jacobian(input, output, jacobian);
+        ASSERT_EQ((size_t)jacobian.rows(), network.outputSize());
+        ASSERT_EQ((size_t)jacobian.cols(), network.inputSize());
+
+        // a ReLU switching within a step bends the difference quotient on that side only,
+        // so every column has to match the central, forward or backward difference
+        const float scale = std::max(jacobian.cwiseAbs().maxCoeff(), 1e-3f);
+        for (int i = 0; i < input.size(); i++) {
+          const float step = 1e-4f * std::max(range(i), 1e-3f);
+          Eigen::VectorXf plus = input, minus = input, output_plus, output_minus;
+          plus(i) += step;
+          minus(i) -= step;
+          network.run(plus, output_plus);
+          network.run(minus, output_minus);
+          const float error = std::min({
+            (jacobian.col(i) - (output_plus - output_minus) / (plus(i) - minus(i))).cwiseAbs().maxCoeff(),
+            (jacobian.col(i) - (output_plus - output) / (plus(i) - input(i))).cwiseAbs().maxCoeff(),
+            (jacobian.col(i) - (output - output_minus) / (input(i) - minus(i))).cwiseAbs().maxCoeff() });
+          EXPECT_LT(error, 0.05f * scale) << "sample " << j << ", input " << i;
+        }
+      }
+    }
+  }
+}
+
+// interval bounds contain the outputs of all inputs in the box, including its corners
+TEST(NeuralNetwork, BoundsContainOutputs)
+{
+  std::srand(2);
+  for (const std::string& model : MODELS) {
+    SCOPED_TRACE(model);
+    auto member = std::make_shared<NeuralNetwork>();
+    member->load(modelFile(model));
+    NeuralNetwork ensemble;
+    ensemble.stack({ member, member });
+    const Eigen::MatrixXf centers = sampleInputs(*member, 10);
+    const Eigen::MatrixXf spread = sampleInputs(*member, 100);
+    const Eigen::VectorXf range = spread.rowwise().maxCoeff() - spread.rowwise().minCoeff();
+    const size_t inputs = member->inputSize();
+
+    for (NeuralNetwork* network : { member.get(), &ensemble }) {
+      SCOPED_TRACE(network->ensembleSize() > 1 ? "ensemble" : "single");
+      for (float width : { 0.0f, 0.01f, 0.1f }) {
+        for (int j = 0; j < centers.cols(); j++) {
+          const Eigen::VectorXf lower = centers.col(j) - 0.5f * width * range;
+          const Eigen::VectorXf upper = centers.col(j) + 0.5f * width * range;
+          Eigen::VectorXf output_lower, output_upper;
+          network->bounds(lower, upper, output_lower, output_upper);
+
+          // corners and random points of the box
+          Eigen::MatrixXf samples(inputs, (1 << inputs) + 50);
+          for (int c = 0; c < (1 << inputs); c++)
+            for (size_t i = 0; i < inputs; i++)
+              samples(i, c) = (c >> i) & 1 ? upper(i) : lower(i);
+          const Eigen::ArrayXXf uniform = (Eigen::ArrayXXf::Random(inputs, 50) + 1.0f) * 0.5f;
+          samples.rightCols(50) = ((uniform.colwise() * (upper - lower).array()).colwise() + lower.array()).matrix();
+          Eigen::MatrixXf outputs;
+          network->runBatch(samples, outputs);
+
+          // the bounds hold up to float rounding
+          const Eigen::VectorXf tolerance = 1e-4f * output_lower.cwiseAbs().cwiseMax(output_upper.cwiseAbs()).cwiseMax(1.0f);
+          EXPECT_TRUE((output_lower.array() <= output_upper.array()).all()) << "width " << width << ", box " << j;
+          const Eigen::ArrayXXf above_lower = (outputs.colwise() - output_lower).array().colwise() + tolerance.array();
+          const Eigen::ArrayXXf below_upper = (outputs.colwise() - output_upper).array().colwise() - tolerance.array();
+          EXPECT_TRUE((above_lower >= 0.0f).all()) << "width " << width << ", box " << j;
+          EXPECT_TRUE((below_upper <= 0.0f).all()) << "width " << width << ", box " << j;
+        }
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
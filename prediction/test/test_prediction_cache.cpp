@@ -0,0 +1,193 @@
+/*********************************************************************
+ * Software License Agreement (BSD License)
+ *
+ *  Copyright (c) 2018, Lars Henning Kayser
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *********************************************************************/
+
+/* Author: Lars Henning Kayser */
+
+
+#include <push_prediction/prediction_cache.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <vector>
+
+using push_prediction::PredictionCache;
+
+namespace {
+
+  PredictionCache::Key makeKey(int32_t i)
+  {
+    return PredictionCache::Key{{ i, -i, 2 * i, 0, 1 }};
+  }
+
+  // value stored for a key, so that lookups can be checked against the key
+  void makeValue(const PredictionCache::Key& key, float* value)
+  {
+    for (size_t v = 0; v < PredictionCache::VALUE_SIZE; v++)
+      value[v] = key[0] + 0.25f * v;
+  }
+
+}
+
+TEST(PredictionCache, QuantizeSharesCells)
+{
+  PredictionCache cache(64, 0.1);
+  PredictionCache::Key a, b, c;
+  const float x[] = { 0.51f, -0.29f, 0.0f };
+  const float y[] = { 0.59f, -0.21f, 0.09f };
+  const float z[] = { 0.61f, -0.29f, 0.0f };
+  ASSERT_TRUE(cache.quantize(x, 3, a));
+  ASSERT_TRUE(cache.quantize(y, 3, b));
+  ASSERT_TRUE(cache.quantize(z, 3, c));
+  EXPECT_EQ(a, b);
+  EXPECT_NE(a, c);
+  // unused key entries are zero
+  EXPECT_EQ(a[3], 0);
+  EXPECT_EQ(a[4], 0);
+
+  const float huge[] = { 1e12f };
+  const float nan[] = { std::numeric_limits<float>::quiet_NaN() };
+  EXPECT_FALSE(cache.quantize(huge, 1, a));
+  EXPECT_FALSE(cache.quantize(nan, 1, a));
+}
+
+TEST(PredictionCache, HitsAfterInsertion)
+{
+  PredictionCache cache(64, 0.1);
+  EXPECT_EQ(cache.capacity(), 64u);
+  float value[PredictionCache::VALUE_SIZE], expected[PredictionCache::VALUE_SIZE];
+  EXPECT_FALSE(cache.lookup(makeKey(1), value));
+
+  makeValue(makeKey(1), expected);
+  cache.insert(makeKey(1), expected);
+  ASSERT_TRUE(cache.lookup(makeKey(1), value));
+  for (size_t v = 0; v < PredictionCache::VALUE_SIZE; v++)
+    EXPECT_EQ(value[v], expected[v]);
+  EXPECT_FALSE(cache.lookup(makeKey(2), value));
+
+  // inserting a key again replaces its value in place
+  expected[0] = 42.0f;
+  cache.insert(makeKey(1), expected);
+  ASSERT_TRUE(cache.lookup(makeKey(1), value));
+  EXPECT_EQ(value[0], 42.0f);
+
+  const PredictionCache::Statistics statistics = cache.statistics();
+  EXPECT_EQ(statistics.hits, 2u);
+  EXPECT_EQ(statistics.misses, 2u);
+  EXPECT_EQ(statistics.insertions, 2u);
+  EXPECT_EQ(statistics.evictions, 0u);
+  EXPECT_EQ(statistics.size, 1u);
+}
+
+TEST(PredictionCache, EvictsLeastRecentlyUsed)
+{
+  // a single window: every key probes all slots
+  const size_t window = PredictionCache::WINDOW;
+  PredictionCache cache(window, 0.1);
+  ASSERT_EQ(cache.capacity(), window);
+  float value[PredictionCache::VALUE_SIZE];
+  for (size_t i = 0; i < window; i++) {
+    makeValue(makeKey(i), value);
+    cache.insert(makeKey(i), value);
+  }
+  EXPECT_EQ(cache.statistics().size, window);
+  EXPECT_EQ(cache.statistics().evictions, 0u);
+
+  // key 0 was inserted first but used last, so key 1 is the least recently used
+  ASSERT_TRUE(cache.lookup(makeKey(0), value));
+  makeValue(makeKey(100), value);
+  cache.insert(makeKey(100), value);
+  EXPECT_EQ(cache.statistics().evictions, 1u);
+  EXPECT_EQ(cache.statistics().size, window);
+  EXPECT_FALSE(cache.lookup(makeKey(1), value));
+  EXPECT_TRUE(cache.lookup(makeKey(0), value));
+  EXPECT_TRUE(cache.lookup(makeKey(100), value));
+  EXPECT_EQ(value[0], 100.0f);
+  for (size_t i = 2; i < window; i++)
+    EXPECT_TRUE(cache.lookup(makeKey(i), value)) << "key " << i;
+}
+
+TEST(PredictionCache, Clear)
+{
+  PredictionCache cache(64, 0.1);
+  float value[PredictionCache::VALUE_SIZE];
+  for (int i = 0; i < 10; i++) {
+    makeValue(makeKey(i), value);
+    cache.insert(makeKey(i), value);
+  }
+  cache.clear();
+  EXPECT_EQ(cache.statistics().size, 0u);
+  EXPECT_EQ(cache.statistics().insertions, 0u);
+  for (int i = 0; i < 10; i++)
+    EXPECT_FALSE(cache.lookup(makeKey(i), value));
+}
+
+// lookups racing with insertions, evictions and clear() only return values stored for their key
+TEST(PredictionCache, ConcurrentLookupsAreConsistent)
+{
+  PredictionCache cache(256, 0.1);
+  const int threads = 4;
+  std::atomic<int> finished(0), wrong(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t]() {
+      float value[PredictionCache::VALUE_SIZE], expected[PredictionCache::VALUE_SIZE];
+      for (int i = 0; i < 100000; i++) {
+        // more keys than slots, so slots are evicted all the time
+        const PredictionCache::Key key = makeKey((i * 7 + t * 13) % 1000);
+        makeValue(key, expected);
+        if (cache.lookup(key, value)) {
+          for (size_t v = 0; v < PredictionCache::VALUE_SIZE; v++)
+            wrong += value[v] != expected[v];
+        } else {
+          cache.insert(key, expected);
+        }
+      }
+      finished++;
+    });
+  }
+  while (finished < threads) {
+    cache.clear();
+    std::this_thread::yield();
+  }
+  for (std::thread& worker : workers)
+    worker.join();
+  EXPECT_EQ(wrong, 0);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}